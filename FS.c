@@ -1,6 +1,7 @@
 #define FUSE_USE_VERSION 30
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -9,6 +10,15 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /*
  * 编译和挂载文件系统说明
@@ -58,74 +68,120 @@
  */
 
 #define block_size 1024
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+#define IMAGE_FILE "fs.img"
+#define IMAGE_MAGIC 0x46534947u
 
 /*
  * superblock - 文件系统超级块结构
  *
  * 功能：
- * 1. 存储文件系统的全局元数据信息。
- * 2. 管理数据块和 inode 的分配状态。
+ * 1. 存储文件系统的全局元数据信息，位于镜像文件 fs.img 的开头。
+ * 2. 记录位图和数据区在镜像文件中的位置，以及数据块和 inode 的分配状态。
  *
  * 字段说明：
- * - datablocks: 数据块数组，存储文件系统的所有数据块。
- * - data_bitmap: 数据块位图，标识哪些数据块已被占用（'1'）或空闲（'0'）。
- * - inode_bitmap: inode 位图，标识哪些 inode 已被占用（'1'）或空闲（'0'）。
+ * - magic / blocksize: 用于识别镜像格式。
+ * - block_count / inode_count: 格式化时确定的数据块总数和 inode 总数。
+ * - free_blocks / free_inodes: 空闲数据块和空闲 inode 的数量，随位图一起保存。
+ * - checkpoint_lsn: 最近一次检查点已经包含的最大日志序列号（见 journal_append）。
+ * - inode_bitmap_offset / data_bitmap_offset / data_offset: 两个位图和数据区在镜像中的偏移。
+ *
+ * 镜像布局（以块为单位对齐）：
+ * | 超级块 | inode 位图 | 数据块位图 | 数据块 0, 1, 2, ... |
  *
  * 示例：
- * 假设文件系统刚初始化，调用 initialize_superblock() 后：
- * - spblock.data_bitmap 的所有位均为 '0'，表示所有数据块空闲。
- * - spblock.inode_bitmap 的所有位均为 '0'，表示所有 inode 空闲。
+ * 用 -o blocks=1048576 格式化时，数据区为 1 GB，数据块位图 128 KB，镜像文件以稀疏文件创建，
+ * 挂载时只读入超级块和两个位图，数据块通过 pread/pwrite 按需访问。
  *
  * 注意：
  * - 超级块是文件系统的核心数据结构，必须在文件系统初始化时调用 initialize_superblock() 方法。
- * - 数据块位图和 inode 位图的大小固定为 100 个字节。
+ * - 位图按 64 位字打包，最后一个字中超出总数的位始终置 1，分配时不会被选中。
+ * - 位图常驻内存（inode_bitmap / data_bitmap），在检查点时与超级块一起写回。
  */
 typedef struct superblock
 {
-	char datablocks[block_size * 100]; // 数据块数组，存储文件系统的所有数据块
-	char data_bitmap[105];			   // 数据块位图，标识数据块的占用状态
-	char inode_bitmap[105];			   // inode 位图，标识 inode 的占用状态
+	uint32_t magic;				  // IMAGE_MAGIC
+	uint32_t blocksize;			  // 块大小（block_size）
+	uint64_t block_count;		  // 数据块总数
+	uint64_t inode_count;		  // inode 总数
+	uint64_t free_blocks;		  // 空闲数据块数量
+	uint64_t free_inodes;		  // 空闲 inode 数量
+	uint64_t checkpoint_lsn;	  // 检查点已包含的最大日志序列号
+	uint64_t inode_bitmap_offset; // inode 位图在镜像中的偏移
+	uint64_t data_bitmap_offset;  // 数据块位图在镜像中的偏移
+	uint64_t data_offset;		  // 数据区在镜像中的偏移
 } superblock;
 
 /*
- * inode - 文件系统索引节点结构
+ * 挂载选项
+ *
+ * - lowlevel: 使用低层接口（-o lowlevel），默认使用高层路径接口。
+ * - blocks / inodes: 新建文件系统时的数据块数和 inode 数（-o blocks=N,inodes=N），
+ *   挂载已有镜像时不起作用。
+ * - readahead: 预读窗口的上限，单位 KB（-o readahead=N），0 表示关闭预读。
+ * - cache: 块缓存的容量，单位 MB（-o cache=N），0 表示关闭缓存。
+ * - flush_interval / dirty_ratio: 后台线程写回脏块的周期（秒）和触发立即写回的脏块比例（百分比），
+ *   见 cache_flusher。
+ * - trace: 把每次回调记录到这个文件中（-o trace=FILE），见 trace_record，默认不记录。
+ */
+struct fs_config
+{
+	int lowlevel;
+	unsigned long blocks;
+	unsigned long inodes;
+	unsigned long readahead;
+	unsigned long cache;
+	unsigned long flush_interval;
+	unsigned long dirty_ratio;
+	char *trace;
+} fs_config = {0, 65536, 65536, 1024, 64, 5, 20, NULL};
+
+/*
+ * extent - 一段连续的数据块
  *
  * 功能：
- * 1. 存储文件或目录的元数据信息。
- * 2. 管理文件数据块的分配和引用。
- *
- * 字段说明：
- * - datablocks: 数据块编号数组，存储文件数据所在的数据块。
- * - number: inode 的唯一标识符。
- * - blocks: 文件占用的数据块数量。
- * - size: 文件或目录的大小（以字节为单位）。
+ * 1. 把文件内从 logical 开始的 len 个逻辑块映射到从 start 开始的 len 个连续物理块。
+ * 2. 每个文件的 extent 按 logical 排序，查找时二分。
  *
  * 示例：
- * 假设文件系统结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
- *
- * inode 示例：
- * inode (test.txt):
- * - datablocks: [5, 6, 7]  // 文件数据存储在数据块 5、6、7 中
- * - number: 3              // inode 编号为 3
- * - blocks: 3              // 文件占用 3 个数据块
- * - size: 3072             // 文件大小为 3072 字节
+ * 一个顺序写入的 40 KB 文件如果分到了连续的 40 个块，只需要一个 extent：
+ * {logical = 0, start = 17, len = 40}
  *
  * 注意：
- * - inode 是文件系统的核心数据结构，用于管理文件的元数据和数据块。
- * - 每个文件或目录都有一个唯一的 inode。
+ * - extent 不超过 EXTENT_INLINE 个时直接存在 inode 记录中，
+ *   否则存放在由 extent_block_header 串起来的数据块链中（见 node_to_disk）。
  */
-typedef struct inode
+#define EXTENT_INLINE 4
+
+typedef struct extent
+{
+	uint32_t logical; // 文件内的起始逻辑块号
+	uint32_t start;	  // 起始物理块号
+	uint32_t len;	  // 连续的块数
+} extent;
+
+typedef struct extent_block_header
+{
+	uint32_t next;	// 链中下一个 extent 块，0 表示结束
+	uint32_t count; // 本块中的 extent 数量
+} extent_block_header;
+
+#define EXTENTS_PER_BLOCK ((block_size - sizeof(extent_block_header)) / sizeof(extent))
+
+/*
+ * name_ref - 名称池中的一个名称
+ *
+ * 字段说明：
+ * - off: 名称在名称池中的偏移（见 name_intern），名称以 '\0' 结尾。
+ * - len: 名称长度，不含 '\0'。
+ * - hash: 名称的哈希值（name_hash），目录哈希索引和驻留表都用它。
+ */
+typedef struct name_ref
 {
-	int datablocks[16]; // 数据块编号数组，存储文件数据所在的数据块
-	int number;			// inode 的唯一标识符
-	int blocks;			// 文件占用的数据块数量
-	// int link;                    //==number of links
-	int size; // 文件或目录的大小（以字节为单位）
-} inode;
+	uint32_t off;
+	uint16_t len;
+	unsigned int hash;
+} name_ref;
 
 /*
  * filetype - 文件/目录元数据结构
@@ -136,16 +192,14 @@ typedef struct inode
  *
  * 字段说明：
  * - valid: 标识节点是否有效（1 表示有效，0 表示无效）。
- * - test: 保留字段，未使用。
- * - path: 文件或目录的完整路径。
- * - name: 文件或目录的名称。
- * - inum: 指向关联的 inode 结构。
- * - children: 子节点指针数组，用于存储目录的子文件或子目录。
+ * - lock: 节点锁，4 字节的读写锁，见 node_rdlock。
+ * - name: 名称在名称池中的引用 (偏移, 长度, 哈希)，见 name_ref。完整路径不保存，需要时由 node_path 拼出。
+ * - children: 子节点指针数组，按加入的先后排列，删除留下的空位为 NULL（见 remove_child）。
  * - num_children: 子节点数量。
+ * - children_end: children 中已经使用的长度（包括空位）。
  * - num_links: 硬链接数。
  * - parent: 指向父目录的指针。
- * - type: 文件类型（如 "file" 或 "directory"）。
- * - permissions: 文件或目录的权限模式（如 0777）。
+ * - permissions: 文件类型（S_IFDIR / S_IFREG）和权限位（如 0777）。
  * - user_id: 文件或目录的用户 ID。
  * - group_id: 文件或目录的组 ID。
  * - a_time: 最后访问时间。
@@ -153,9 +207,16 @@ typedef struct inode
  * - c_time: 最后状态更改时间。
  * - b_time: 创建时间。
  * - size: 文件或目录的大小（以字节为单位）。
- * - datablocks: 数据块编号数组，存储文件数据所在的数据块。
+ * - extents / num_extents / extents_capacity: 按逻辑块号排序的 extent 数组，写入时按需分配。
+ * - extent_blocks / num_extent_blocks: extent 超过 EXTENT_INLINE 个时用来保存它们的数据块。
  * - number: 文件或目录的编号（唯一标识）。
  * - blocks: 文件占用的数据块数量。
+ * - dirty: 自上次写回以来是否被修改（1 表示需要写回）。
+ * - dir_index: 目录的子节点哈希索引（见 dir_table）。
+ * - children_capacity: children 数组的容量。
+ * - child_slot: 本节点在父目录 children 数组中的下标。
+ * - dir_pos: 本节点在父目录中的位置，加入时分配、之后不变，用作 readdir 的偏移量（见 ll_readdir）。
+ * - open_count / nlookup: 打开的句柄数和低层接口下内核持有的 lookup 引用数，见 node_forgotten。
  *
  * 示例：
  * 假设文件系统结构如下：
@@ -167,10 +228,8 @@ typedef struct inode
  * 文件类型示例：
  * Filetype (Root):
  * - valid: 1
- * - path: "/"
  * - name: "/"
- * - type: "directory"
- * - permissions: 0777
+ * - permissions: S_IFDIR | 0777
  * - user_id: 1000
  * - group_id: 1000
  * - a_time: 1698765432
@@ -186,589 +245,5646 @@ typedef struct inode
  * - num_links: 2
  *
  * 注意：
- * - 文件类型和目录类型使用相同的结构体。
+ * - 文件类型和目录类型使用相同的结构体，用 S_ISDIR(permissions) 区分。
+ *   只属于目录的字段（children、dir_index 等）和只属于文件的字段（extents 等）共用一个 union，
+ *   访问之前要先确认节点的类型；dir_lookup 对文件返回 NULL，创建时父节点不是目录返回 -ENOTDIR。
  * - 目录的 size 字段通常表示目录元数据的大小。
+ * - 节点常驻内存，大小直接决定大目录树的内存占用：字段按大小排列避免填充，
+ *   valid / dirty 只占一个字节，节点锁是 4 字节的 futex 锁而不是 56 字节的 pthread_rwlock_t。
  */
 typedef struct filetype
 {
-	int valid;					// 标识节点是否有效
-	char test[10];				// 保留字段，未使用
-	char path[100];				// 文件或目录的完整路径
-	char name[100];				// 文件或目录的名称
-	inode *inum;				// 指向关联的 inode 结构
-	struct filetype **children; // 子节点指针数组
-	int num_children;			// 子节点数量
+	name_ref name;				// 名称（名称池中的偏移、长度和哈希）
+	uint8_t valid;				// 标识节点是否有效
+	uint8_t dirty;				// 自上次写回以来是否被修改
+	unsigned int lock;			// 节点锁，见“并发控制”和 node_rdlock
+	int number;					// 文件或目录的编号
 	int num_links;				// 硬链接数
-	struct filetype *parent;	// 指向父目录的指针
-	char type[20];				// 文件类型（如 "file" 或 "directory"）
-	mode_t permissions;			// 文件或目录的权限模式
+	mode_t permissions;			// 文件类型和权限模式
 	uid_t user_id;				// 用户 ID
 	gid_t group_id;				// 组 ID
+	int blocks;					// 文件占用的数据块数量
+	int open_count;				// 打开的句柄数
+	uint32_t dir_pos;			// 本节点在父目录中的位置（readdir 的偏移量）
+	int child_slot;				// 本节点在父目录 children 数组中的下标
+	struct filetype *parent;	// 指向父目录的指针
 	time_t a_time;				// 最后访问时间
 	time_t m_time;				// 最后修改时间
 	time_t c_time;				// 最后状态更改时间
 	time_t b_time;				// 创建时间
 	off_t size;					// 文件或目录的大小
-	int datablocks[16];			// 数据块编号数组
-	int number;					// 文件或目录的编号
-	int blocks;					// 文件占用的数据块数量
+	unsigned long nlookup;		// 低层接口下内核持有的 lookup 引用数
+	union
+	{
+		struct // 目录
+		{
+			struct filetype **children;	 // 子节点指针数组
+			struct dir_table *dir_index; // 子节点哈希索引（开放定址）
+			int num_children;			 // 子节点数量
+			int children_capacity;		 // children 数组的容量
+			int children_end;			 // children 中已经使用的长度（包括空位）
+		};
+		struct // 文件
+		{
+			extent *extents;	   // 按逻辑块号排序的 extent 数组
+			int *extent_blocks;	   // 保存 extent 的数据块链
+			int num_extents;	   // extent 数量
+			int extents_capacity;  // extents 数组的容量
+			int num_extent_blocks; // extent_blocks 的数量
+		};
+	};
 } filetype;
 
-superblock spblock;
 /*
- * initialize_superblock - 初始化超级块
+ * open_file - 打开文件的句柄
  *
  * 功能：
- * 1. 初始化文件系统的超级块结构。
- * 2. 将数据块位图和 inode 位图初始化为全 0，表示所有数据块和 inode 均为空闲状态。
+ * 1. open / create 时分配，指针保存在 fuse_file_info->fh 中，release 时释放。
+ * 2. read / write 直接从句柄取得节点，不再解析路径。
  *
- * 参数：
- * - 无。
+ * 字段说明：
+ * - node: 打开的文件节点。文件被删除后节点仍然保留，直到最后一个句柄关闭。
+ * - extent_cursor: 上次访问的 extent 下标，顺序访问时不必重新二分查找。
+ * - next_offset / last_offset / stride / hits: 预读的访问模式识别状态（见 readahead_update）。
+ * - ra_end / ra_size: 已经预读到的位置和当前预读窗口大小。
+ * - lock: 同一个句柄上可能有并发的读请求，保护以上状态。
+ * - snapshot / snapshot_len: 打开 /.fsstats 时生成的统计文本（见 stats_open），此时 node 为 NULL。
+ */
+typedef struct open_file
+{
+	filetype *node;
+	int extent_cursor;
+	off_t next_offset;
+	off_t last_offset;
+	off_t stride;
+	int hits;
+	off_t ra_end;
+	size_t ra_size;
+	pthread_mutex_t lock;
+	char *snapshot;
+	size_t snapshot_len;
+} open_file;
+
+/*
+ * 并发控制
  *
- * 返回值：
- * - 无。
+ * fuse_main 默认用多个线程同时调用回调函数，文件系统使用以下几类锁：
  *
- * 实现逻辑：
- * 1. 使用 memset 将数据块位图（spblock.data_bitmap）初始化为全 0。
- * 2. 使用 memset 将 inode 位图（spblock.inode_bitmap）初始化为全 0。
+ * 1. fs_lock（大读者锁）：普通回调以共享方式进入；rename 和检查点独占。
+ *    rename 会改写整棵子树的路径并可能跨目录移动，检查点要遍历整棵树，二者都需要独占。
+ *    共享进入只写本线程的 reader_record，不同线程之间没有共享的写，见 fs_enter。
+ * 2. 节点锁 filetype->lock（读写锁，见 node_rdlock）：
+ *    - 目录：保护 children、num_children 和哈希索引的修改。add_child / remove_child 持写锁，
+ *      readdir 持读锁。路径查找（dir_lookup）不加锁。
+ *    - 文件：保护 extent 和 size。读文件持读锁，写文件持写锁。
+ *    - nlookup、open_count 和 valid 在节点的写锁下修改。
+ * 3. 分配器分片锁：位图切成 ALLOC_SHARDS 段，每段一把互斥锁，见 bitmap_allocator。
+ * 4. 叶子锁：freed_lock、cache.lock、journal_lock、open_file->lock。
+ *    持有叶子锁时不再获取其他锁。
  *
- * 示例：
- * 假设文件系统刚创建，调用 initialize_superblock() 后：
- * - spblock.data_bitmap 的所有位均为 0，表示所有数据块空闲。
- * - spblock.inode_bitmap 的所有位均为 0，表示所有 inode 空闲。
+ * 加锁顺序：
+ * fs_lock -> 父目录 -> 子节点 -> 叶子锁。
  *
  * 注意：
- * - 超级块是文件系统的核心数据结构，必须在文件系统初始化时调用此方法。
- * - 数据块位图和 inode 位图的大小固定为 100 个字节。
+ * - 已删除的节点在 forget_inode 之后交给 rcu_retire_with 延迟回收，fs_enter / fs_leave 之间
+ *   不持锁得到的节点指针可以安全访问，加锁之后再检查 valid（或 node_forgotten）判断它是否已经被删除。
+ * - 目录哈希表和路径缓存项被替换后不能立即释放，同样交给 rcu_retire 延迟回收。
+ * - 日志在持有相应节点锁时追加，保证日志中的顺序与操作实际生效的顺序一致。
+ * - 日志写满时 journal_append 只置 checkpoint_wanted，由 fs_leave 在退出共享状态之后
+ *   以独占方式重新进入完成检查点。
+ * - fs_enter / fs_leave 可以嵌套（低层接口会调用高层回调），只有最外层真正加锁。
+ * - a_time 在读锁下更新，使用原子操作读写。
  */
-void initialize_superblock()
-{
-
-	memset(spblock.data_bitmap, '0', 100 * sizeof(char));
-	memset(spblock.inode_bitmap, '0', 100 * sizeof(char));
-}
-
-filetype *root;
-
-filetype file_array[50];
 
 /*
- * tree_to_array - 将文件树结构序列化为数组
+ * node_rdlock / node_wrlock / node_unlock - 节点锁的加锁和解锁
  *
  * 功能：
- * 1. 通过广度优先遍历（BFS）将文件树结构扁平化为数组。
- * 2. 将树中的每个节点按遍历顺序存储到数组中。
- * 3. 使用无效节点（valid = 0）填充空位，确保数组长度固定。
- *
- * 参数：
- * - queue: 用于广度优先遍历的队列，存储待处理的节点。
- * - front: 队列的起始索引，指向当前处理的节点。
- * - rear: 队列的结束索引，指向下一个可插入的位置。
- * - index: 当前数组的索引，指向下一个可存储的位置。
+ * 1. 与默认属性的 pthread_rwlock_t 语义相同（读者优先，读锁可以重入），
+ *    但只占节点中的 4 个字节；pthread_rwlock_t 占 56 个字节，是节点中最大的字段。
  *
  * 实现逻辑：
- * 1. 从队列中取出当前节点（queue[*front]），并将其存储到数组（file_array[*index]）中。
- * 2. 如果当前节点有效（valid = 1），将其子节点加入队列。
- * 3. 如果当前节点无效或子节点不足 5 个，用无效节点填充队列。
- * 4. 递归处理队列中的下一个节点，直到队列为空或数组已满。
- *
- * 示例：
- * 假设文件树结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
- *
- * 序列化后的数组布局如下：
- * Filetype 0 (Root):
- * - valid: 1
- * - path: "/"
- * - name: "/"
- * - type: "directory"
- * - children: [Filetype 1, Filetype 2]
- *
- * Filetype 1 (home):
- * - valid: 1
- * - path: "/home"
- * - name: "home"
- * - type: "directory"
- * - children: [Filetype 3]
- *
- * Filetype 2 (test.txt):
- * - valid: 1
- * - path: "/test.txt"
- * - name: "test.txt"
- * - type: "file"
- * - children: []
- *
- * Filetype 3 (user):
- * - valid: 1
- * - path: "/home/user"
- * - name: "user"
- * - type: "directory"
- * - children: []
- *
- * Filetype 4-30:
- * - valid: 0 (无效节点，用于占位)
+ * 1. lock 的低位是持有读锁的线程数，NODE_LOCK_WRITER 表示写者持有，NODE_LOCK_WAITERS 表示有线程在等待。
+ * 2. 加锁用 CAS；拿不到时置 NODE_LOCK_WAITERS，在 futex 上等待 lock 改变后重试。
+ * 3. 写者解锁或最后一个读者解锁时把 lock 清零，之前有等待者时唤醒全部等待者重新竞争。
  *
  * 注意：
- * - 数组长度固定为 31，包括无效节点。
- * - 每个节点最多有 5 个子节点。
+ * - 没有竞争时加锁和解锁各是一次 CAS，不进入内核。
+ * - node_unlock 同时用于释放读锁和写锁。
  */
-void tree_to_array(filetype *queue, int *front, int *rear, int *index)
-{
+#define NODE_LOCK_WRITER 0x80000000u
+#define NODE_LOCK_WAITERS 0x40000000u
 
-	if (rear < front)
-		return;
-	if (*index > 30)
+void node_lock_wait(unsigned int *lock, unsigned int seen)
+{
+	// 置等待标志失败说明 lock 已经改变，由调用方重试
+	if (!(seen & NODE_LOCK_WAITERS) &&
+		!__atomic_compare_exchange_n(lock, &seen, seen | NODE_LOCK_WAITERS, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
 		return;
+	syscall(SYS_futex, lock, FUTEX_WAIT_PRIVATE, seen | NODE_LOCK_WAITERS, NULL, NULL, 0);
+}
 
-	filetype curr_node = queue[*front];
-	*front += 1;
-	file_array[*index] = curr_node;
-	*index += 1;
+void node_rdlock(filetype *node)
+{
+	unsigned int seen = __atomic_load_n(&node->lock, __ATOMIC_RELAXED);
 
-	if (*index < 6)
+	for (;;)
 	{
-
-		if (curr_node.valid)
+		if (seen & NODE_LOCK_WRITER)
 		{
-			int n = 0;
-			int i;
-			for (i = 0; i < curr_node.num_children; i++)
-			{
-				if (*rear < *front)
-					*rear = *front;
-				queue[*rear] = *(curr_node.children[i]);
-				*rear += 1;
-			}
-			while (i < 5)
-			{
-				filetype waste_node;
-				waste_node.valid = 0;
-				queue[*rear] = waste_node;
-				*rear += 1;
-				i++;
-			}
+			node_lock_wait(&node->lock, seen);
+			seen = __atomic_load_n(&node->lock, __ATOMIC_RELAXED);
 		}
-		else
+		else if (__atomic_compare_exchange_n(&node->lock, &seen, seen + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+void node_wrlock(filetype *node)
+{
+	unsigned int seen = __atomic_load_n(&node->lock, __ATOMIC_RELAXED);
+
+	for (;;)
+	{
+		if (seen & ~NODE_LOCK_WAITERS)
 		{
-			int i = 0;
-			while (i < 5)
-			{
-				filetype waste_node;
-				waste_node.valid = 0;
-				queue[*rear] = waste_node;
-				*rear += 1;
-				i++;
-			}
+			node_lock_wait(&node->lock, seen);
+			seen = __atomic_load_n(&node->lock, __ATOMIC_RELAXED);
 		}
+		else if (__atomic_compare_exchange_n(&node->lock, &seen, seen | NODE_LOCK_WRITER, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
 	}
+}
 
-	tree_to_array(queue, front, rear, index);
+void node_unlock(filetype *node)
+{
+	unsigned int seen = __atomic_load_n(&node->lock, __ATOMIC_RELAXED), next;
+
+	do
+	{
+		next = (seen & NODE_LOCK_WRITER) ? 0 : seen - 1;
+		if ((next & ~NODE_LOCK_WAITERS) == 0)
+			next = 0;
+	} while (!__atomic_compare_exchange_n(&node->lock, &seen, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if ((seen & NODE_LOCK_WAITERS) && next == 0)
+		syscall(SYS_futex, &node->lock, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
 }
 
 /*
- * save_contents - 保存文件系统内容到磁盘
+ * reader_record - 每个线程的读者记录
  *
  * 功能：
- * 1. 将内存中的文件树结构通过广度优先遍历序列化为数组。
- * 2. 将序列化后的数组和超级块分别保存到 `file_structure.bin` 和 `super.bin` 文件中。
- *
- * 文件布局：
- * - `file_structure.bin` 存储文件树的所有节点信息，按广度优先遍历顺序扁平化为数组。
- *   - 每个节点包含文件/目录的元数据，如路径、名称、类型、权限、时间戳等。
- *   - 无效节点（valid = 0）用于占位，确保数组长度固定。
- *   - 在内存中，通过 children 指针重建树结构。
- * - `super.bin` 存储超级块信息，包括数据块和 inode 的位图。
- *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
- *
- * `file_structure.bin` 的布局可能如下：
- * Filetype 0 (Root):
- * - valid: 1
- * - path: "/"
- * - name: "/"
- * - type: "directory"
- * - children: [Filetype 1, Filetype 2]
- *
- * Filetype 1 (home):
- * - valid: 1
- * - path: "/home"
- * - name: "home"
- * - type: "directory"
- * - children: [Filetype 3]
- *
- * Filetype 2 (test.txt):
- * - valid: 1
- * - path: "/test.txt"
- * - name: "test.txt"
- * - type: "file"
- * - children: []
- *
- * Filetype 3 (user):
- * - valid: 1
- * - path: "/home/user"
- * - name: "user"
- * - type: "directory"
- * - children: []
- *
- * Filetype 4-30:
- * - valid: 0 (无效节点，用于占位)
- *
- * 流程：
- * 1. 初始化队列，将根节点加入队列。
- * 2. 通过广度优先遍历将文件树序列化为数组。
- * 3. 将序列化后的数组写入 `file_structure.bin`。
- * 4. 将超级块写入 `super.bin`。
+ * 1. 实现 fs_lock：active 表示线程在 fs_enter / fs_leave 之间。
+ * 2. 实现纪元回收：epoch 是线程进入时看到的全局纪元，limbo 是本线程退休、尚未释放的对象。
+ * 3. 保存本线程的操作统计（stats），见“操作统计”。
+ * 4. 保存本线程的请求临时内存（scratch），见 scratch_alloc。
+ * 5. 保存本线程的空闲路径缓存条目，见 dcache_alloc。
  *
  * 注意：
- * - 文件树最多支持 31 个节点（包括无效节点）。
- * - 每个节点最多有 5 个子节点。
+ * - 记录只增不减，线程退出时由 pthread_key 的析构函数归还（in_use = 0），供新线程复用。
+ * - 按缓存行对齐，不同线程的记录不会落在同一缓存行上。
  */
-int save_contents()
+typedef struct reader_record
 {
-	printf("SAVING\n");
-	filetype *queue = malloc(sizeof(filetype) * 60);
-	int front = 0;
-	int rear = 0;
-	queue[0] = *root;
-	int index = 0;
-	tree_to_array(queue, &front, &rear, &index);
+	int active;					// 是否在 fs_enter / fs_leave 之间
+	int in_use;					// 是否属于某个线程
+	unsigned long epoch;		// 进入时看到的全局纪元
+	struct rcu_item *limbo;		// 已退休、等待释放的对象
+	int limbo_count;			// limbo 中的对象数
+	int limbo_capacity;			// limbo 数组的容量
+	int limbo_limit;			// limbo_count 达到该值时尝试回收
+	struct op_stats *stats;		// 本线程的操作统计，见 stats_record
+	char *scratch;				// 本线程的请求临时内存，见 scratch_alloc
+	size_t scratch_top;			// scratch 中已分配的字节数（包括溢出部分）
+	struct scratch_block *scratch_overflow; // scratch 中放不下、单独分配的块
+	struct dcache_entry *dcache_free;		 // 本线程的空闲路径缓存条目
+	struct reader_record *next; // 全局链表中的下一条记录
+} __attribute__((aligned(64))) reader_record;
 
-	for (int i = 0; i < 31; i++)
-	{
-		printf("%d", file_array[i].valid);
-	}
+/*
+ * rcu_item - limbo 中的一个对象及释放它的函数
+ */
+typedef struct rcu_item
+{
+	void *ptr;
+	void (*release)(void *);
+	unsigned long epoch; // 对象退休时的纪元
+} rcu_item;
 
-	FILE *fd = fopen("file_structure.bin", "wb");
+#define RCU_BATCH 64
 
-	FILE *fd1 = fopen("super.bin", "wb");
+reader_record *reader_records = NULL;
+pthread_key_t reader_key;
+pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+__thread reader_record *reader_self = NULL;
 
-	fwrite(file_array, sizeof(filetype) * 31, 1, fd);
-	fwrite(&spblock, sizeof(superblock), 1, fd1);
+__thread int fs_lock_depth = 0;
+__thread int fs_lock_exclusive = 0;
+int fs_writer = 0;
+pthread_mutex_t fs_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long rcu_epoch = 1;
+int checkpoint_wanted = 0;
 
-	fclose(fd);
-	fclose(fd1);
+int journal_checkpoint();
+extern int journal_replaying;
 
-	printf("\n");
+void reader_release(void *arg)
+{
+	reader_record *r = (reader_record *)arg;
+	__atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+void reader_key_init()
+{
+	pthread_key_create(&reader_key, reader_release);
 }
 
 /*
- * initialize_root_directory - 初始化根目录
- *
- * 功能：
- * 1. 创建并初始化文件系统的根目录。
- * 2. 设置根目录的元数据，包括路径、名称、类型、权限、时间戳等。
- * 3. 标记根目录的 inode 为已使用。
- * 4. 调用 save_contents 方法将初始化后的文件系统保存到磁盘。
+ * reader_self_record - 取得当前线程的读者记录，第一次调用时认领或新建一条
+ */
+reader_record *reader_self_record()
+{
+	if (reader_self != NULL)
+		return reader_self;
+
+	pthread_once(&reader_once, reader_key_init);
+	for (reader_record *r = __atomic_load_n(&reader_records, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+	{
+		int free_record = 0;
+		if (__atomic_compare_exchange_n(&r->in_use, &free_record, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			reader_self = r;
+			break;
+		}
+	}
+
+	if (reader_self == NULL)
+	{
+		reader_record *r;
+		if (posix_memalign((void **)&r, 64, sizeof(reader_record)) != 0)
+			abort();
+		memset(r, 0, sizeof(reader_record));
+		r->in_use = 1;
+		r->limbo_limit = RCU_BATCH;
+		r->next = __atomic_load_n(&reader_records, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&reader_records, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		reader_self = r;
+	}
+
+	pthread_setspecific(reader_key, reader_self);
+	return reader_self;
+}
+
+/*
+ * fs_enter - 以共享方式进入文件系统
  *
  * 实现逻辑：
- * 1. 在 inode 位图中标记根目录的 inode 为已使用（spblock.inode_bitmap[1] = 1）。
- * 2. 分配内存并初始化根目录结构（filetype）。
- * 3. 设置根目录的路径为 "/"，名称为 "/"。
- * 4. 设置根目录的类型为 "directory"，权限为 0777。
- * 5. 初始化时间戳（创建时间、访问时间、修改时间等）。
- * 6. 设置根目录的 inode 编号为 2。
- * 7. 调用 save_contents 方法保存文件系统。
- *
- * 初始化后的根目录结构示例：
- * Filetype (Root):
- * - valid: 1
- * - path: "/"
- * - name: "/"
- * - type: "directory"
- * - permissions: 0777
- * - user_id: 当前用户ID
- * - group_id: 当前组ID
- * - a_time: 当前时间
- * - m_time: 当前时间
- * - c_time: 当前时间
- * - b_time: 当前时间
- * - size: 0
- * - number: 2 (inode 编号)
- * - blocks: 0
- * - children: NULL
- * - num_children: 0
- * - parent: NULL
- * - num_links: 2
+ * 1. 先置 active 并记录当前纪元，再检查 fs_writer（两步都是顺序一致的原子操作）。
+ * 2. 没有独占者时直接返回，整个过程只写本线程的记录。
+ * 3. 有独占者时撤销 active，在 fs_writer_lock 上等它结束后重试。
  *
  * 注意：
- * - 根目录的 inode 编号固定为 2。
- * - 根目录是文件系统的起点，所有其他文件和目录都是其子节点。
+ * - 独占者先置 fs_writer 再检查所有 active，读者先置 active 再检查 fs_writer，
+ *   二者至少有一方能看到对方，不会同时进入。
  */
-void initialize_root_directory()
+void fs_enter()
 {
+	reader_record *self = reader_self_record();
+	if (fs_lock_depth++ > 0)
+		return;
 
-	spblock.inode_bitmap[1] = 1; // marking it with 0
-	root = (filetype *)malloc(sizeof(filetype));
-
-	strcpy(root->path, "/");
-	strcpy(root->name, "/");
+	for (;;)
+	{
+		__atomic_store_n(&self->active, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&self->epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+		if (!__atomic_load_n(&fs_writer, __ATOMIC_SEQ_CST))
+			return;
+
+		__atomic_store_n(&self->active, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_lock(&fs_writer_lock);
+		pthread_mutex_unlock(&fs_writer_lock);
+	}
+}
 
-	root->children = NULL;
-	root->num_children = 0;
-	root->parent = NULL;
-	root->num_links = 2;
-	root->valid = 1;
-	strcpy(root->test, "test");
-	// root -> type = malloc(10);
-	strcpy(root->type, "directory");
+/*
+ * fs_enter_exclusive - 以独占方式进入文件系统
+ *
+ * 实现逻辑：
+ * 1. 获取 fs_writer_lock（独占者之间互斥）并置 fs_writer，新的读者会退让。
+ * 2. 等待所有已经进入的读者离开。
+ */
+void fs_enter_exclusive()
+{
+	reader_record *self = reader_self_record();
+	if (fs_lock_depth++ > 0)
+		return;
 
-	root->c_time = time(NULL);
-	root->a_time = time(NULL);
-	root->m_time = time(NULL);
-	root->b_time = time(NULL);
+	pthread_mutex_lock(&fs_writer_lock);
+	__atomic_store_n(&fs_writer, 1, __ATOMIC_SEQ_CST);
+	for (reader_record *r = __atomic_load_n(&reader_records, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+	{
+		while (__atomic_load_n(&r->active, __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
 
-	root->permissions = S_IFDIR | 0777;
+	fs_lock_exclusive = 1;
+	// 独占期间本线程也算作读者，它持有的对象不会被回收
+	__atomic_store_n(&self->active, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&self->epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
 
-	root->size = 0;
-	root->group_id = getgid();
-	root->user_id = getuid();
+void fs_leave()
+{
+	if (--fs_lock_depth > 0)
+		return;
 
-	root->number = 2;
-	// root -> size = 0;
-	root->blocks = 0;
+	__atomic_store_n(&reader_self->active, 0, __ATOMIC_SEQ_CST);
+	if (fs_lock_exclusive)
+	{
+		fs_lock_exclusive = 0;
+		__atomic_store_n(&fs_writer, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&fs_writer_lock);
+	}
 
-	save_contents();
+	// 重放期间的回调不做检查点：它会清空 journal_replay 正在读的日志，重放结束后统一做一次
+	if (__atomic_load_n(&checkpoint_wanted, __ATOMIC_RELAXED) && !journal_replaying)
+	{
+		fs_enter_exclusive();
+		// 其他线程可能已经做完了检查点
+		if (__atomic_load_n(&checkpoint_wanted, __ATOMIC_RELAXED))
+			journal_checkpoint();
+		fs_leave();
+	}
 }
 
 /*
- * filetype_from_path - 根据路径查找对应的文件节点
+ * rcu_retire / rcu_retire_with - 延迟释放一个已经从共享结构中摘下的对象（纪元回收）
  *
  * 功能：
- * 1. 根据给定的路径，在文件树中查找对应的文件或目录节点。
- * 2. 支持绝对路径（以 "/" 开头）的解析。
- * 3. 如果路径不存在，返回 NULL。
- *
- * 参数：
- * - path: 要查找的路径字符串（必须以 "/" 开头）。
- *
- * 返回值：
- * - 成功时返回对应的文件节点指针（filetype *）。
- * - 如果路径不存在或路径格式错误，返回 NULL。
+ * 1. 不加锁的读者（dir_lookup、filetype_from_path）可能还在访问被替换掉的目录哈希表、
+ *    路径缓存项或已删除的节点，这些对象交给本函数，等所有可能看到它们的读者离开之后再释放。
+ * 2. rcu_retire 用 free 释放；rcu_retire_with 用指定的函数释放（节点交给 node_free 归还 slab，路径缓存条目交给 dcache_free）。
  *
  * 实现逻辑：
- * 1. 检查路径是否以 "/" 开头，如果不是则报错并退出。
- * 2. 从根节点开始，逐级解析路径中的目录名。
- * 3. 在当前节点的子节点中查找匹配的目录或文件。
- * 4. 如果找到匹配的节点，返回该节点；否则返回 NULL。
- *
- * 示例：
- * 假设文件树结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
- *
- * 调用示例：
- * 1. filetype_from_path("/") -> 返回根节点
- * 2. filetype_from_path("/home") -> 返回 home 目录节点
- * 3. filetype_from_path("/home/user") -> 返回 user 目录节点
- * 4. filetype_from_path("/test.txt") -> 返回 test.txt 文件节点
- * 5. filetype_from_path("/invalid") -> 返回 NULL
+ * 1. 对象连同当前全局纪元放入本线程的 limbo。
+ * 2. limbo 积累到 limbo_limit 时，若所有活跃读者都已看到当前纪元，把全局纪元加一。
+ * 3. 退休纪元 e 的对象在全局纪元达到 e + 2 时释放：此时所有活跃读者都是在
+ *    对象被摘下之后才进入的，不可能再持有它。
  *
  * 注意：
- * - 路径必须以 "/" 开头。
- * - 路径末尾的 "/" 会被自动去除。
- * - 如果路径不存在，返回 NULL。
+ * - 调用方必须处于 fs_enter / fs_leave 之间，对象已经不能从共享结构中找到。
+ * - 有读者长时间不离开时 limbo 会增长，limbo_limit 随之加倍，避免每次都扫描。
  */
-filetype *filetype_from_path(char *path)
+void rcu_try_advance()
 {
-	char curr_folder[100];
-	char *path_name = malloc(strlen(path) + 2);
-
-	strcpy(path_name, path);
-
-	filetype *curr_node = root;
-
-	fflush(stdin);
-
-	if (strcmp(path_name, "/") == 0)
-		return curr_node;
-
-	if (path_name[0] != '/')
+	unsigned long epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+	for (reader_record *r = __atomic_load_n(&reader_records, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
 	{
-		printf("INCORRECT PATH\n");
-		exit(1);
+		if (__atomic_load_n(&r->active, __ATOMIC_SEQ_CST) && __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST) != epoch)
+			return;
 	}
-	else
+	__atomic_compare_exchange_n(&rcu_epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+void rcu_reclaim(reader_record *self)
+{
+	unsigned long epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+	int kept = 0;
+	for (int i = 0; i < self->limbo_count; i++)
 	{
-		path_name++;
+		if (self->limbo[i].epoch + 2 <= epoch)
+		{
+			self->limbo[i].release(self->limbo[i].ptr);
+			continue;
+		}
+		self->limbo[kept++] = self->limbo[i];
 	}
+	self->limbo_count = kept;
+	self->limbo_limit = kept * 2 > RCU_BATCH ? kept * 2 : RCU_BATCH;
+}
 
-	if (path_name[strlen(path_name) - 1] == '/')
+void rcu_retire_with(void *ptr, void (*release)(void *))
+{
+	reader_record *self = reader_self_record();
+	if (self->limbo_count == self->limbo_capacity)
 	{
-		path_name[strlen(path_name) - 1] = '\0';
+		self->limbo_capacity = self->limbo_capacity ? self->limbo_capacity * 2 : RCU_BATCH;
+		self->limbo = realloc(self->limbo, self->limbo_capacity * sizeof(rcu_item));
 	}
+	self->limbo[self->limbo_count].ptr = ptr;
+	self->limbo[self->limbo_count].release = release;
+	self->limbo[self->limbo_count].epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+	self->limbo_count++;
 
-	char *index;
-	int flag = 0;
-
-	while (strlen(path_name) != 0)
+	if (self->limbo_count >= self->limbo_limit)
 	{
-		index = strchr(path_name, '/');
-
-		if (index != NULL)
-		{
-			strncpy(curr_folder, path_name, index - path_name);
-			curr_folder[index - path_name] = '\0';
+		rcu_try_advance();
+		rcu_reclaim(self);
+	}
+}
 
-			flag = 0;
-			for (int i = 0; i < curr_node->num_children; i++)
+void rcu_retire(void *ptr)
+{
+	rcu_retire_with(ptr, free);
+}
+
+/*
+ * 请求临时内存（scratch arena）
+ *
+ * 功能：
+ * 1. 回调处理一次请求时需要的临时内存（拆分出的父目录路径、低层接口的读缓冲区、
+ *    日志重放的记录等）从本线程的 bump arena 中分配，不需要逐个 free。
+ * 2. 请求结束时整体归还：STATS_OP / STATS_LL_OP 的包装函数在回调前后调用
+ *    scratch_mark / scratch_reset，直接调用回调的地方（日志重放）自己成对调用。
+ *
+ * 实现逻辑：
+ * 1. 每个线程的 reader_record 上挂一块 SCRATCH_SIZE 字节的内存，第一次使用时分配，
+ *    线程退出后随记录留给下一个线程，不再释放；分配只把 scratch_top 向后移动。
+ * 2. 放不下的请求（例如超过 SCRATCH_SIZE 的读缓冲区）单独 malloc 一个 scratch_block，
+ *    挂在溢出链表上并同样推进 scratch_top，scratch_reset 时释放 mark 之后的溢出块。
+ *
+ * 示例：
+ * size_t mark = scratch_mark();
+ * char *parent;
+ * const char *name = split_path("/home/user", &parent);  // parent = "/home"，name = "user"
+ * ...
+ * scratch_reset(mark);                                    // parent 不再可用
+ *
+ * 注意：
+ * - 分配的内存只在当前请求内有效，不能保存到节点或其他线程可见的结构中。
+ * - mark / reset 可以嵌套，内层 reset 只归还内层分配的内存。
+ */
+#define SCRATCH_SIZE (256 * 1024)
+#define SCRATCH_ALIGN 16
+
+typedef struct scratch_block
+{
+	struct scratch_block *next;
+	size_t top; // 分配前的 scratch_top
+	char data[] __attribute__((aligned(SCRATCH_ALIGN)));
+} scratch_block;
+
+void *scratch_alloc(size_t size)
+{
+	reader_record *self = reader_self_record();
+	size_t top = self->scratch_top;
+
+	size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+	if (self->scratch == NULL && (self->scratch = malloc(SCRATCH_SIZE)) == NULL)
+		abort();
+	self->scratch_top = top + size;
+	if (top + size <= SCRATCH_SIZE)
+		return self->scratch + top;
+
+	scratch_block *block = malloc(sizeof(scratch_block) + size);
+	if (block == NULL)
+		abort();
+	block->top = top;
+	block->next = self->scratch_overflow;
+	self->scratch_overflow = block;
+	return block->data;
+}
+
+size_t scratch_mark()
+{
+	return reader_self_record()->scratch_top;
+}
+
+void scratch_reset(size_t mark)
+{
+	reader_record *self = reader_self_record();
+
+	while (self->scratch_overflow != NULL && self->scratch_overflow->top >= mark)
+	{
+		scratch_block *block = self->scratch_overflow;
+		self->scratch_overflow = block->next;
+		free(block);
+	}
+	self->scratch_top = mark;
+}
+
+/*
+ * split_path - 把路径拆成父目录路径和最后一个名称
+ *
+ * 参数：
+ * - path: 以 "/" 开头的完整路径。
+ * - parent: 输出父目录路径，分配在 scratch 中；父目录是根目录时为 "/"。
+ *
+ * 返回值：
+ * - 最后一个名称，指向 path 内部。
+ */
+const char *split_path(const char *path, char **parent)
+{
+	const char *slash = strrchr(path, '/');
+	size_t len = slash > path ? (size_t)(slash - path) : 1;
+
+	*parent = scratch_alloc(len + 1);
+	memcpy(*parent, path, len);
+	(*parent)[len] = '\0';
+	return slash + 1;
+}
+
+/*
+ * 日志
+ *
+ * 功能：
+ * 1. 分级日志：LOG_ERROR、LOG_WARN、LOG_INFO、LOG_DEBUG。编译时用 -DLOG_LEVEL=N 选择级别，
+ *    高于该级别的 log_debug / log_info 调用连同参数求值一起被编译器删除。
+ * 2. 回调线程不格式化也不做系统调用：log_write 只扫描格式串，把参数按类型以二进制形式
+ *    写入本线程的环形缓冲区（log_ring）。
+ * 3. 后台线程 log_drainer 定期取出所有环中的记录，按时间排序后格式化写到标准输出。
+ *
+ * 实现逻辑：
+ * 1. 每个环只有一个生产者（所属线程）和一个消费者（持有 log_drain_lock 的线程），
+ *    head / tail 用 acquire / release 原子操作同步，不需要锁。
+ * 2. 环达到半满时唤醒后台线程；环满时丢弃新记录并计数，回调线程永远不会阻塞在日志上，
+ *    下一次输出时报告丢弃的条数。
+ * 3. 字符串参数复制到记录里（超长截断），数值参数按 64 位保存，输出时再按格式串格式化。
+ *
+ * 示例：
+ * log_debug("GETATTR %s\n", pathname);
+ * 默认级别（LOG_INFO）下这一行不产生任何代码；-DLOG_LEVEL=3 编译时写入一条记录，
+ * 由后台线程输出 "GETATTR /home/a.txt"。
+ *
+ * 注意：
+ * - 格式串必须是字符串常量（记录里只保存指针）。支持 %d %i %u %o %x %X %c %s %p %f %e %g
+ *   和 h / l / ll / z / j / t 长度修饰，不支持 '*' 宽度和 %n。
+ *   最多 LOG_MAX_ARGS 个参数，多余的转换原样输出。
+ * - 错误级别的记录写入后立即调用 log_flush 同步输出，随后的 exit 不会丢失它。
+ * - 后台线程启动之前（加载阶段）的记录留在环中，由 log_flush 或后台线程启动后输出。
+ * - 线程退出后它的环归还（in_use = 0），由新线程复用，环中尚未输出的记录不会丢失。
+ */
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_RING_SIZE 1024 // 每个线程的记录数（2 的幂）
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_MAX 192
+#define LOG_DRAIN_INTERVAL_MS 100
+
+enum
+{
+	LOG_ARG_INT,
+	LOG_ARG_UINT,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_STRING,
+	LOG_ARG_POINTER
+};
+
+typedef struct log_record
+{
+	uint64_t time;				   // CLOCK_MONOTONIC 纳秒，用于多个环之间排序
+	const char *fmt;			   // 格式串（字符串常量）
+	int level;					   // 日志级别
+	int nargs;					   // 参数个数
+	unsigned char types[LOG_MAX_ARGS]; // 参数类型（LOG_ARG_*）
+	uint64_t args[LOG_MAX_ARGS];   // 参数值；字符串参数保存它在 strings 中的偏移
+	char strings[LOG_STRING_MAX];  // 字符串参数，以 '\0' 分隔
+} log_record;
+
+typedef struct log_ring
+{
+	unsigned int head;	   // 下一条写入的位置，只由生产者修改
+	unsigned int tail;	   // 下一条读取的位置，只由消费者修改
+	unsigned long dropped; // 环满时丢弃的记录数
+	int in_use;			   // 是否属于某个线程
+	struct log_ring *next; // 全局链表中的下一个环
+	log_record records[LOG_RING_SIZE];
+} log_ring;
+
+log_ring *log_rings = NULL;
+pthread_key_t log_key;
+pthread_once_t log_once = PTHREAD_ONCE_INIT;
+__thread log_ring *log_self = NULL;
+
+struct
+{
+	pthread_mutex_t drain_lock; // 消费者之间互斥
+	pthread_mutex_t lock;		// 保护 stop，配合 cond 唤醒后台线程
+	pthread_cond_t cond;
+	pthread_t drainer;
+	int drainer_running;
+	int stop;
+	log_record *batch; // 一次输出的记录，按时间排序
+	int batch_capacity;
+} log_state = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+void log_ring_release(void *arg)
+{
+	log_ring *ring = (log_ring *)arg;
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+void log_key_init()
+{
+	pthread_key_create(&log_key, log_ring_release);
+}
+
+/*
+ * log_self_ring - 取得当前线程的环，第一次调用时认领或新建一个
+ */
+log_ring *log_self_ring()
+{
+	if (log_self != NULL)
+		return log_self;
+
+	pthread_once(&log_once, log_key_init);
+	for (log_ring *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+	{
+		int free_ring = 0;
+		if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			log_self = ring;
+			break;
+		}
+	}
+
+	if (log_self == NULL)
+	{
+		log_ring *ring = calloc(1, sizeof(log_ring));
+		if (ring == NULL)
+			return NULL;
+		ring->in_use = 1;
+		ring->next = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&log_rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		log_self = ring;
+	}
+
+	pthread_setspecific(log_key, log_self);
+	return log_self;
+}
+
+/*
+ * log_spec_end - 返回格式说明（'%' 之后）的转换字符位置，长度修饰保存在 modifier 中
+ */
+const char *log_spec_end(const char *spec, char *modifier)
+{
+	while (*spec != '\0' && strchr("-+ #0123456789.", *spec) != NULL)
+		spec++;
+
+	*modifier = 0;
+	while (*spec != '\0' && strchr("hlLqjzt", *spec) != NULL)
+		*modifier = *spec++;
+
+	return spec;
+}
+
+void log_flush();
+
+/*
+ * log_write - 写入一条二进制日志记录（不要直接调用，使用 log_error / log_info 等宏）
+ *
+ * 参数：
+ * - level: 日志级别。
+ * - fmt: printf 风格的格式串（字符串常量）。
+ */
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void log_write(int level, const char *fmt, ...)
+{
+	log_ring *ring = log_self_ring();
+	if (ring == NULL)
+		return;
+
+	unsigned int head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE)
+	{
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	log_record *rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+	struct timespec now;
+	size_t used = 0;
+	va_list ap;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rec->time = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	rec->fmt = fmt;
+	rec->level = level;
+	rec->nargs = 0;
+
+	va_start(ap, fmt);
+	for (const char *p = strchr(fmt, '%'); p != NULL && rec->nargs < LOG_MAX_ARGS; p = strchr(p + 1, '%'))
+	{
+		char modifier;
+		const char *conv = log_spec_end(p + 1, &modifier);
+		int i = rec->nargs;
+
+		switch (*conv)
+		{
+		case '%':
+			p = conv;
+			continue;
+		case 'd':
+		case 'i':
+			rec->types[i] = LOG_ARG_INT;
+			if (modifier == 'l' || modifier == 'q')
+				rec->args[i] = (uint64_t)va_arg(ap, long long);
+			else if (modifier == 'z' || modifier == 'j' || modifier == 't')
+				rec->args[i] = (uint64_t)va_arg(ap, intmax_t);
+			else
+				rec->args[i] = (uint64_t)(long long)va_arg(ap, int);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+		case 'c':
+			rec->types[i] = LOG_ARG_UINT;
+			if (modifier == 'l' || modifier == 'q')
+				rec->args[i] = va_arg(ap, unsigned long long);
+			else if (modifier == 'z' || modifier == 'j' || modifier == 't')
+				rec->args[i] = va_arg(ap, uintmax_t);
+			else
+				rec->args[i] = va_arg(ap, unsigned int);
+			break;
+		case 'f':
+		case 'e':
+		case 'g':
+		{
+			double d = va_arg(ap, double);
+			rec->types[i] = LOG_ARG_DOUBLE;
+			memcpy(&rec->args[i], &d, sizeof(d));
+			break;
+		}
+		case 's':
+		{
+			const char *s = va_arg(ap, const char *);
+			size_t len = s ? strnlen(s, LOG_STRING_MAX) : 0;
+			if (len >= LOG_STRING_MAX - used)
+				len = used < LOG_STRING_MAX ? LOG_STRING_MAX - used - 1 : 0;
+			rec->types[i] = LOG_ARG_STRING;
+			rec->args[i] = used;
+			if (used < LOG_STRING_MAX)
 			{
-				if (strcmp((curr_node->children)[i]->name, curr_folder) == 0)
-				{
-					curr_node = (curr_node->children)[i];
-					flag = 1;
-					break;
-				}
+				memcpy(rec->strings + used, s ? s : "", len);
+				rec->strings[used + len] = '\0';
+				used += len + 1;
 			}
-			if (flag == 0)
-				return NULL;
+			break;
 		}
-		else
+		case 'p':
+			rec->types[i] = LOG_ARG_POINTER;
+			rec->args[i] = (uintptr_t)va_arg(ap, void *);
+			break;
+		default:
+			// 不支持的转换，之后的参数无法解析
+			va_end(ap);
+			rec->nargs = i;
+			goto publish;
+		}
+		rec->nargs++;
+		p = conv;
+	}
+	va_end(ap);
+
+publish:
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	if (level == LOG_ERROR)
+		log_flush();
+	else if (head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == LOG_RING_SIZE / 2)
+		pthread_cond_signal(&log_state.cond); // 环已半满，提前唤醒后台线程
+}
+
+#define log_error(...) log_write(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) do { if (LOG_LEVEL >= LOG_WARN) log_write(LOG_WARN, __VA_ARGS__); } while (0)
+#define log_info(...) do { if (LOG_LEVEL >= LOG_INFO) log_write(LOG_INFO, __VA_ARGS__); } while (0)
+#define log_debug(...) do { if (LOG_LEVEL >= LOG_DEBUG) log_write(LOG_DEBUG, __VA_ARGS__); } while (0)
+
+/*
+ * log_format - 按记录的格式串和参数输出一条记录
+ *
+ * 实现逻辑：
+ * 格式串按 '%' 切成片段，每个片段连同一个参数单独交给 fprintf。
+ * 整数参数统一以 long long 传递，片段中原来的长度修饰替换为 "ll"。
+ */
+void log_format(FILE *out, const log_record *rec)
+{
+	const char *p = rec->fmt;
+	int i = 0;
+
+	while (*p != '\0')
+	{
+		const char *percent = strchr(p, '%');
+		if (percent == NULL)
+		{
+			fputs(p, out);
+			break;
+		}
+		fwrite(p, 1, percent - p, out);
+
+		char modifier, spec[32];
+		const char *conv = log_spec_end(percent + 1, &modifier);
+		if (*conv == '%')
+		{
+			fputc('%', out);
+			p = conv + 1;
+			continue;
+		}
+		if (*conv == '\0' || i >= rec->nargs)
+		{
+			fputs(percent, out);
+			break;
+		}
+
+		// 标志、宽度和精度部分
+		size_t flags = strspn(percent + 1, "-+ #0123456789.");
+		if (flags > sizeof(spec) - 5)
+			flags = sizeof(spec) - 5;
+		spec[0] = '%';
+		memcpy(spec + 1, percent + 1, flags);
+		size_t n = flags + 1;
+
+		switch (rec->types[i])
 		{
-			strcpy(curr_folder, path_name);
-			flag = 0;
-			for (int i = 0; i < curr_node->num_children; i++)
+		case LOG_ARG_INT:
+		case LOG_ARG_UINT:
+			if (*conv == 'c')
 			{
-				if (strcmp((curr_node->children)[i]->name, curr_folder) == 0)
-				{
-					curr_node = (curr_node->children)[i];
-					return curr_node;
-				}
+				spec[n++] = 'c';
+				spec[n] = '\0';
+				fprintf(out, spec, (int)rec->args[i]);
+				break;
 			}
-			return NULL;
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *conv;
+			spec[n] = '\0';
+			if (rec->types[i] == LOG_ARG_INT)
+				fprintf(out, spec, (long long)rec->args[i]);
+			else
+				fprintf(out, spec, (unsigned long long)rec->args[i]);
+			break;
+		case LOG_ARG_DOUBLE:
+		{
+			double d;
+			memcpy(&d, &rec->args[i], sizeof(d));
+			spec[n++] = *conv;
+			spec[n] = '\0';
+			fprintf(out, spec, d);
+			break;
+		}
+		case LOG_ARG_STRING:
+			spec[n++] = 's';
+			spec[n] = '\0';
+			fprintf(out, spec, rec->args[i] < LOG_STRING_MAX ? rec->strings + rec->args[i] : "");
+			break;
+		case LOG_ARG_POINTER:
+			spec[n++] = 'p';
+			spec[n] = '\0';
+			fprintf(out, spec, (void *)(uintptr_t)rec->args[i]);
+			break;
+		}
+		i++;
+		p = conv + 1;
+	}
+}
+
+int cmp_log_record(const void *a, const void *b)
+{
+	const log_record *x = (const log_record *)a, *y = (const log_record *)b;
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/*
+ * log_flush - 取出所有环中的记录，按时间排序后输出
+ *
+ * 注意：
+ * - 由后台线程定期调用；错误日志、卸载和退出前同步调用。
+ * - log_drain_lock 保证同一时间只有一个消费者。
+ */
+void log_flush()
+{
+	int count = 0;
+	unsigned long dropped = 0;
+
+	pthread_mutex_lock(&log_state.drain_lock);
+	for (log_ring *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+	{
+		unsigned int tail = ring->tail;
+		unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		if (count + (int)(head - tail) > log_state.batch_capacity)
+		{
+			int capacity = log_state.batch_capacity ? log_state.batch_capacity : LOG_RING_SIZE;
+			while (capacity < count + (int)(head - tail))
+				capacity *= 2;
+			log_record *batch = realloc(log_state.batch, capacity * sizeof(log_record));
+			if (batch == NULL)
+				head = tail + (log_state.batch_capacity - count);
+			else
+			{
+				log_state.batch = batch;
+				log_state.batch_capacity = capacity;
+			}
+		}
+		for (; tail != head; tail++)
+			log_state.batch[count++] = ring->records[tail & (LOG_RING_SIZE - 1)];
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	}
+
+	if (count > 1)
+		qsort(log_state.batch, count, sizeof(log_record), cmp_log_record);
+	for (int i = 0; i < count; i++)
+		log_format(stdout, &log_state.batch[i]);
+	if (dropped > 0)
+		printf("LOG DROPPED %lu\n", dropped);
+	fflush(stdout);
+	pthread_mutex_unlock(&log_state.drain_lock);
+}
+
+/*
+ * log_drainer - 日志输出线程，每隔 LOG_DRAIN_INTERVAL_MS 毫秒输出一次，log_state.stop 置 1 后退出
+ */
+void *log_drainer(void *arg)
+{
+	pthread_mutex_lock(&log_state.lock);
+	while (!log_state.stop)
+	{
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&log_state.cond, &log_state.lock, &deadline);
+
+		pthread_mutex_unlock(&log_state.lock);
+		log_flush();
+		pthread_mutex_lock(&log_state.lock);
+	}
+	pthread_mutex_unlock(&log_state.lock);
+	return NULL;
+}
+
+/*
+ * log_start / log_stop - 启动和停止日志输出线程
+ *
+ * 注意：
+ * - 与写回线程一样在 init 回调中（fork 之后）启动。
+ * - log_stop 在线程退出后再输出一次，不丢失最后的记录。
+ */
+void log_start()
+{
+	if (log_state.drainer_running)
+		return;
+	log_state.stop = 0;
+	if (pthread_create(&log_state.drainer, NULL, log_drainer, NULL) == 0)
+		log_state.drainer_running = 1;
+}
+
+void log_stop()
+{
+	if (log_state.drainer_running)
+	{
+		pthread_mutex_lock(&log_state.lock);
+		log_state.stop = 1;
+		pthread_cond_signal(&log_state.cond);
+		pthread_mutex_unlock(&log_state.lock);
+		pthread_join(log_state.drainer, NULL);
+		log_state.drainer_running = 0;
+	}
+	log_flush();
+}
+
+/*
+ * 操作统计
+ *
+ * 功能：
+ * 1. 每种回调（以及检查点、save_contents）记录调用次数、总耗时和 HDR 风格的延迟直方图。
+ * 2. 统计结果通过隐藏的虚拟文件 /.fsstats 以文本形式读出，见 stats_open。
+ *
+ * 实现逻辑：
+ * 1. 直方图按对数-线性分桶：小于 HIST_SUB 纳秒的值每纳秒一个桶；之后每个 2 的幂区间
+ *    再等分成 HIST_SUB 个桶，相对误差不超过 1 / HIST_SUB（约 6%），
+ *    从 1 纳秒到 2^HIST_MAX_BITS 纳秒（约 18 分钟）共 HIST_BUCKETS 个桶。
+ * 2. 计数保存在每个线程自己的 op_stats 中（挂在 reader_record 上），只有所属线程写入，
+ *    回调之间不争用缓存行；读取时把所有线程的计数相加。
+ * 3. 回调通过 STATS_OP / STATS_LL_OP 生成的包装函数注册，包装函数在调用前后各读一次时钟。
+ *
+ * 注意：
+ * - 计数用 relaxed 原子操作读写，读出的是近似一致的快照。
+ * - 低层接口的耗时包含向内核发送应答的时间。
+ */
+enum
+{
+	OP_GETATTR,
+	OP_READDIR,
+	OP_MKDIR,
+	OP_RMDIR,
+	OP_CREATE,
+	OP_OPEN,
+	OP_RELEASE,
+	OP_FLUSH,
+	OP_FSYNC,
+	OP_FSYNCDIR,
+	OP_READ,
+	OP_WRITE,
+	OP_RENAME,
+	OP_UNLINK,
+	OP_LOOKUP,
+	OP_FORGET,
+	OP_TRUNCATE,
+	OP_CHECKPOINT,
+	OP_SAVE,
+	OP_COUNT
+};
+
+const char *op_names[OP_COUNT] = {
+	"getattr", "readdir", "mkdir", "rmdir", "create", "open", "release", "flush", "fsync",
+	"fsyncdir", "read", "write", "rename", "unlink", "lookup", "forget", "truncate",
+	"checkpoint", "save_contents"};
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct op_stats
+{
+	uint64_t count[OP_COUNT];				// 调用次数
+	uint64_t total_ns[OP_COUNT];			// 总耗时
+	uint64_t max_ns[OP_COUNT];				// 最大耗时
+	uint64_t hist[OP_COUNT][HIST_BUCKETS]; // 延迟直方图
+} op_stats;
+
+uint64_t stats_now()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/*
+ * hist_bucket / hist_bucket_high - 纳秒值所在的桶，以及桶能表示的最大值
+ *
+ * 示例：
+ * - 5 -> 桶 5（精确）
+ * - 1000 = 0b1111101000：最高位是第 9 位，右移 5 位得到 31，桶号 5 * 16 + 31 = 111，
+ *   桶 111 覆盖 [992, 1023]。
+ */
+int hist_bucket(uint64_t ns)
+{
+	if (ns < HIST_SUB)
+		return ns;
+	if (ns >> HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+	return shift * HIST_SUB + (int)(ns >> shift);
+}
+
+uint64_t hist_bucket_high(int bucket)
+{
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	int shift = bucket / HIST_SUB - 1;
+	uint64_t sub = bucket - shift * HIST_SUB;
+	return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * stats_record - 记录一次操作的耗时
+ *
+ * 参数：
+ * - op: 操作编号（OP_*）。
+ * - start: 操作开始时 stats_now() 的返回值。
+ */
+void stats_record(int op, uint64_t start)
+{
+	uint64_t ns = stats_now() - start;
+	reader_record *self = reader_self_record();
+	op_stats *stats = self->stats;
+
+	if (stats == NULL)
+	{
+		if ((stats = calloc(1, sizeof(op_stats))) == NULL)
+			return;
+		__atomic_store_n(&self->stats, stats, __ATOMIC_RELEASE);
+	}
+
+	// 只有本线程写入，读-改-写不需要原子指令
+	int bucket = hist_bucket(ns);
+	__atomic_store_n(&stats->count[op], stats->count[op] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->total_ns[op], stats->total_ns[op] + ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->hist[op][bucket], stats->hist[op][bucket] + 1, __ATOMIC_RELAXED);
+	if (ns > stats->max_ns[op])
+		__atomic_store_n(&stats->max_ns[op], ns, __ATOMIC_RELAXED);
+}
+
+/*
+ * stats_collect - 把所有线程的计数加到 sum 中
+ */
+void stats_collect(op_stats *sum)
+{
+	memset(sum, 0, sizeof(op_stats));
+	for (reader_record *r = __atomic_load_n(&reader_records, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+	{
+		op_stats *stats = __atomic_load_n(&r->stats, __ATOMIC_ACQUIRE);
+		if (stats == NULL)
+			continue;
+		for (int op = 0; op < OP_COUNT; op++)
+		{
+			sum->count[op] += __atomic_load_n(&stats->count[op], __ATOMIC_RELAXED);
+			sum->total_ns[op] += __atomic_load_n(&stats->total_ns[op], __ATOMIC_RELAXED);
+			uint64_t max = __atomic_load_n(&stats->max_ns[op], __ATOMIC_RELAXED);
+			if (max > sum->max_ns[op])
+				sum->max_ns[op] = max;
+			for (int b = 0; b < HIST_BUCKETS; b++)
+				sum->hist[op][b] += __atomic_load_n(&stats->hist[op][b], __ATOMIC_RELAXED);
 		}
-		path_name = index + 1;
 	}
 }
+
+/*
+ * hist_percentile - 直方图中累计样本达到 p（0 到 1）比例的桶的上界，不超过实际最大值 max
+ */
+uint64_t hist_percentile(const uint64_t *hist, uint64_t count, uint64_t max, double p)
+{
+	uint64_t target = (uint64_t)(p * count + 0.5), seen = 0;
+
+	if (target == 0)
+		target = 1;
+	for (int b = 0; b < HIST_BUCKETS; b++)
+	{
+		seen += hist[b];
+		if (seen >= target)
+			return hist_bucket_high(b) < max ? hist_bucket_high(b) : max;
+	}
+	return max;
+}
+
+/*
+ * node_forgotten - 节点是否已被删除并且释放了 inode 编号（调用方持有节点锁）
+ */
+int node_forgotten(const filetype *node)
+{
+	return !node->valid && node->nlookup == 0 && node->open_count == 0;
+}
+
+superblock spblock;
+int image_fd = -1;
+uint64_t *inode_bitmap = NULL;
+uint64_t *data_bitmap = NULL;
+
+/*
+ * image_read / image_write - 在镜像文件的指定位置读写
+ *
+ * 返回值：
+ * - 成功返回 0；出错或读到文件末尾返回 -EIO。
+ */
+int image_read(void *buf, size_t len, off_t pos)
+{
+	while (len > 0)
+	{
+		ssize_t n = pread(image_fd, buf, len, pos);
+		if (n <= 0)
+		{
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -EIO;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+		pos += n;
+	}
+	return 0;
+}
+
+int image_write(const void *buf, size_t len, off_t pos)
+{
+	while (len > 0)
+	{
+		ssize_t n = pwrite(image_fd, buf, len, pos);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -EIO;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		pos += n;
+	}
+	return 0;
+}
+
+/*
+ * block_offset - 数据块在镜像文件中的偏移
+ */
+off_t block_offset(uint32_t block)
+{
+	return spblock.data_offset + (off_t)block * block_size;
+}
+
+/*
+ * 块缓存（ARC）
+ *
+ * 功能：
+ * 1. 在用户态缓存数据块，容量由 -o cache=N（单位 MB）限定，0 表示关闭缓存。
+ * 2. 采用 ARC（Adaptive Replacement Cache）替换策略，能抵抗一次性的大范围扫描。
+ * 3. 统计命中（cache.hits）和未命中（cache.misses）的块数。
+ *
+ * 实现逻辑：
+ * 1. 缓存中的块分属四个 LRU 链表：
+ *    - T1: 最近只被访问过一次的块（有数据）。
+ *    - T2: 最近被访问过至少两次的块（有数据）。
+ *    - B1 / B2: 最近从 T1 / T2 淘汰的块的"幽灵"记录，只保存块号，不占数据内存。
+ * 2. T1 与 T2 的块数之和不超过容量 c，目标值 p 决定淘汰时优先从 T1 还是 T2 淘汰。
+ * 3. 命中 B1 说明 T1 太小，p 增大；命中 B2 说明 T2 太小，p 减小。
+ * 4. 一次性扫描的块只进入 T1，很快被淘汰到 B1，不会挤掉 T2 中反复访问的热点块。
+ *
+ * 示例：
+ * 一个 64 MB 的缓存中，T2 保存着常用的 20 MB 数据；此时顺序读一个 10 GB 的备份文件，
+ * 扫描的块只在 T1 中流过，读完之后 T2 中的 20 MB 仍然在缓存中。
+ *
+ * 写回：
+ * 1. 写入只修改缓存中的块并标记为脏（cache_write_span），不立即写镜像。
+ * 2. 后台线程 cache_flusher 每隔 flush_interval 秒，或者脏块超过容量的 dirty_ratio% 时，
+ *    把所有脏块按块号排序，相邻的脏块合并成一次 pwrite 写回（cache_flush_locked）。
+ *    大量小的追加写因此变成少数几次大的顺序写。
+ * 3. 淘汰只选择干净的块，不做 I/O。全是脏块时缓存暂时超出容量；写入方需要放入新块而脏块
+ *    已经占满容量时，先自己写回一轮，写回失败则返回 -EIO（cache_write_span）。
+ * 4. 检查点之前调用 cache_flush 写回全部脏块，之后才能清空日志。
+ *
+ * 注意：
+ * - 缓存状态由 cache.lock 保护。写回时在锁内把一段脏块复制出来、标记为干净并钉住（busy），
+ *   释放锁之后再 pwrite：钉住的块不会被淘汰，写入失败时重新标记为脏，数据不会丢失；
+ *   写回期间被再次写入的块重新变脏，下一轮再写。
+ * - 同一时刻只有一个线程在写回（cache.flushing），同一块的新旧数据不会乱序落盘。
+ * - 数据块被释放时调用 cache_invalidate 丢弃对应的缓存记录，脏数据直接丢弃。
+ * - 连续未命中的块合并为一次 pread 读入。读入之前先在锁内放入缓存并标记为 loading，
+ *   释放锁之后再 pread，读完重新加锁填入数据：读镜像期间其他线程照常命中别的块，
+ *   访问同一块的线程在 cache.loaded_cond 上等待，loading 的块不会被淘汰或删除。
+ * - 预读的区间放入 cache.prefetch_queue，由后台线程 cache_prefetcher 读入，读者不等待预读的 I/O。
+ * - 关闭缓存（-o cache=0）时读写直接访问镜像，写入为写穿透。
+ */
+#define FLUSH_MAX_RUN 256
+#define PREFETCH_QUEUE 64
+enum cache_list_id
+{
+	CACHE_T1,
+	CACHE_T2,
+	CACHE_B1,
+	CACHE_B2,
+	CACHE_LISTS
+};
+
+typedef struct cache_entry
+{
+	uint32_t block;				// 数据块编号
+	int list;					// 所在的链表（enum cache_list_id）
+	struct cache_entry *prev;	// 链表中更新的一项（靠近 MRU 端）
+	struct cache_entry *next;	// 链表中更旧的一项（靠近 LRU 端）
+	struct cache_entry *hnext;	// 哈希桶中的下一项
+	struct cache_entry *dprev;	// 脏块链表中的前一项
+	struct cache_entry *dnext;	// 脏块链表中的后一项
+	int dirty;					// 是否有尚未写回镜像的修改
+	int busy;					// 正在写回，不能淘汰
+	int loading;				// 正在从镜像读入，数据还不可用，不能淘汰
+	int prefetched;				// 由预读放入、还没有被真正访问过
+	char *data;					// 块内容，幽灵记录为 NULL
+} cache_entry;
+
+typedef struct cache_list
+{
+	cache_entry *head; // MRU 端
+	cache_entry *tail; // LRU 端
+	size_t size;
+} cache_list;
+
+struct block_cache
+{
+	size_t capacity;				  // 可以缓存的块数 c
+	size_t p;						  // T1 的目标大小
+	cache_list lists[CACHE_LISTS];	  // T1、T2、B1、B2
+	cache_entry **buckets;			  // 块号到记录的哈希表
+	size_t nbuckets;				  // 桶数（2 的幂）
+	char *spare;					  // 淘汰时回收的数据缓冲区，供下一次未命中复用
+	unsigned long hits;				  // 命中的块数
+	unsigned long misses;			  // 未命中的块数
+	cache_entry *dirty_list;		  // 脏块链表
+	size_t dirty_count;				  // 脏块数量
+	size_t dirty_limit;				  // 超过该数量时唤醒写回线程
+	unsigned long flushes;			  // 写回时的 pwrite 次数
+	pthread_mutex_t lock;			  // 保护缓存的全部状态
+	pthread_cond_t flush_cond;		  // 唤醒写回线程
+	pthread_cond_t flushed_cond;	  // 一轮写回结束
+	pthread_cond_t loaded_cond;		  // 有块读入完成（loading 清零）
+	int flushing;					  // 是否有线程正在写回
+	pthread_t flusher;				  // 写回线程
+	int flusher_running;			  // 写回线程是否在运行
+	int stop;						  // 通知写回线程和预读线程退出
+	uint32_t prefetch_queue[PREFETCH_QUEUE][2]; // 等待预读的（起始块, 块数），环形队列
+	int prefetch_head;				  // 队首位置
+	int prefetch_count;				  // 队列中的区间数
+	unsigned long prefetch_dropped;	  // 队列满时丢弃的区间数
+	pthread_cond_t prefetch_cond;	  // 唤醒预读线程
+	pthread_t prefetcher;			  // 预读线程
+	int prefetcher_running;			  // 预读线程是否在运行
+} cache;
+
+/*
+ * cache_init - 按 fs_config.cache 初始化缓存
+ */
+void cache_init()
+{
+	memset(&cache, 0, sizeof(cache));
+	pthread_mutex_init(&cache.lock, NULL);
+	pthread_cond_init(&cache.flush_cond, NULL);
+	pthread_cond_init(&cache.flushed_cond, NULL);
+	pthread_cond_init(&cache.loaded_cond, NULL);
+	pthread_cond_init(&cache.prefetch_cond, NULL);
+	cache.capacity = fs_config.cache * 1024 * 1024 / block_size;
+	if (cache.capacity == 0)
+		return;
+	cache.dirty_limit = cache.capacity * fs_config.dirty_ratio / 100;
+
+	// 幽灵记录最多再占 c 项，桶数取不小于 2c 的 2 的幂
+	cache.nbuckets = 64;
+	while (cache.nbuckets < 2 * cache.capacity)
+		cache.nbuckets *= 2;
+	cache.buckets = calloc(cache.nbuckets, sizeof(cache_entry *));
+}
+
+cache_entry **cache_bucket(uint32_t block)
+{
+	return &cache.buckets[(block * 2654435761u) & (cache.nbuckets - 1)];
+}
+
+cache_entry *cache_lookup(uint32_t block)
+{
+	cache_entry *e = *cache_bucket(block);
+
+	while (e != NULL && e->block != block)
+		e = e->hnext;
+	return e;
+}
+
+/*
+ * cache_lookup_loaded - 查找块的记录，块正在被其他线程读入时先等它读完（调用方持有 cache.lock）
+ */
+cache_entry *cache_lookup_loaded(uint32_t block)
+{
+	cache_entry *e;
+
+	while ((e = cache_lookup(block)) != NULL && e->loading)
+		pthread_cond_wait(&cache.loaded_cond, &cache.lock);
+	return e;
+}
+
+void cache_list_remove(cache_entry *e)
+{
+	cache_list *l = &cache.lists[e->list];
+
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		l->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		l->tail = e->prev;
+	l->size--;
+}
+
+void cache_list_push(cache_entry *e, int list)
+{
+	cache_list *l = &cache.lists[list];
+
+	e->list = list;
+	e->prev = NULL;
+	e->next = l->head;
+	if (l->head)
+		l->head->prev = e;
+	else
+		l->tail = e;
+	l->head = e;
+	l->size++;
+}
+
+/*
+ * cache_mark_dirty / cache_mark_clean - 维护脏块链表
+ */
+void cache_mark_dirty(cache_entry *e)
+{
+	if (e->dirty)
+		return;
+	e->dirty = 1;
+	e->dprev = NULL;
+	e->dnext = cache.dirty_list;
+	if (cache.dirty_list)
+		cache.dirty_list->dprev = e;
+	cache.dirty_list = e;
+	cache.dirty_count++;
+}
+
+void cache_mark_clean(cache_entry *e)
+{
+	if (!e->dirty)
+		return;
+	e->dirty = 0;
+	if (e->dprev)
+		e->dprev->dnext = e->dnext;
+	else
+		cache.dirty_list = e->dnext;
+	if (e->dnext)
+		e->dnext->dprev = e->dprev;
+	cache.dirty_count--;
+}
+
+/*
+ * cache_victim - 从 LRU 端找到链表中第一个可以淘汰的块（干净、没有在写回也没有在读入），没有时返回 NULL
+ */
+cache_entry *cache_victim(int list)
+{
+	cache_entry *e = cache.lists[list].tail;
+
+	while (e != NULL && (e->dirty || e->busy || e->loading))
+		e = e->prev;
+	return e;
+}
+
+/*
+ * cache_touch - 命中时把块移到 MRU 端
+ *
+ * 注意：
+ * - 预读放入的块第一次被真正访问时只移到 T1 的 MRU 端，相当于一次未命中；第二次访问才进入 T2。
+ *   否则一次顺序扫描的每个块都像是被访问了两次，会把 T2 中的热点块挤出缓存。
+ */
+void cache_touch(cache_entry *e)
+{
+	cache_list_remove(e);
+	if (e->prefetched)
+	{
+		e->prefetched = 0;
+		cache_list_push(e, CACHE_T1);
+	}
+	else
+		cache_list_push(e, CACHE_T2);
+}
+
+/*
+ * cache_drop - 把记录从链表和哈希表中彻底删除
+ *
+ * 注意：
+ * - 只用于干净的记录：幽灵记录、cache_victim 选出的块、以及已经被释放的块（cache_invalidate）。
+ */
+void cache_drop(cache_entry *e)
+{
+	cache_entry **pp = cache_bucket(e->block);
+
+	while (*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+	cache_list_remove(e);
+
+	if (e->data != NULL)
+	{
+		free(cache.spare);
+		cache.spare = e->data;
+	}
+	free(e);
+}
+
+/*
+ * cache_demote - 把 T1 或 T2 中的块 e 降为 B1 或 B2 中的幽灵记录，数据缓冲区留给下一次未命中
+ */
+void cache_demote(cache_entry *e, int to)
+{
+	// 预读之后从没被访问过的块不留幽灵记录，以后读到它不能算作 ARC 意义上的"再次访问"
+	if (e->prefetched)
+	{
+		cache_drop(e);
+		return;
+	}
+	cache_list_remove(e);
+	free(cache.spare);
+	cache.spare = e->data;
+	e->data = NULL;
+	cache_list_push(e, to);
+}
+
+/*
+ * cache_replace - ARC 的 REPLACE：按目标值 p 从 T1 或 T2 淘汰，直到 T1 与 T2 之和小于容量
+ *
+ * 注意：
+ * - 应该淘汰的链表中没有干净的块时从另一个链表淘汰；两个链表都没有时缓存暂时超出容量，
+ *   之后的未命中在脏块写回后继续淘汰，回到容量以内。
+ */
+void cache_replace(int in_b2)
+{
+	// 还有空位时不需要淘汰（块被 cache_invalidate 删除后会出现这种情况）
+	while (cache.lists[CACHE_T1].size + cache.lists[CACHE_T2].size >= cache.capacity)
+	{
+		size_t t1 = cache.lists[CACHE_T1].size;
+		cache_entry *e = NULL;
+
+		if (t1 > 0 && ((in_b2 && t1 == cache.p) || t1 > cache.p) && (e = cache_victim(CACHE_T1)) != NULL)
+			cache_demote(e, CACHE_B1);
+		else if ((e = cache_victim(CACHE_T2)) != NULL)
+			cache_demote(e, CACHE_B2);
+		else if ((e = cache_victim(CACHE_T1)) != NULL)
+			cache_demote(e, CACHE_B1);
+		else
+			break;
+	}
+}
+
+/*
+ * cache_insert - 未命中时把块放入缓存，返回用来存放数据的记录（调用方填写 data）
+ */
+cache_entry *cache_insert(uint32_t block)
+{
+	cache_entry *e = cache_lookup(block);
+	size_t t1 = cache.lists[CACHE_T1].size, t2 = cache.lists[CACHE_T2].size;
+	size_t b1 = cache.lists[CACHE_B1].size, b2 = cache.lists[CACHE_B2].size;
+
+	if (e != NULL && e->list == CACHE_B1)
+	{
+		// 命中 B1：增大 T1 的目标大小
+		size_t delta = b2 > b1 ? b2 / b1 : 1;
+		cache.p = cache.p + delta < cache.capacity ? cache.p + delta : cache.capacity;
+		cache_replace(0);
+		cache_list_remove(e);
+	}
+	else if (e != NULL && e->list == CACHE_B2)
+	{
+		// 命中 B2：减小 T1 的目标大小
+		size_t delta = b1 > b2 ? b1 / b2 : 1;
+		cache.p = cache.p > delta ? cache.p - delta : 0;
+		cache_replace(1);
+		cache_list_remove(e);
+	}
+	else
+	{
+		// 缓存暂时超出容量时各项之和可能超过 c 或 2c，用 >= 比较
+		if (t1 + b1 >= cache.capacity)
+		{
+			if (t1 < cache.capacity)
+			{
+				cache_drop(cache.lists[CACHE_B1].tail);
+				cache_replace(0);
+			}
+			else if ((e = cache_victim(CACHE_T1)) != NULL)
+				cache_drop(e);
+		}
+		else if (t1 + t2 + b1 + b2 >= cache.capacity)
+		{
+			if (t1 + t2 + b1 + b2 >= 2 * cache.capacity && b2 > 0)
+				cache_drop(cache.lists[CACHE_B2].tail);
+			cache_replace(0);
+		}
+
+		e = calloc(1, sizeof(cache_entry));
+		e->block = block;
+		cache_entry **bucket = cache_bucket(block);
+		e->hnext = *bucket;
+		*bucket = e;
+		cache_list_push(e, CACHE_T1);
+		e->data = cache.spare ? cache.spare : malloc(block_size);
+		cache.spare = NULL;
+		return e;
+	}
+
+	// 幽灵命中：重新取得数据后进入 T2
+	cache_list_push(e, CACHE_T2);
+	e->data = cache.spare ? cache.spare : malloc(block_size);
+	cache.spare = NULL;
+	return e;
+}
+
+/*
+ * cache_invalidate - 数据块被释放时丢弃它的缓存记录
+ */
+void cache_invalidate(uint32_t block)
+{
+	cache_entry *e;
+
+	if (cache.capacity == 0)
+		return;
+	pthread_mutex_lock(&cache.lock);
+	if ((e = cache_lookup_loaded(block)) != NULL)
+	{
+		// 块已经不属于任何文件，脏数据不必写回
+		cache_mark_clean(e);
+		cache_drop(e);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ * cache_read_span - 从第 block 块的 in_block 字节处开始，读取一段连续的 len 个字节
+ *
+ * 实现逻辑：
+ * 1. 命中的块在锁内复制；正在被其他线程读入的块先等它读完。
+ * 2. 连续未命中的块先放入缓存并标记为 loading，释放 cache.lock 后用一次 pread 读入 scratch，
+ *    重新加锁后填入这些块、清除 loading 并唤醒等待的线程。
+ *
+ * 返回值：
+ * - 成功返回 0，读镜像失败返回 -EIO（这一段放入的块全部删除）。
+ */
+int cache_read_span(uint32_t block, size_t in_block, char *buf, size_t len)
+{
+	if (cache.capacity == 0)
+		return image_read(buf, len, block_offset(block) + in_block);
+
+	uint32_t last = block + (in_block + len - 1) / block_size;
+	uint32_t b = block;
+
+	pthread_mutex_lock(&cache.lock);
+	while (b <= last)
+	{
+		cache_entry *e = cache_lookup_loaded(b);
+		size_t from = b == block ? in_block : 0;
+		size_t n = block_size - from < len ? block_size - from : len;
+
+		if (e != NULL && e->data != NULL)
+		{
+			// 命中：移到 T2 的 MRU 端（预读的块见 cache_touch）
+			cache_touch(e);
+			memcpy(buf, e->data + from, n);
+			cache.hits++;
+			buf += n;
+			len -= n;
+			b++;
+			continue;
+		}
+
+		// 连续未命中的块一次读入，先占住缓存中的位置
+		uint32_t first = b, end = b;
+		do
+		{
+			e = cache_insert(end);
+			e->loading = 1;
+			cache.misses++;
+			end++;
+		} while (end <= last && ((e = cache_lookup(end)) == NULL || e->data == NULL));
+
+		size_t mark = scratch_mark();
+		char *tmp = scratch_alloc((size_t)(end - first) * block_size);
+		pthread_mutex_unlock(&cache.lock);
+		int failed = image_read(tmp, (size_t)(end - first) * block_size, block_offset(first)) != 0;
+		pthread_mutex_lock(&cache.lock);
+
+		for (; b < end; b++)
+		{
+			const char *src = tmp + (size_t)(b - first) * block_size;
+
+			e = cache_lookup(b);
+			e->loading = 0;
+			if (failed)
+			{
+				cache_drop(e);
+				continue;
+			}
+			from = b == block ? in_block : 0;
+			n = block_size - from < len ? block_size - from : len;
+			memcpy(e->data, src, block_size);
+			memcpy(buf, src + from, n);
+			buf += n;
+			len -= n;
+		}
+		pthread_cond_broadcast(&cache.loaded_cond);
+		scratch_reset(mark);
+		if (failed)
+		{
+			pthread_mutex_unlock(&cache.lock);
+			return -EIO;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return 0;
+}
+
+/*
+ * cache_prefetch - 预读：把第 block 块开始的 count 个块中不在缓存里的块读入缓存
+ *
+ * 功能：
+ * 1. 连续的未缓存块（最多 FLUSH_MAX_RUN 个）一次读入，放入 T1 并标记为 prefetched，
+ *    不计入命中和未命中。第一次真正访问只让它留在 T1（见 cache_touch），被淘汰时不留幽灵记录，
+ *    一次顺序扫描因此不会挤掉 T2 中反复访问的热点块。
+ * 2. 已有记录的块（包括 B1 / B2 中的幽灵记录）跳过，由真正的访问按 ARC 的规则处理。
+ *
+ * 参数：
+ * - tmp: 读镜像用的缓冲区，至少 FLUSH_MAX_RUN 个块。
+ *
+ * 注意：
+ * - 只由预读线程调用（见 cache_prefetcher），读者不等待这里的 I/O。
+ * - 读镜像时不持有 cache.lock。不在缓存中的块，镜像里就是它的最新内容；读的期间只有
+ *   写回（cache.flushes 增加）才会改变镜像，这时放弃这一批，预读只是提示。
+ * - 读回来之后已经被其他线程放入缓存的块不覆盖。
+ */
+void cache_prefetch(uint32_t block, uint32_t count, char *tmp)
+{
+	uint32_t end = block + count;
+
+	while (block < end)
+	{
+		cache_entry *e;
+
+		pthread_mutex_lock(&cache.lock);
+		while (block < end && cache_lookup(block) != NULL)
+			block++;
+		uint32_t first = block;
+		while (block < end && block - first < FLUSH_MAX_RUN && cache_lookup(block) == NULL)
+			block++;
+		unsigned long flushes = cache.flushes;
+		pthread_mutex_unlock(&cache.lock);
+		if (first == block)
+			break;
+
+		if (image_read(tmp, (size_t)(block - first) * block_size, block_offset(first)) != 0)
+			break;
+
+		pthread_mutex_lock(&cache.lock);
+		for (uint32_t b = first; b < block && cache.flushes == flushes; b++)
+		{
+			if (cache_lookup(b) != NULL)
+				continue;
+			e = cache_insert(b);
+			memcpy(e->data, tmp + (size_t)(b - first) * block_size, block_size);
+			e->prefetched = 1;
+		}
+		pthread_mutex_unlock(&cache.lock);
+	}
+}
+
+/*
+ * cache_queue_prefetch - 把第 block 块开始的 count 个块交给预读线程，立即返回
+ *
+ * 注意：
+ * - 预读线程没有运行（关闭缓存，或者还没有调用 init）或者队列已满时直接丢弃，预读只是提示。
+ */
+void cache_queue_prefetch(uint32_t block, uint32_t count)
+{
+	pthread_mutex_lock(&cache.lock);
+	if (cache.prefetcher_running && !cache.stop && cache.prefetch_count == PREFETCH_QUEUE)
+		cache.prefetch_dropped++;
+	else if (cache.prefetcher_running && !cache.stop)
+	{
+		int tail = (cache.prefetch_head + cache.prefetch_count) % PREFETCH_QUEUE;
+		cache.prefetch_queue[tail][0] = block;
+		cache.prefetch_queue[tail][1] = count;
+		cache.prefetch_count++;
+		pthread_cond_signal(&cache.prefetch_cond);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ * cache_prefetcher - 预读线程：按顺序取出 cache.prefetch_queue 中的区间读入缓存，cache.stop 置 1 后退出
+ */
+void *cache_prefetcher(void *arg)
+{
+	char *tmp = malloc((size_t)FLUSH_MAX_RUN * block_size);
+
+	pthread_mutex_lock(&cache.lock);
+	while (!cache.stop)
+	{
+		if (cache.prefetch_count == 0)
+		{
+			pthread_cond_wait(&cache.prefetch_cond, &cache.lock);
+			continue;
+		}
+		uint32_t block = cache.prefetch_queue[cache.prefetch_head][0];
+		uint32_t count = cache.prefetch_queue[cache.prefetch_head][1];
+		cache.prefetch_head = (cache.prefetch_head + 1) % PREFETCH_QUEUE;
+		cache.prefetch_count--;
+		pthread_mutex_unlock(&cache.lock);
+		cache_prefetch(block, count, tmp);
+		pthread_mutex_lock(&cache.lock);
+	}
+	pthread_mutex_unlock(&cache.lock);
+	free(tmp);
+	return NULL;
+}
+
+int cache_flush_locked();
+
+/*
+ * cache_write_span - 从第 block 块的 in_block 字节处开始写入一段连续的 len 个字节
+ *
+ * 功能：
+ * 1. 写入缓存中的块并标记为脏，由写回线程稍后写入镜像。
+ * 2. 整块覆盖的块直接放入缓存；只写一部分的块如果不在缓存中，先从镜像读入（不持有 cache.lock）。
+ * 3. 脏块超过 dirty_limit 时唤醒写回线程；脏块占满容量时先由当前线程写回一轮。
+ *
+ * 返回值：
+ * - 成功返回 0，读镜像或写回失败返回 -EIO。
+ */
+int cache_write_span(uint32_t block, size_t in_block, const char *buf, size_t len)
+{
+	if (cache.capacity == 0)
+		return image_write(buf, len, block_offset(block) + in_block) != 0 ? -EIO : 0;
+
+	pthread_mutex_lock(&cache.lock);
+	for (uint32_t b = block; len > 0; b++)
+	{
+		cache_entry *e = cache_lookup_loaded(b);
+		size_t from = b == block ? in_block : 0;
+		size_t n = block_size - from < len ? block_size - from : len;
+
+		// 脏块已经占满容量，放入新块之前先写回一轮，腾出可以淘汰的干净块
+		if ((e == NULL || e->data == NULL) && cache.dirty_count >= cache.capacity)
+		{
+			if (cache_flush_locked() != 0)
+			{
+				pthread_mutex_unlock(&cache.lock);
+				return -EIO;
+			}
+			e = cache_lookup_loaded(b);
+		}
+
+		if (e != NULL && e->data != NULL)
+			cache_touch(e);
+		else
+		{
+			e = cache_insert(b);
+			if (n < block_size)
+			{
+				// 与 cache_read_span 一样，读镜像时不持有 cache.lock
+				e->loading = 1;
+				pthread_mutex_unlock(&cache.lock);
+				int failed = image_read(e->data, block_size, block_offset(b)) != 0;
+				pthread_mutex_lock(&cache.lock);
+				e->loading = 0;
+				pthread_cond_broadcast(&cache.loaded_cond);
+				if (failed)
+				{
+					cache_drop(e);
+					pthread_mutex_unlock(&cache.lock);
+					return -EIO;
+				}
+			}
+		}
+		memcpy(e->data + from, buf, n);
+		cache_mark_dirty(e);
+		buf += n;
+		len -= n;
+	}
+	if (cache.dirty_count > cache.dirty_limit)
+		pthread_cond_signal(&cache.flush_cond);
+	pthread_mutex_unlock(&cache.lock);
+	return 0;
+}
+
+/*
+ * cache_flush_locked - 写回全部脏块（调用方持有 cache.lock）
+ *
+ * 实现逻辑：
+ * 1. 已有线程在写回时先等它结束，然后取出所有脏块的块号并排序。
+ * 2. 块号相邻、仍然是脏的块（最多 FLUSH_MAX_RUN 个）复制到同一个缓冲区，标记为干净并钉住，
+ *    释放 cache.lock 后用一次 pwrite 写回，再重新加锁。
+ * 3. 写入失败时把这一段中仍在缓存里的块重新标记为脏。
+ *
+ * 返回值：
+ * - 成功返回 0，有写入失败时返回 -EIO（失败的块保持为脏）。
+ *
+ * 注意：
+ * - 写回期间其他线程可以继续读写缓存；块号在释放锁之后可能已经被 cache_invalidate 删除，
+ *   每一段都重新查找。
+ */
+int cmp_block(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+int cache_flush_locked()
+{
+	size_t n = 0, count;
+	int res = 0;
+
+	while (cache.flushing)
+		pthread_cond_wait(&cache.flushed_cond, &cache.lock);
+	if ((count = cache.dirty_count) == 0)
+		return 0;
+	cache.flushing = 1;
+
+	uint32_t *blocks = malloc(count * sizeof(uint32_t));
+	for (cache_entry *e = cache.dirty_list; e != NULL; e = e->dnext)
+		blocks[n++] = e->block;
+	qsort(blocks, n, sizeof(uint32_t), cmp_block);
+
+	char *buf = malloc((size_t)FLUSH_MAX_RUN * block_size);
+	for (size_t i = 0; i < n;)
+	{
+		cache_entry *e;
+		size_t j = i;
+
+		while (j < n && j - i < FLUSH_MAX_RUN && (j == i || blocks[j] == blocks[j - 1] + 1) &&
+			   (e = cache_lookup(blocks[j])) != NULL && e->dirty)
+		{
+			memcpy(buf + (j - i) * block_size, e->data, block_size);
+			cache_mark_clean(e);
+			e->busy = 1;
+			j++;
+		}
+		if (j == i)
+		{
+			// 已经被释放或者被别的线程写回
+			i++;
+			continue;
+		}
+
+		pthread_mutex_unlock(&cache.lock);
+		int failed = image_write(buf, (j - i) * block_size, block_offset(blocks[i])) != 0;
+		pthread_mutex_lock(&cache.lock);
+
+		for (size_t k = i; k < j; k++)
+		{
+			if ((e = cache_lookup(blocks[k])) == NULL || !e->busy)
+				continue;
+			e->busy = 0;
+			if (failed)
+				cache_mark_dirty(e);
+		}
+		if (failed)
+			res = -EIO;
+		cache.flushes++;
+		i = j;
+	}
+	free(buf);
+	free(blocks);
+
+	cache.flushing = 0;
+	pthread_cond_broadcast(&cache.flushed_cond);
+	return res;
+}
+
+/*
+ * cache_flush - 写回全部脏块
+ */
+int cache_flush()
+{
+	int res;
+
+	if (cache.capacity == 0)
+		return 0;
+	pthread_mutex_lock(&cache.lock);
+	res = cache_flush_locked();
+	pthread_mutex_unlock(&cache.lock);
+	return res;
+}
+
+/*
+ * cache_flusher - 写回线程
+ *
+ * 功能：
+ * 1. 每隔 fs_config.flush_interval 秒，或者被 cache_write_span 唤醒（脏块过多）时写回全部脏块。
+ * 2. cache.stop 置 1 后退出。
+ *
+ * 注意：
+ * - 写回时只在复制数据时持有 cache.lock，见 cache_flush_locked。写入失败的块保持为脏，下一轮重试。
+ */
+void *cache_flusher(void *arg)
+{
+	pthread_mutex_lock(&cache.lock);
+	while (!cache.stop)
+	{
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += fs_config.flush_interval;
+		while (!cache.stop && cache.dirty_count <= cache.dirty_limit)
+		{
+			if (pthread_cond_timedwait(&cache.flush_cond, &cache.lock, &deadline) == ETIMEDOUT)
+				break;
+		}
+		cache_flush_locked();
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return NULL;
+}
+
+/*
+ * cache_start_flusher / cache_stop_flusher - 启动和停止写回线程和预读线程
+ *
+ * 注意：
+ * - FUSE 在后台运行时会 fork，线程必须在 init 回调中（fork 之后）启动。
+ * - 停止时队列中还没有读的预读区间直接丢弃。
+ */
+void cache_start_flusher()
+{
+	if (cache.capacity == 0 || cache.flusher_running)
+		return;
+	cache.stop = 0;
+	if (pthread_create(&cache.flusher, NULL, cache_flusher, NULL) == 0)
+		cache.flusher_running = 1;
+	pthread_mutex_lock(&cache.lock);
+	if (pthread_create(&cache.prefetcher, NULL, cache_prefetcher, NULL) == 0)
+		cache.prefetcher_running = 1;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void cache_stop_flusher()
+{
+	if (!cache.flusher_running && !cache.prefetcher_running)
+		return;
+	pthread_mutex_lock(&cache.lock);
+	cache.stop = 1;
+	cache.prefetch_count = 0;
+	pthread_cond_signal(&cache.flush_cond);
+	pthread_cond_signal(&cache.prefetch_cond);
+	pthread_mutex_unlock(&cache.lock);
+	if (cache.flusher_running)
+		pthread_join(cache.flusher, NULL);
+	if (cache.prefetcher_running)
+		pthread_join(cache.prefetcher, NULL);
+	cache.flusher_running = 0;
+	cache.prefetcher_running = 0;
+}
+
+/*
+ * bitmap_set / bitmap_clear / bitmap_test - 打包位图的单个位操作
+ */
+void bitmap_set(uint64_t *map, unsigned long bit)
+{
+	map[bit / 64] |= 1ULL << (bit % 64);
+}
+
+void bitmap_clear(uint64_t *map, unsigned long bit)
+{
+	map[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+int bitmap_test(const uint64_t *map, unsigned long bit)
+{
+	return (map[bit / 64] >> (bit % 64)) & 1;
+}
+
+/*
+ * bitmap_alloc - 在打包位图中分配一个空闲位
+ *
+ * 功能：
+ * 1. 从 hint 指向的位置开始（next-fit）查找第一个为 0 的位，置 1 后返回其编号。
+ * 2. 把 hint 移到刚分配位置的下一位，下次分配从这里继续。
+ *
+ * 参数：
+ * - map: 位图。
+ * - lo / hi: 查找范围 [lo, hi)，lo 必须是 64 的倍数。
+ * - hint: 下次查找的起点，查找到 hi 后回绕到 lo。
+ *
+ * 返回值：
+ * - 成功时返回分配到的位编号；位图已满时返回 -1。
+ *
+ * 实现逻辑：
+ * 1. 每次取一个 64 位字，按位取反后非 0 即说明其中有空闲位。
+ * 2. 用 __builtin_ctzll 直接得到最低的空闲位，不需要逐位测试。
+ * 3. 起点所在的字先屏蔽掉 hint 之前的位，回绕一圈后再完整检查一次。
+ *
+ * 注意：
+ * - 调用方先检查空闲计数，计数为 0 时不调用本函数，因此空间耗尽时也是 O(1)。
+ * - 已分配的对象聚集在 hint 之前，每次分配平均只需检查很少几个字。
+ * - hi 所在字中 hi 之后的位必须已经置 1（位图末尾的填充位在格式化时置 1，
+ *   其余情况下 hi 是 64 的倍数）。
+ */
+long bitmap_alloc(uint64_t *map, unsigned long lo, unsigned long hi, unsigned long *hint)
+{
+	unsigned long first = lo / 64, nwords = BITMAP_WORDS(hi) - first;
+	unsigned long start = *hint >= lo && *hint < hi ? *hint : lo;
+	unsigned long w = start / 64;
+
+	for (unsigned long n = 0; n <= nwords; n++)
+	{
+		uint64_t avail = ~map[w];
+		if (n == 0)
+			avail &= ~0ULL << (start % 64);
+
+		if (avail != 0)
+		{
+			unsigned long bit = w * 64 + __builtin_ctzll(avail);
+			map[w] |= 1ULL << (bit % 64);
+			*hint = bit + 1 < hi ? bit + 1 : lo;
+			return bit;
+		}
+		w = w + 1 == first + nwords ? first : w + 1;
+	}
+	return -1;
+}
+
+/*
+ * bitmap_alloc_run - 分配一段连续的空闲位
+ *
+ * 功能：
+ * 1. 用 bitmap_alloc 找到第一个空闲位，再向后尽量延伸，最多 want 位。
+ *
+ * 返回值：
+ * - 成功时返回起始位编号，*got 为实际分配的位数；位图已满时返回 -1。
+ */
+long bitmap_alloc_run(uint64_t *map, unsigned long lo, unsigned long hi, unsigned long *hint, unsigned long want, unsigned long *got)
+{
+	long first = bitmap_alloc(map, lo, hi, hint);
+	unsigned long n = 1;
+
+	if (first < 0)
+		return -1;
+	while (n < want && first + n < hi && !bitmap_test(map, first + n))
+	{
+		bitmap_set(map, first + n);
+		n++;
+	}
+	*hint = first + n < hi ? first + n : lo;
+	*got = n;
+	return first;
+}
+
+/*
+ * bitmap_allocator - 分片的位图分配器
+ *
+ * 功能：
+ * 1. 把位图按 64 位对齐切成 ALLOC_SHARDS 段，每段有自己的互斥锁和 next-fit 起点，
+ *    不同的段从不共享同一个 64 位字，可以同时分配和释放。
+ * 2. 没有指定位置的分配从当前线程固定的“主段”开始，不同线程分散在不同的段上；
+ *    指定了 goal（文件上一段数据之后的块）时从 goal 所在的段开始，保持文件数据连续。
+ * 3. 主段已满时依次尝试后面的段。
+ *
+ * 注意：
+ * - 空闲计数用原子操作更新；位图和计数只在检查点（独占 fs_lock）时写回。
+ */
+#define ALLOC_SHARDS 16
+
+typedef struct alloc_shard
+{
+	pthread_mutex_t lock;
+	unsigned long lo;	// 本段的第一位（64 的倍数）
+	unsigned long hi;	// 本段最后一位之后的位置
+	unsigned long hint; // 段内下次查找的起点
+} alloc_shard;
+
+typedef struct bitmap_allocator
+{
+	unsigned long shard_bits; // 每段的位数（64 的倍数）
+	alloc_shard shards[ALLOC_SHARDS];
+} bitmap_allocator;
+
+bitmap_allocator inode_alloc;
+bitmap_allocator block_alloc;
+int alloc_next_home = 0;
+__thread int alloc_home = -1;
+
+void allocator_init(bitmap_allocator *a, unsigned long nbits)
+{
+	a->shard_bits = (nbits + ALLOC_SHARDS * 64 - 1) / (ALLOC_SHARDS * 64) * 64;
+	for (int i = 0; i < ALLOC_SHARDS; i++)
+	{
+		alloc_shard *s = &a->shards[i];
+
+		pthread_mutex_init(&s->lock, NULL);
+		s->lo = i * a->shard_bits < nbits ? i * a->shard_bits : nbits;
+		s->hi = s->lo + a->shard_bits < nbits ? s->lo + a->shard_bits : nbits;
+		s->hint = s->lo;
+	}
+}
+
+/*
+ * allocator_get - 分配最多 want 个连续的位
+ *
+ * 参数：
+ * - goal: 希望从这一位开始分配，-1 表示不指定。
+ * - got: 返回实际分配的位数（至少 1）。
+ *
+ * 返回值：
+ * - 成功时返回起始位编号；所有段都已满时返回 -1。
+ */
+long allocator_get(bitmap_allocator *a, uint64_t *map, long goal, unsigned long want, unsigned long *got)
+{
+	if (alloc_home < 0)
+		alloc_home = __atomic_fetch_add(&alloc_next_home, 1, __ATOMIC_RELAXED) % ALLOC_SHARDS;
+	int first = goal >= 0 ? (int)(goal / a->shard_bits) : alloc_home;
+
+	for (int k = 0; k < ALLOC_SHARDS; k++)
+	{
+		alloc_shard *s = &a->shards[(first + k) % ALLOC_SHARDS];
+		long bit;
+
+		if (s->lo >= s->hi)
+			continue;
+		pthread_mutex_lock(&s->lock);
+		if (k == 0 && goal >= 0)
+			s->hint = goal;
+		bit = bitmap_alloc_run(map, s->lo, s->hi, &s->hint, want, got);
+		pthread_mutex_unlock(&s->lock);
+		if (bit >= 0)
+			return bit;
+	}
+	return -1;
+}
+
+void allocator_put(bitmap_allocator *a, uint64_t *map, unsigned long bit)
+{
+	alloc_shard *s = &a->shards[bit / a->shard_bits];
+
+	pthread_mutex_lock(&s->lock);
+	bitmap_clear(map, bit);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * initialize_superblock - 初始化超级块
+ *
+ * 功能：
+ * 1. 按 fs_config.blocks / fs_config.inodes 格式化镜像文件 fs.img。
+ * 2. 将数据块位图和 inode 位图初始化为全 0，表示所有数据块和 inode 均为空闲状态。
+ *
+ * 参数：
+ * - 无。
+ *
+ * 返回值：
+ * - 成功返回 0，无法创建镜像时返回 -EIO。
+ *
+ * 实现逻辑：
+ * 1. 计算位图和数据区的偏移，用 ftruncate 把镜像扩展到完整大小（稀疏文件，不占实际空间）。
+ * 2. 分配两个位图，把最后一个字中超出总数的位置 1。
+ * 3. 保留 0 号数据块（extent 中的 0 表示"未分配"）和 0、1 号 inode。
+ * 4. 设置空闲计数，写入超级块和位图。
+ *
+ * 示例：
+ * 假设文件系统刚创建，调用 initialize_superblock() 后：
+ * - spblock.free_blocks == fs_config.blocks - 1。
+ * - spblock.free_inodes == fs_config.inodes - 2。
+ *
+ * 注意：
+ * - 超级块是文件系统的核心数据结构，必须在文件系统初始化时调用此方法。
+ */
+int write_superblock();
+
+int initialize_superblock()
+{
+	size_t inode_bytes = BITMAP_WORDS(fs_config.inodes) * sizeof(uint64_t);
+	size_t data_bytes = BITMAP_WORDS(fs_config.blocks) * sizeof(uint64_t);
+
+	memset(&spblock, 0, sizeof(spblock));
+	spblock.magic = IMAGE_MAGIC;
+	spblock.blocksize = block_size;
+	spblock.block_count = fs_config.blocks;
+	spblock.inode_count = fs_config.inodes;
+	spblock.inode_bitmap_offset = block_size;
+	spblock.data_bitmap_offset = spblock.inode_bitmap_offset + (inode_bytes + block_size - 1) / block_size * block_size;
+	spblock.data_offset = spblock.data_bitmap_offset + (data_bytes + block_size - 1) / block_size * block_size;
+
+	image_fd = open(IMAGE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (image_fd < 0 || ftruncate(image_fd, block_offset(spblock.block_count)) != 0)
+	{
+		perror(IMAGE_FILE);
+		return -EIO;
+	}
+
+	inode_bitmap = calloc(1, inode_bytes);
+	data_bitmap = calloc(1, data_bytes);
+	for (unsigned long i = spblock.block_count; i < BITMAP_WORDS(spblock.block_count) * 64; i++)
+		bitmap_set(data_bitmap, i);
+	for (unsigned long i = spblock.inode_count; i < BITMAP_WORDS(spblock.inode_count) * 64; i++)
+		bitmap_set(inode_bitmap, i);
+
+	bitmap_set(data_bitmap, 0);
+	bitmap_set(inode_bitmap, 0);
+	bitmap_set(inode_bitmap, 1);
+	spblock.free_blocks = spblock.block_count - 1;
+	spblock.free_inodes = spblock.inode_count - 2;
+	allocator_init(&inode_alloc, spblock.inode_count);
+	allocator_init(&block_alloc, spblock.block_count);
+
+	return write_superblock();
+}
+
+/*
+ * load_superblock - 挂载时读入超级块和两个位图
+ *
+ * 返回值：
+ * - 成功返回 0；镜像不存在或格式不符时返回 -1。
+ *
+ * 注意：
+ * - 数据区不会被读入内存。
+ */
+int load_superblock()
+{
+	image_fd = open(IMAGE_FILE, O_RDWR);
+	if (image_fd < 0 || image_read(&spblock, sizeof(spblock), 0) != 0 ||
+		spblock.magic != IMAGE_MAGIC || spblock.blocksize != block_size)
+	{
+		log_error("UNSUPPORTED IMAGE FORMAT\n");
+		return -1;
+	}
+
+	size_t inode_bytes = BITMAP_WORDS(spblock.inode_count) * sizeof(uint64_t);
+	size_t data_bytes = BITMAP_WORDS(spblock.block_count) * sizeof(uint64_t);
+	inode_bitmap = malloc(inode_bytes);
+	data_bitmap = malloc(data_bytes);
+	if (image_read(inode_bitmap, inode_bytes, spblock.inode_bitmap_offset) != 0 ||
+		image_read(data_bitmap, data_bytes, spblock.data_bitmap_offset) != 0)
+	{
+		log_error("UNSUPPORTED IMAGE FORMAT\n");
+		return -1;
+	}
+	allocator_init(&inode_alloc, spblock.inode_count);
+	allocator_init(&block_alloc, spblock.block_count);
+	return 0;
+}
+
+/*
+ * write_superblock - 把超级块和两个位图写回镜像
+ */
+int write_superblock()
+{
+	if (image_write(&spblock, sizeof(spblock), 0) != 0 ||
+		image_write(inode_bitmap, BITMAP_WORDS(spblock.inode_count) * sizeof(uint64_t), spblock.inode_bitmap_offset) != 0 ||
+		image_write(data_bitmap, BITMAP_WORDS(spblock.block_count) * sizeof(uint64_t), spblock.data_bitmap_offset) != 0)
+	{
+		perror(IMAGE_FILE);
+		return -EIO;
+	}
+	return 0;
+}
+
+filetype *root;
+
+/*
+ * name_hash - 计算名称的哈希值（FNV-1a）
+ *
+ * 参数：
+ * - name: 名称字符串，不要求以 '\0' 结尾。
+ * - len: 名称长度。
+ */
+unsigned int name_hash(const char *name, size_t len)
+{
+	unsigned int hash = 2166136261u;
+
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+	return hash;
+}
+
+/*
+ * 名称池（name arena）
+ *
+ * 功能：
+ * 1. 节点不内嵌定长的名称和路径：名称以 name_ref（偏移、长度、哈希）的形式指向名称池中的字节，
+ *    完整路径需要时由 node_path 沿父目录链拼出，文件类型由 permissions 中的 S_IFMT 位表示。
+ *    节点因此小了一半多，名称长度也不再受 100 字节的限制。
+ * 2. 名称是驻留（intern）的：不同目录下的同名节点（Makefile、.git、index.js 等）共享同一份字节，
+ *    重复创建、删除同名文件也不会让名称池增长。
+ *
+ * 实现逻辑：
+ * 1. 名称池由 NAME_CHUNK_SIZE 字节的块组成，块分配之后不会移动；偏移的高位是块号，
+ *    低 NAME_CHUNK_BITS 位是块内位置。名称以 '\0' 结尾，不跨块。
+ * 2. 名称按哈希的高位分到 NAME_SHARDS 个分片，每个分片有自己的锁、驻留表和当前块，
+ *    并发创建不同名称的线程一般落在不同的分片上，不再争用一把全局锁。
+ *    新块的块号用原子操作从 name_pool.nchunks 领取，分片之间不需要协调。
+ * 3. 驻留表是开放定址（线性探测）的哈希表，保存 (偏移 + 1, 哈希)，0 表示空槽，由分片的锁保护。
+ * 4. 名称只追加不删除。删除和重命名留下的名称由检查点回收，见 name_pool_compact。
+ *
+ * 示例：
+ * /home/a/Makefile 和 /home/b/Makefile 两个节点的 name 相同：
+ *   {off = 12, len = 8, hash = name_hash("Makefile", 8)}
+ *
+ * 注意：
+ * - 不加锁的读者（dir_lookup、readdir）只通过 name_str 读取节点引用的块，不访问驻留表；
+ *   块指针在节点发布之前写好，节点发布之后不会改变（整理时独占 fs_lock）。
+ * - 名称最长 NAME_LEN_MAX 字节，与 Linux 的 NAME_MAX 相同。
+ */
+#define NAME_LEN_MAX 255
+#define NAME_CHUNK_BITS 16
+#define NAME_CHUNK_SIZE (1u << NAME_CHUNK_BITS)
+#define NAME_CHUNKS_MAX (1u << (32 - NAME_CHUNK_BITS))
+#define NAME_TABLE_MIN_SIZE 256
+#define NAME_SHARD_BITS 3
+#define NAME_SHARDS (1 << NAME_SHARD_BITS)
+
+typedef struct name_slot
+{
+	uint32_t off; // 偏移 + 1，0 表示空槽
+	unsigned int hash;
+} name_slot;
+
+typedef struct name_shard
+{
+	pthread_mutex_t lock;
+	uint64_t top;	   // 当前块中下一个名称的偏移
+	uint64_t end;	   // 当前块的结束偏移，top == end 时需要新块
+	name_slot *table;  // 驻留表
+	size_t table_size; // 驻留表槽位数（2 的幂）
+	size_t table_used; // 驻留的名称数
+} __attribute__((aligned(64))) name_shard;
+
+struct
+{
+	char *chunks[NAME_CHUNKS_MAX]; // 名称块，按块号分配
+	uint32_t nchunks;			   // 已经领取的块数（原子操作）
+	uint64_t top;				   // 名称占用的字节数（原子操作）
+	uint64_t compacted;			   // 上次整理之后的 top
+	name_shard shards[NAME_SHARDS];
+} name_pool = {.shards = {[0 ... NAME_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}}};
+
+name_shard *name_shard_of(unsigned int hash)
+{
+	// 驻留表用哈希的低位定位槽位，分片用高位
+	return &name_pool.shards[hash >> (32 - NAME_SHARD_BITS)];
+}
+
+/*
+ * name_at / name_str - 取得名称池中偏移 off 处（或 name_ref 引用）的名称，以 '\0' 结尾
+ */
+const char *name_at(uint32_t off)
+{
+	return name_pool.chunks[off >> NAME_CHUNK_BITS] + (off & (NAME_CHUNK_SIZE - 1));
+}
+
+const char *name_str(const name_ref *ref)
+{
+	return name_at(ref->off);
+}
+
+void name_table_put(name_shard *shard, uint32_t off, unsigned int hash)
+{
+	size_t mask = shard->table_size - 1;
+	size_t slot = hash & mask;
+
+	while (shard->table[slot].off != 0)
+		slot = (slot + 1) & mask;
+	shard->table[slot].off = off + 1;
+	shard->table[slot].hash = hash;
+	shard->table_used++;
+}
+
+void name_table_resize(name_shard *shard, size_t size)
+{
+	name_slot *old_table = shard->table;
+	size_t old_size = shard->table_size;
+
+	shard->table = calloc(size, sizeof(name_slot));
+	if (shard->table == NULL)
+		abort();
+	shard->table_size = size;
+	shard->table_used = 0;
+	for (size_t i = 0; i < old_size; i++)
+	{
+		if (old_table[i].off != 0)
+			name_table_put(shard, old_table[i].off - 1, old_table[i].hash);
+	}
+	free(old_table);
+}
+
+/*
+ * name_intern_locked - 在分片的驻留表中查找名称，没有时追加到分片的当前块
+ *
+ * 返回值：
+ * - 成功返回 0 并填写 *off；名称池已满返回 -ENOSPC。
+ *
+ * 注意：
+ * - 调用方持有 shard->lock，shard 是 name_shard_of(hash)。
+ */
+int name_intern_locked(name_shard *shard, const char *name, size_t len, unsigned int hash, uint32_t *off)
+{
+	if (shard->table == NULL || (shard->table_used + 1) * 4 > shard->table_size * 3)
+		name_table_resize(shard, shard->table ? shard->table_size * 2 : NAME_TABLE_MIN_SIZE);
+
+	size_t mask = shard->table_size - 1;
+	name_slot *entry;
+	for (size_t slot = hash & mask; (entry = &shard->table[slot])->off != 0; slot = (slot + 1) & mask)
+	{
+		if (entry->hash != hash)
+			continue;
+		const char *str = name_at(entry->off - 1);
+		if (strncmp(str, name, len) == 0 && str[len] == '\0')
+		{
+			*off = entry->off - 1;
+			return 0;
+		}
+	}
+
+	// 名称不跨块：当前块放不下时领取一个新块
+	if (shard->top + len + 1 > shard->end)
+	{
+		uint32_t chunk = __atomic_fetch_add(&name_pool.nchunks, 1, __ATOMIC_RELAXED);
+		if (chunk >= NAME_CHUNKS_MAX)
+			return -ENOSPC;
+		if ((name_pool.chunks[chunk] = malloc(NAME_CHUNK_SIZE)) == NULL)
+			abort();
+		shard->top = (uint64_t)chunk << NAME_CHUNK_BITS;
+		shard->end = shard->top + NAME_CHUNK_SIZE;
+	}
+
+	char *str = name_pool.chunks[shard->top >> NAME_CHUNK_BITS] + (shard->top & (NAME_CHUNK_SIZE - 1));
+	memcpy(str, name, len);
+	str[len] = '\0';
+	*off = (uint32_t)shard->top;
+	shard->top += len + 1;
+	__atomic_add_fetch(&name_pool.top, len + 1, __ATOMIC_RELAXED);
+
+	name_table_put(shard, *off, hash);
+	return 0;
+}
+
+/*
+ * name_pool_interned - 驻留的名称数（各分片之和）
+ */
+size_t name_pool_interned()
+{
+	size_t used = 0;
+
+	for (int k = 0; k < NAME_SHARDS; k++)
+	{
+		pthread_mutex_lock(&name_pool.shards[k].lock);
+		used += name_pool.shards[k].table_used;
+		pthread_mutex_unlock(&name_pool.shards[k].lock);
+	}
+	return used;
+}
+
+/*
+ * name_intern - 驻留一个名称，填写 name_ref
+ *
+ * 参数：
+ * - name: 名称，不要求以 '\0' 结尾。
+ * - len: 名称长度。
+ * - ref: 输出的名称引用。
+ *
+ * 返回值：
+ * - 成功返回 0。
+ * - 名称为空时返回 -ENOENT，超过 NAME_LEN_MAX 时返回 -ENAMETOOLONG。
+ * - 名称池已满返回 -ENOSPC。
+ *
+ * 注意：
+ * - 调用方处于 fs_enter / fs_leave 之间：整理名称池需要独占 fs_lock，
+ *   返回的偏移在本次 fs_leave 之前一直有效，调用方要在此之前把它保存到节点中。
+ */
+int name_intern(const char *name, size_t len, name_ref *ref)
+{
+	if (len == 0)
+		return -ENOENT;
+	if (len > NAME_LEN_MAX)
+		return -ENAMETOOLONG;
+
+	ref->len = len;
+	ref->hash = name_hash(name, len);
+	name_shard *shard = name_shard_of(ref->hash);
+	pthread_mutex_lock(&shard->lock);
+	int res = name_intern_locked(shard, name, len, ref->hash, &ref->off);
+	pthread_mutex_unlock(&shard->lock);
+	return res;
+}
+
+/*
+ * node_path - 沿父目录链拼出节点的完整路径
+ *
+ * 返回值：
+ * - 分配在 scratch 中的路径，根目录为 "/"。
+ *
+ * 示例：
+ * node_path(user) -> "/home/user"
+ *
+ * 注意：
+ * - 节点必须仍在文件树中（valid）：已删除节点的父目录可能已经被回收。
+ * - 调用方处于 fs_enter / fs_leave 之间；rename 独占 fs_lock，拼接期间父目录链不会改变。
+ */
+char *node_path(const filetype *node)
+{
+	size_t len = 0;
+	for (const filetype *n = node; n->parent != NULL; n = n->parent)
+		len += n->name.len + 1;
+
+	char *path = scratch_alloc(len + 2);
+	char *p = path + len;
+	*p = '\0';
+	for (const filetype *n = node; n->parent != NULL; n = n->parent)
+	{
+		p -= n->name.len;
+		memcpy(p, name_str(&n->name), n->name.len);
+		*--p = '/';
+	}
+	if (len == 0)
+		strcpy(path, "/");
+	return path;
+}
+
+/*
+ * 目录哈希索引
+ *
+ * 功能：
+ * 1. 每个目录维护一张开放定址（线性探测）的哈希表 dir_index，保存子节点指针。
+ * 2. 子节点名称的哈希值在驻留名称时计算一次（name.hash），查找时先比较哈希值和长度再比较名称。
+ * 3. 查找不加锁：修改者持目录写锁，用原子存储写槽位；查找者用原子加载读槽位。
+ *
+ * 实现逻辑：
+ * 1. 插入把子节点写入探测链上第一个空槽或墓碑。
+ * 2. 删除把槽位改成墓碑 DIR_TOMBSTONE，不移动其他槽位，并发的查找不会漏掉后面的节点。
+ * 3. 已占用的槽位（含墓碑）超过 3/4 时重建：新表只含有效节点，必要时翻倍，
+ *    建好后一次性发布到 dir_index，旧表交给 rcu_retire。
+ *
+ * 示例：
+ * 目录 /home 下有 100000 个文件时，filetype_from_path("/home/f99999")
+ * 在 /home 这一级只需探测一两个槽位，而不是逐个 strcmp 100000 个名称。
+ *
+ * 注意：
+ * - 索引只存在于内存中，加载时由 add_child 重建。
+ * - add_child、remove_child 是修改 children 的唯一入口，负责保持索引同步。
+ * - 表中始终至少有 1/4 的空槽，查找一定会在空槽处结束。
+ */
+#define DIR_INDEX_MIN_SIZE 8
+#define DIR_TOMBSTONE ((filetype *)1)
+
+typedef struct dir_table
+{
+	int size;		   // 槽位数（2 的幂）
+	int used;		   // 非空槽位数（含墓碑）
+	filetype *slots[]; // 子节点指针、墓碑或 NULL
+} dir_table;
+
+void dir_table_put(dir_table *table, filetype *child)
+{
+	int mask = table->size - 1;
+	int slot = child->name.hash & mask;
+	filetype *entry;
+
+	while ((entry = table->slots[slot]) != NULL && entry != DIR_TOMBSTONE)
+		slot = (slot + 1) & mask;
+	if (entry == NULL)
+		table->used++;
+	__atomic_store_n(&table->slots[slot], child, __ATOMIC_RELEASE);
+}
+
+void dir_index_rebuild(filetype *dir, int size)
+{
+	dir_table *old_table = dir->dir_index;
+	dir_table *table = calloc(1, sizeof(dir_table) + size * sizeof(filetype *));
+
+	table->size = size;
+	for (int i = 0; old_table != NULL && i < old_table->size; i++)
+	{
+		if (old_table->slots[i] != NULL && old_table->slots[i] != DIR_TOMBSTONE)
+			dir_table_put(table, old_table->slots[i]);
+	}
+
+	__atomic_store_n(&dir->dir_index, table, __ATOMIC_RELEASE);
+	if (old_table != NULL)
+		rcu_retire(old_table);
+}
+
+void dir_index_delete(filetype *dir, filetype *child)
+{
+	dir_table *table = dir->dir_index;
+	int mask = table->size - 1;
+	int slot = child->name.hash & mask;
+
+	while (table->slots[slot] != child)
+		slot = (slot + 1) & mask;
+	__atomic_store_n(&table->slots[slot], DIR_TOMBSTONE, __ATOMIC_RELEASE);
+}
+
+/*
+ * dir_lookup - 在目录中按名称查找子节点（不加锁）
+ *
+ * 参数：
+ * - dir: 目录节点。
+ * - name: 名称，不要求以 '\0' 结尾。
+ * - len: 名称长度。
+ *
+ * 返回值：
+ * - 找到时返回子节点指针，否则返回 NULL（dir 不是目录时也返回 NULL）。
+ *
+ * 注意：
+ * - 调用方处于 fs_enter / fs_leave 之间，保证读到的表不会被释放。
+ * - 与 add_child / remove_child 并发时，结果是修改之前或之后的状态之一。
+ */
+filetype *dir_lookup(filetype *dir, const char *name, size_t len)
+{
+	if (!S_ISDIR(dir->permissions))
+		return NULL;
+
+	dir_table *table = __atomic_load_n(&dir->dir_index, __ATOMIC_ACQUIRE);
+	if (table == NULL)
+		return NULL;
+
+	unsigned int hash = name_hash(name, len);
+	int mask = table->size - 1;
+	filetype *child;
+
+	for (int slot = hash & mask; (child = __atomic_load_n(&table->slots[slot], __ATOMIC_ACQUIRE)) != NULL; slot = (slot + 1) & mask)
+	{
+		if (child != DIR_TOMBSTONE && child->name.hash == hash && child->name.len == len && memcmp(name_str(&child->name), name, len) == 0)
+			return child;
+	}
+
+	return NULL;
+}
+
+void node_mark_dirty(filetype *node);
+
+/*
+ * add_child - 添加子节点
+ *
+ * 功能：
+ * 1. 将指定节点添加到父目录的子节点列表中。
+ * 2. 更新父目录的子节点数量和列表。
+ * 3. 按子节点名称的哈希值（name.hash）加入父目录的哈希索引。
+ * 4. 子节点的父目录编号变了，用 node_mark_dirty 标记它在检查点时写回。
+ *
+ * 参数：
+ * - parent: 父目录节点。
+ * - child: 要添加的子节点。
+ *
+ * 返回值：
+ * - 无。
+ *
+ * 实现逻辑：
+ * 1. 子节点列表容量不足时按两倍扩展。
+ * 2. 将子节点添加到列表末尾，记录它在列表中的下标（child_slot），
+ *    位置（dir_pos）取列表中最后一个子节点的位置加一。
+ * 3. 哈希索引插入后会超过 3/4 时重建（有效节点超过一半时翻倍），然后插入子节点。
+ *
+ * 注意：
+ * - 确保父目录是目录类型，子节点的 name 已经由 name_intern 填好。
+ * - 调用方持有父目录的写锁（加载时除外）。
+ */
+void add_child(filetype *parent, filetype *child)
+{
+	int end = parent->children_end;
+
+	if (end == parent->children_capacity)
+	{
+		parent->children_capacity = parent->children_capacity ? parent->children_capacity * 2 : 4;
+		parent->children = realloc(parent->children, parent->children_capacity * sizeof(filetype *));
+	}
+
+	// remove_child 去掉了末尾的空位，children[end - 1] 不为 NULL。位置用完时（累计加入 2^32 个
+	// 子节点）按当前顺序重新编号，这时正在分批读取的 readdir 可能重复或漏掉目录项
+	if (end > 0 && parent->children[end - 1]->dir_pos == UINT32_MAX)
+	{
+		for (int i = 0, n = 0; i < end; i++)
+			if (parent->children[i] != NULL)
+				parent->children[i]->dir_pos = n++;
+	}
+	child->dir_pos = end > 0 ? parent->children[end - 1]->dir_pos + 1 : 0;
+	child->child_slot = end;
+	(parent->children)[end] = child;
+	parent->children_end = end + 1;
+	(parent->num_children)++;
+
+	dir_table *table = parent->dir_index;
+	if (table == NULL || (table->used + 1) * 4 > table->size * 3)
+	{
+		int size = table ? table->size : DIR_INDEX_MIN_SIZE;
+		while (parent->num_children * 2 > size)
+			size *= 2;
+		dir_index_rebuild(parent, size);
+	}
+	dir_table_put(parent->dir_index, child);
+
+	node_mark_dirty(child);
+}
+
+/*
+ * remove_child - 从父目录中移除子节点
+ *
+ * 功能：
+ * 1. 从父目录的哈希索引中删除子节点。
+ * 2. 把它在列表中的位置置为 NULL，其余子节点的顺序和位置（dir_pos）都不变。
+ *
+ * 实现逻辑：
+ * 1. 去掉列表末尾的空位，add_child 总能从最后一个子节点得到下一个位置。
+ * 2. 空位超过子节点数时按原来的顺序压缩列表，只更新 child_slot，均摊 O(1)。
+ *
+ * 注意：
+ * - 不能用最后一个子节点填补空位：readdir 以位置为偏移量分批读取，一边读一边删除
+ *   （rm -rf）时被移动的子节点会被跳过。
+ */
+void remove_child(filetype *parent, filetype *child)
+{
+	filetype **children = parent->children;
+	int end = parent->children_end;
+
+	dir_index_delete(parent, child);
+	children[child->child_slot] = NULL;
+	parent->num_children--;
+	while (end > 0 && children[end - 1] == NULL)
+		end--;
+
+	if (end - parent->num_children > parent->num_children + 8)
+	{
+		int n = 0;
+		for (int i = 0; i < end; i++)
+		{
+			if (children[i] == NULL)
+				continue;
+			children[i]->child_slot = n;
+			children[n++] = children[i];
+		}
+		end = n;
+	}
+	parent->children_end = end;
+}
+
+/*
+ * dir_seek - 返回 children 中第一个位置不小于 pos 的子节点的下标，没有时返回 children_end
+ *
+ * 注意：
+ * - children 按位置递增排列，中间可能有空位；二分查找时遇到空位向后找到下一个子节点。
+ * - 调用方持有目录的锁。
+ */
+int dir_seek(filetype *dir, uint32_t pos)
+{
+	int lo = 0, hi = dir->children_end;
+
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2, i = mid;
+
+		while (i < hi && dir->children[i] == NULL)
+			i++;
+		if (i == hi || dir->children[i]->dir_pos >= pos)
+			hi = mid;
+		else
+			lo = i + 1;
+	}
+	while (lo < dir->children_end && dir->children[lo] == NULL)
+		lo++;
+	return lo;
+}
+
+/*
+ * inode_table - 按 inode 编号索引的内存节点表
+ *
+ * 功能：
+ * 1. inode_table[number] 指向编号为 number 的节点，未使用的编号为 NULL。
+ * 2. 加载 file_structure.bin 时按编号直接定位节点，再根据父目录编号连接成树。
+ *
+ * 注意：
+ * - 表第一次使用时就分配 spblock.inode_count 项，挂载期间不会再 realloc，
+ *   低层接口按编号读取节点时不需要加锁。
+ */
+filetype **inode_table = NULL;
+size_t inode_table_size = 0;
+
+/*
+ * inode_table_set - 设置 inode 编号对应的节点
+ *
+ * 参数：
+ * - number: inode 编号。
+ * - node: 节点指针，删除时传 NULL。
+ */
+void inode_table_set(int number, filetype *node)
+{
+	if ((size_t)number >= inode_table_size)
+	{
+		size_t new_size = inode_table_size ? inode_table_size : spblock.inode_count > 128 ? spblock.inode_count : 128;
+		while (new_size <= (size_t)number)
+			new_size *= 2;
+		inode_table = realloc(inode_table, new_size * sizeof(filetype *));
+		memset(inode_table + inode_table_size, 0, (new_size - inode_table_size) * sizeof(filetype *));
+		inode_table_size = new_size;
+	}
+	inode_table[number] = node;
+}
+
+/*
+ * 节点分配器（slab）
+ *
+ * 功能：
+ * 1. 节点按 NODE_SLAB_COUNT 个一组整块分配，删除后归还的节点放进空闲链表，
+ *    下次 node_alloc 直接复用，创建和删除文件不再逐个 malloc / free 节点。
+ * 2. 加载 file_structure.bin 时的大量节点也从整块中切出，相邻编号的节点在内存中相邻。
+ *
+ * 实现逻辑：
+ * 1. 空闲的槽位复用节点本身的内存保存链表指针（node_slot）。
+ * 2. 空闲链表由 node_slab.lock 保护；node_alloc 只在创建文件和目录时调用，
+ *    这些操作还要追加日志（journal_lock），这把锁不会成为新的串行点。
+ *
+ * 注意：
+ * - 整块内存不归还给系统，卸载前节点总数的峰值决定占用。
+ * - 已删除的节点不能直接 node_free：不加锁的读者可能还持有它，见 forget_inode。
+ */
+#define NODE_SLAB_COUNT 256
+
+typedef union node_slot
+{
+	filetype node;
+	union node_slot *next;
+} node_slot;
+
+struct
+{
+	pthread_mutex_t lock;
+	node_slot *free;  // 空闲槽位链表
+	size_t slabs;	  // 已分配的整块数
+	size_t in_use;	  // 正在使用的节点数
+} node_slab = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0};
+
+/*
+ * node_alloc - 分配一个清零的节点（节点锁为 0 即未加锁）
+ */
+filetype *node_alloc()
+{
+	pthread_mutex_lock(&node_slab.lock);
+	if (node_slab.free == NULL)
+	{
+		node_slot *slab = malloc(NODE_SLAB_COUNT * sizeof(node_slot));
+		if (slab == NULL)
+			abort();
+		for (int i = NODE_SLAB_COUNT - 1; i >= 0; i--)
+		{
+			slab[i].next = node_slab.free;
+			node_slab.free = &slab[i];
+		}
+		node_slab.slabs++;
+	}
+	node_slot *slot = node_slab.free;
+	node_slab.free = slot->next;
+	node_slab.in_use++;
+	pthread_mutex_unlock(&node_slab.lock);
+
+	filetype *node = &slot->node;
+	memset(node, 0, sizeof(filetype));
+	return node;
+}
+
+/*
+ * node_free - 释放节点的子节点数组、哈希索引和 extent，把节点归还 slab
+ *
+ * 注意：
+ * - 只用于从未发布的节点（创建失败）或经过 rcu_retire_with 延迟之后的节点。
+ */
+void node_free(void *ptr)
+{
+	filetype *node = ptr;
+	node_slot *slot = (node_slot *)node;
+
+	if (S_ISDIR(node->permissions))
+	{
+		free(node->children);
+		free(node->dir_index);
+	}
+	else
+	{
+		free(node->extents);
+		free(node->extent_blocks);
+	}
+
+	pthread_mutex_lock(&node_slab.lock);
+	slot->next = node_slab.free;
+	node_slab.free = slot;
+	node_slab.in_use--;
+	pthread_mutex_unlock(&node_slab.lock);
+}
+
+/*
+ * name_pool_compact - 整理名称池，回收不再被节点引用的名称
+ *
+ * 功能：
+ * 1. 名称池自上次整理以来增长到两倍以上（且超过 NAME_COMPACT_MIN）时，由检查点调用。
+ * 2. 把 inode_table 中所有节点（包括已删除但仍打开的节点）的名称重新驻留到新的块中，
+ *    删除、重命名留下的名称和驻留表中对应的槽位随之消失。
+ *
+ * 注意：
+ * - 调用方独占 fs_lock：没有读者持有旧的偏移。旧块仍交给 rcu_retire，与其他共享结构一致。
+ * - 已经从 inode_table 摘下、等待回收的节点不会再被读取，它们的偏移不需要更新。
+ */
+#define NAME_COMPACT_MIN (4 * (uint64_t)NAME_CHUNK_SIZE)
+
+void name_pool_compact()
+{
+	if (name_pool.top < NAME_COMPACT_MIN || name_pool.top < 2 * name_pool.compacted)
+		return;
+
+	for (int k = 0; k < NAME_SHARDS; k++)
+		pthread_mutex_lock(&name_pool.shards[k].lock);
+	size_t count = name_pool.nchunks < NAME_CHUNKS_MAX ? name_pool.nchunks : NAME_CHUNKS_MAX;
+	char **old_chunks = malloc(count * sizeof(char *));
+	if (old_chunks == NULL)
+		abort();
+	memcpy(old_chunks, name_pool.chunks, count * sizeof(char *));
+	memset(name_pool.chunks, 0, count * sizeof(char *));
+	name_pool.nchunks = 0;
+	name_pool.top = 0;
+	for (int k = 0; k < NAME_SHARDS; k++)
+	{
+		name_shard *shard = &name_pool.shards[k];
+
+		free(shard->table);
+		shard->table = NULL;
+		shard->table_size = 0;
+		shard->table_used = 0;
+		shard->top = shard->end = 0;
+	}
+
+	for (size_t i = 0; i < inode_table_size; i++)
+	{
+		filetype *node = inode_table[i];
+		if (node == NULL)
+			continue;
+		uint32_t off = node->name.off;
+		const char *name = old_chunks[off >> NAME_CHUNK_BITS] + (off & (NAME_CHUNK_SIZE - 1));
+		// 池中的名称至少有一半已经不再使用，新池比旧池小得多，不会失败
+		name_intern_locked(name_shard_of(node->name.hash), name, node->name.len, node->name.hash, &node->name.off);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		rcu_retire(old_chunks[i]);
+	free(old_chunks);
+	name_pool.compacted = name_pool.top;
+	for (int k = NAME_SHARDS - 1; k >= 0; k--)
+		pthread_mutex_unlock(&name_pool.shards[k].lock);
+}
+
+/*
+ * file_structure.bin 磁盘格式（不含任何指针）
+ *
+ * 文件布局：
+ * - 开头是 meta_header，记录魔数、版本号和每条 inode 记录的大小。
+ * - 随后是 inode 表：编号为 n 的节点保存在 sizeof(meta_header) + n * sizeof(disk_inode) 处，
+ *   未使用的编号对应全 0 的记录（valid = 0）。
+ * - 目录项不单独存放：每条记录保存自身的名称和父目录的 inode 编号，
+ *   即 (父目录编号, 名称) -> 子节点编号。完整路径不保存，需要时由父目录链推导（node_path）。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /            (inode 2)
+ * ├── home     (inode 3)
+ * │   └── user (inode 5)
+ * └── test.txt (inode 4)
+ *
+ * 磁盘上的 inode 表：
+ * [0] valid=0
+ * [1] valid=0
+ * [2] valid=1 parent=0 name="/"
+ * [3] valid=1 parent=2 name="home"
+ * [4] valid=1 parent=2 name="test.txt"
+ * [5] valid=1 parent=3 name="user"
+ *
+ * 注意：
+ * - 记录位置只取决于 inode 编号，修改某个节点只需重写它自己的记录。
+ * - 保存和加载都只需顺序扫描一遍 inode 表，时间与节点数成线性关系。
+ */
+#define META_MAGIC 0x46534d54u
+#define META_VERSION 5
+
+typedef struct meta_header
+{
+	uint32_t magic;		  // META_MAGIC
+	uint32_t version;	  // META_VERSION
+	uint32_t record_size; // sizeof(disk_inode)
+	uint32_t root;		  // 根目录的 inode 编号
+} meta_header;
+
+typedef struct disk_inode
+{
+	uint32_t valid;		  // 记录是否有效
+	uint32_t parent;	  // 父目录的 inode 编号（根目录为 0）
+	char name[NAME_LEN_MAX + 1]; // 文件或目录的名称
+	uint32_t permissions; // 文件类型和权限模式
+	uint32_t user_id;	  // 用户 ID
+	uint32_t group_id;	  // 组 ID
+	uint32_t num_links;	  // 硬链接数
+	int64_t a_time;		  // 最后访问时间
+	int64_t m_time;		  // 最后修改时间
+	int64_t c_time;		  // 最后状态更改时间
+	int64_t b_time;		  // 创建时间
+	int64_t size;		  // 文件或目录的大小
+	uint32_t num_extents;		  // extent 数量
+	uint32_t extent_block;		  // extent 块链的第一个块（extent 超过 EXTENT_INLINE 个时）
+	extent extents[EXTENT_INLINE]; // 内联的 extent
+	int32_t number;		  // inode 编号
+	int32_t blocks;		  // 文件占用的数据块数量
+} disk_inode;
+
+/*
+ * 脏数据跟踪
+ *
+ * - 节点的 dirty 标记: 节点被修改后由 node_mark_dirty 置 1，写回时重写它在 inode 表中的记录。
+ * - dirty_inodes: 自上次写回以来被标记为脏的 inode 编号，写回时只访问这些节点，不遍历整棵树。
+ * - freed_inodes: 自上次写回以来被删除的 inode 编号，写回时把对应记录清零。
+ * - pending_blocks: 自上次检查点以来释放的数据块，检查点时才归还位图，见 free_db。
+ * - bitmap_dirty: 位图或检查点序列号被修改后置 1。
+ * - image_written: 磁盘镜像是否已经完整存在，首次保存时需要先建立文件。
+ *
+ * save_contents 只用 pwrite 写回脏的部分，写回完成后清除脏标记。
+ * 数据块不在内存中，写入时直接 pwrite 到镜像文件，不需要脏标记。
+ */
+int bitmap_dirty = 0;
+pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER; // 保护 dirty_inodes
+int *dirty_inodes = NULL;
+int dirty_inode_count = 0;
+int dirty_inode_capacity = 0;
+pthread_mutex_t freed_lock = PTHREAD_MUTEX_INITIALIZER; // 保护 freed_inodes
+int *freed_inodes = NULL;
+int freed_count = 0;
+int freed_capacity = 0;
+pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER; // 保护 pending_blocks
+uint32_t *pending_blocks = NULL;
+int pending_count = 0;
+int pending_capacity = 0;
+int image_written = 0;
+
+/*
+ * node_mark_dirty - 标记节点需要在下一次检查点时写回
+ *
+ * 注意：
+ * - 只有从干净变为脏的那一次把编号加入 dirty_inodes；之后对同一节点的修改只是一次原子交换。
+ * - 调用方持有节点锁或父目录的锁，不同节点可能被不同线程同时标记，dirty_inodes 由 dirty_lock 保护。
+ */
+void node_mark_dirty(filetype *node)
+{
+	if (__atomic_exchange_n(&node->dirty, 1, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&dirty_lock);
+	if (dirty_inode_count == dirty_inode_capacity)
+	{
+		dirty_inode_capacity = dirty_inode_capacity ? dirty_inode_capacity * 2 : 64;
+		dirty_inodes = realloc(dirty_inodes, dirty_inode_capacity * sizeof(int));
+	}
+	dirty_inodes[dirty_inode_count++] = node->number;
+	pthread_mutex_unlock(&dirty_lock);
+}
+
+/*
+ * find_free_inode - 查找空闲的 inode
+ *
+ * 功能：
+ * 1. 查找当前文件系统中空闲的 inode 编号。
+ * 2. 用于创建新文件或目录时分配 inode。
+ *
+ * 参数：
+ * - 无。
+ *
+ * 返回值：
+ * - 成功时返回空闲的 inode 编号。
+ * - 如果没有空闲 inode，返回 -1。
+ *
+ * 实现逻辑：
+ * 1. 空闲计数为 0 时直接返回 -1。
+ * 2. 否则由 allocator_get 从当前线程的主段开始查找。
+ *
+ * 注意：
+ * - 如果 inode 表已满，需扩展文件系统。
+ * - 释放编号使用 free_inode_number。
+ */
+int find_free_inode()
+{
+	unsigned long n;
+
+	if (__atomic_load_n(&spblock.free_inodes, __ATOMIC_RELAXED) == 0)
+		return -1;
+
+	long i = allocator_get(&inode_alloc, inode_bitmap, -1, 1, &n);
+	if (i < 0)
+		return -1;
+	__atomic_sub_fetch(&spblock.free_inodes, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&bitmap_dirty, 1, __ATOMIC_RELAXED);
+	return i;
+}
+
+void free_inode_number(int number)
+{
+	allocator_put(&inode_alloc, inode_bitmap, number);
+	__atomic_add_fetch(&spblock.free_inodes, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&bitmap_dirty, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * no_free_blocks - 数据块分配失败时调用，还有延迟释放的块时请求一次检查点（见 free_db）
+ */
+int no_free_blocks()
+{
+	pthread_mutex_lock(&pending_lock);
+	if (pending_count > 0)
+		__atomic_store_n(&checkpoint_wanted, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pending_lock);
+	return -1;
+}
+
+/*
+ * find_free_db - 查找空闲的数据块
+ *
+ * 功能：
+ * 1. 查找当前文件系统中空闲的数据块编号。
+ * 2. 用于存储文件数据时分配数据块。
+ *
+ * 参数：
+ * - 无。
+ *
+ * 返回值：
+ * - 成功时返回空闲的数据块编号。
+ * - 如果没有空闲数据块，返回 -1。
+ *
+ * 实现逻辑：
+ * 1. 空闲计数为 0 时直接返回 -1。
+ * 2. 否则由 allocator_get 从当前线程的主段开始查找。
+ *
+ * 注意：
+ * - 如果数据块已满，需扩展文件系统。
+ * - 0 号数据块保留，返回值不会是 0。释放数据块使用 free_db。
+ */
+int find_free_db()
+{
+	unsigned long n;
+
+	if (__atomic_load_n(&spblock.free_blocks, __ATOMIC_RELAXED) == 0)
+		return no_free_blocks();
+
+	long i = allocator_get(&block_alloc, data_bitmap, -1, 1, &n);
+	if (i < 0)
+		return no_free_blocks();
+	__atomic_sub_fetch(&spblock.free_blocks, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&bitmap_dirty, 1, __ATOMIC_RELAXED);
+	return i;
+}
+
+/*
+ * free_db - 释放数据块
+ *
+ * 功能：
+ * 1. 丢弃块的缓存记录（包括脏数据），把块号放入 pending_blocks，不清除位图。
+ * 2. 检查点时由 pending_release 一次归还，之后才能被重新分配。
+ *
+ * 注意：
+ * - 删除文件的日志记录落盘之前，块不能交给别的文件：写回线程会把新文件的数据写进镜像，
+ *   崩溃后重放从上一个检查点恢复出被删除的文件，它的 extent 就指向了别人的数据。
+ *   检查点之后日志被清空，被删除的文件不会再恢复，这时归还才安全。
+ * - 空闲块用完而还有待归还的块时，分配失败的回调结束后会做一次检查点（见 find_free_run）。
+ */
+void free_db(int block)
+{
+	cache_invalidate(block);
+
+	pthread_mutex_lock(&pending_lock);
+	if (pending_count == pending_capacity)
+	{
+		pending_capacity = pending_capacity ? pending_capacity * 2 : 64;
+		pending_blocks = realloc(pending_blocks, pending_capacity * sizeof(uint32_t));
+	}
+	pending_blocks[pending_count++] = block;
+	pthread_mutex_unlock(&pending_lock);
+}
+
+/*
+ * pending_release - 检查点时归还延迟释放的数据块
+ *
+ * 功能：
+ * 1. 在写检查点之前把 pending_blocks 中的块从位图中清除，检查点中的位图因此不含它们。
+ * 2. 检查点完成后由 journal_checkpoint 清空 pending_blocks。
+ *
+ * 注意：
+ * - 调用方独占 fs_lock，没有其他线程同时分配或释放数据块。
+ */
+void pending_release()
+{
+	for (int i = 0; i < pending_count; i++)
+		allocator_put(&block_alloc, data_bitmap, pending_blocks[i]);
+	spblock.free_blocks += pending_count;
+	if (pending_count > 0)
+		bitmap_dirty = 1;
+}
+
+/*
+ * pending_restore - 检查点失败时重新占用 pending_release 归还的块，等下一次检查点再归还
+ */
+void pending_restore()
+{
+	for (int i = 0; i < pending_count; i++)
+		bitmap_set(data_bitmap, pending_blocks[i]);
+	spblock.free_blocks -= pending_count;
+	if (pending_count > 0)
+		bitmap_dirty = 1;
+}
+
+/*
+ * find_free_run - 分配一段连续的数据块
+ *
+ * 参数：
+ * - goal: 希望从这个块开始分配（通常是文件上一段数据之后的块），无效时从当前线程的主段分配。
+ * - want: 希望分配的块数。
+ * - got: 返回实际分配的块数（至少 1）。
+ *
+ * 返回值：
+ * - 成功时返回起始块号；没有空闲数据块时返回 -1。
+ */
+int find_free_run(int goal, int want, int *got)
+{
+	unsigned long n;
+
+	if (__atomic_load_n(&spblock.free_blocks, __ATOMIC_RELAXED) == 0)
+		return no_free_blocks();
+	if (goal <= 0 || (uint64_t)goal >= spblock.block_count)
+		goal = -1;
+
+	long start = allocator_get(&block_alloc, data_bitmap, goal, want, &n);
+	if (start < 0)
+		return no_free_blocks();
+	__atomic_sub_fetch(&spblock.free_blocks, n, __ATOMIC_RELAXED);
+	__atomic_store_n(&bitmap_dirty, 1, __ATOMIC_RELAXED);
+	*got = n;
+	return start;
+}
+
+/*
+ * extent_find - 二分查找覆盖或位于逻辑块 lblock 之前的最后一个 extent
+ *
+ * 返回值：
+ * - extent 的下标；lblock 位于第一个 extent 之前时返回 -1。
+ */
+int extent_find(const filetype *file, uint32_t lblock)
+{
+	int lo = 0, hi = file->num_extents - 1, found = -1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (file->extents[mid].logical <= lblock)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+/*
+ * extent_find_cursor - 带游标的 extent_find
+ *
+ * 注意：
+ * - 先检查游标所在的 extent 和它的下一个，命中时为 O(1)，顺序读写几乎总是命中；
+ *   否则退回二分查找并更新游标。cursor 为 NULL 时等同于 extent_find。
+ */
+int extent_find_cursor(const filetype *file, uint32_t lblock, int *cursor)
+{
+	const extent *e = file->extents;
+	int n = file->num_extents;
+
+	if (cursor != NULL && *cursor >= 0 && *cursor < n)
+	{
+		for (int c = *cursor; c < n && c <= *cursor + 1; c++)
+		{
+			if (e[c].logical <= lblock && (c + 1 == n || e[c + 1].logical > lblock))
+				return *cursor = c;
+		}
+	}
+
+	int i = extent_find(file, lblock);
+	if (cursor != NULL)
+		*cursor = i;
+	return i;
+}
+
+/*
+ * extent_map - 把逻辑块号映射为物理块号
+ *
+ * 返回值：
+ * - 已分配时返回物理块号，*run 为从该块起仍然连续的块数。
+ * - 未分配（空洞）时返回 0，*run 为到下一个 extent 之前的空洞长度。
+ */
+int extent_map(const filetype *file, uint32_t lblock, uint32_t *run, int *cursor)
+{
+	int i = extent_find_cursor(file, lblock, cursor);
+
+	if (i >= 0 && lblock < file->extents[i].logical + file->extents[i].len)
+	{
+		*run = file->extents[i].logical + file->extents[i].len - lblock;
+		return file->extents[i].start + (lblock - file->extents[i].logical);
+	}
+	*run = i + 1 < file->num_extents ? file->extents[i + 1].logical - lblock : UINT32_MAX;
+	return 0;
+}
+
+/*
+ * extent_reserve - 保证文件可以容纳 count 个 extent
+ *
+ * 功能：
+ * 1. 扩充内存中的 extents 数组。
+ * 2. extent 超过 EXTENT_INLINE 个时，提前分配保存它们所需的数据块，
+ *    这样写回时不会因为空间不足而无法保存。
+ *
+ * 返回值：
+ * - 成功返回 0，数据块不足返回 -ENOSPC。
+ */
+int extent_reserve(filetype *file, int count)
+{
+	int need = count <= EXTENT_INLINE ? 0 : (count + EXTENTS_PER_BLOCK - 1) / EXTENTS_PER_BLOCK;
+
+	while (file->num_extent_blocks < need)
+	{
+		int block = find_free_db();
+		if (block < 0)
+			return -ENOSPC;
+		file->extent_blocks = realloc(file->extent_blocks, (file->num_extent_blocks + 1) * sizeof(int));
+		file->extent_blocks[file->num_extent_blocks++] = block;
+	}
+	if (count > file->extents_capacity)
+	{
+		file->extents_capacity = file->extents_capacity ? file->extents_capacity * 2 : EXTENT_INLINE;
+		if (file->extents_capacity < count)
+			file->extents_capacity = count;
+		file->extents = realloc(file->extents, file->extents_capacity * sizeof(extent));
+	}
+	return 0;
+}
+
+/*
+ * extent_insert - 在下标 i 之后插入一个 extent，能与前后相接的直接合并
+ *
+ * 注意：
+ * - 调用前需要 extent_reserve(file, file->num_extents + 1)。
+ */
+void extent_insert(filetype *file, int i, uint32_t logical, uint32_t start, uint32_t len)
+{
+	extent *e = file->extents;
+
+	if (i >= 0 && e[i].logical + e[i].len == logical && e[i].start + e[i].len == start)
+		e[i].len += len;
+	else
+	{
+		memmove(&e[i + 2], &e[i + 1], (file->num_extents - i - 1) * sizeof(extent));
+		e[i + 1].logical = logical;
+		e[i + 1].start = start;
+		e[i + 1].len = len;
+		file->num_extents++;
+		i++;
+	}
+
+	if (i + 1 < file->num_extents && e[i].logical + e[i].len == e[i + 1].logical &&
+		e[i].start + e[i].len == e[i + 1].start)
+	{
+		e[i].len += e[i + 1].len;
+		memmove(&e[i + 1], &e[i + 2], (file->num_extents - i - 2) * sizeof(extent));
+		file->num_extents--;
+	}
+}
+
+/*
+ * extent_alloc - 为逻辑块区间 [lblock, lblock + count) 中的空洞分配数据块
+ *
+ * 功能：
+ * 1. 已经映射的部分跳过，空洞处按需分配。
+ * 2. 优先紧接着前一个 extent 的物理块分配，顺序写入的文件会合并成少数几个 extent。
+ * 3. 区间首尾两个块如果是新分配的就清零，避免读到之前文件留下的数据。
+ *
+ * 返回值：
+ * - 成功返回 0，空间不足返回 -ENOSPC，写镜像失败返回 -EIO（已经分配的部分保留在文件中）。
+ *
+ * 注意：
+ * - 调用方随后会写满整个区间，只有首尾两个块可能被部分覆盖，中间的块不必清零。
+ */
+int extent_alloc(filetype *file, uint32_t lblock, uint32_t count)
+{
+	static const char zero_block[block_size];
+	uint32_t first = lblock, end = lblock + count;
+
+	while (lblock < end)
+	{
+		uint32_t run;
+		int got;
+
+		if (extent_map(file, lblock, &run, NULL) != 0)
+		{
+			lblock += run;
+			continue;
+		}
+		if (extent_reserve(file, file->num_extents + 1) < 0)
+			return -ENOSPC;
+
+		int i = extent_find(file, lblock);
+		int goal = i >= 0 ? (int)(file->extents[i].start + file->extents[i].len) : 0;
+		int start = find_free_run(goal, end - lblock < run ? end - lblock : run, &got);
+		if (start < 0)
+			return -ENOSPC;
+
+		if ((lblock == first && cache_write_span(start, 0, zero_block, block_size) != 0) ||
+			(lblock + got == end && cache_write_span(start + got - 1, 0, zero_block, block_size) != 0))
+			return -EIO;
+
+		extent_insert(file, i, lblock, start, got);
+		file->blocks += got;
+		lblock += got;
+	}
+	return 0;
+}
+
+/*
+ * extent_io - 在文件的字节区间 [off, off + len) 与缓冲区之间复制数据
+ *
+ * 功能：
+ * 1. 按连续的物理区段经块缓存读写，未命中的连续块只做一次 pread，写入只做一次 pwrite。
+ * 2. write 为 1 时写入镜像文件；为 0 时读出，空洞读出为 0。
+ *
+ * 返回值：
+ * - 成功返回 0，读写镜像失败返回 -EIO。
+ *
+ * 注意：
+ * - 写入前需要先用 extent_alloc 分配对应的块。
+ * - cursor 可以为 NULL，见 extent_find_cursor。
+ */
+int extent_io(filetype *file, char *buf, size_t len, off_t off, int write, int *cursor)
+{
+	while (len > 0)
+	{
+		uint32_t run;
+		int block = extent_map(file, off / block_size, &run, cursor);
+		size_t in_block = off % block_size;
+		size_t span = (size_t)run * block_size - in_block;
+
+		if (span > len)
+			span = len;
+
+		if (block == 0)
+		{
+			if (!write)
+				memset(buf, 0, span);
+		}
+		else if (write ? cache_write_span(block, in_block, buf, span)
+					   : cache_read_span(block, in_block, buf, span))
+			return -EIO;
+
+		buf += span;
+		off += span;
+		len -= span;
+	}
+	return 0;
+}
+
+/*
+ * extent_free_all - 归还文件的全部数据块和 extent 块
+ */
+void extent_free_all(filetype *file)
+{
+	for (int i = 0; i < file->num_extents; i++)
+		for (uint32_t b = 0; b < file->extents[i].len; b++)
+			free_db(file->extents[i].start + b);
+	for (int i = 0; i < file->num_extent_blocks; i++)
+		free_db(file->extent_blocks[i]);
+
+	free(file->extents);
+	free(file->extent_blocks);
+	file->extents = NULL;
+	file->extent_blocks = NULL;
+	file->num_extents = file->extents_capacity = file->num_extent_blocks = 0;
+	file->blocks = 0;
+}
+
+/*
+ * extent_truncate - 归还逻辑块 lblock 及之后的全部数据块
+ *
+ * 注意：
+ * - 跨过 lblock 的 extent 被截短，之后的 extent 整个删除。
+ * - 剩下的 extent 需要的 extent 块变少时，多余的 extent 块一并归还。
+ */
+void extent_truncate(filetype *file, uint32_t lblock)
+{
+	int keep = 0;
+
+	for (int i = 0; i < file->num_extents; i++)
+	{
+		extent *e = &file->extents[i];
+		uint32_t from = 0;
+
+		if (e->logical + e->len <= lblock)
+		{
+			keep = i + 1;
+			continue;
+		}
+		if (e->logical < lblock)
+		{
+			from = lblock - e->logical;
+			keep = i + 1;
+		}
+		for (uint32_t b = from; b < e->len; b++)
+			free_db(e->start + b);
+		file->blocks -= e->len - from;
+		e->len = from;
+	}
+	file->num_extents = keep;
+
+	int need = keep <= EXTENT_INLINE ? 0 : (keep + EXTENTS_PER_BLOCK - 1) / EXTENTS_PER_BLOCK;
+	while (file->num_extent_blocks > need)
+		free_db(file->extent_blocks[--file->num_extent_blocks]);
+}
+
+/*
+ * release_inode - 删除节点后释放它的 inode 编号
+ *
+ * 功能：
+ * 1. 从 inode 表中移除节点，并在 inode 位图中把编号标记为空闲，同时归还文件的数据块。
+ * 2. 记录该编号，下次写回时清零磁盘上的对应记录。
+ *
+ * 注意：
+ * - 低层接口以 inode 编号寻址，内核 forget 之前编号不能被复用，
+ *   此时由 forget_inode 在引用计数归零时完成第 1 步。
+ * - forget_inode 之后节点交给 rcu_retire_with，在所有可能持有它的读者离开后归还 slab。
+ *   并发的 forget 和 release 可能先后看到同一个节点满足 node_forgotten，
+ *   inode 表中已经不是它时说明已经处理过，直接返回。
+ * - 调用方持有节点的写锁（删除时同时持有父目录的写锁）。
+ */
+void forget_inode(filetype *node)
+{
+	if ((size_t)node->number >= inode_table_size || inode_table[node->number] != node)
+		return;
+	inode_table_set(node->number, NULL);
+	free_inode_number(node->number);
+	if (!S_ISDIR(node->permissions))
+		extent_free_all(node);
+	rcu_retire_with(node, node_free);
+}
+
+/*
+ * freed_inode_add - 记下被删除的 inode 编号，下一次写回时把它的记录清零
+ */
+void freed_inode_add(int number)
+{
+	pthread_mutex_lock(&freed_lock);
+	if (freed_count == freed_capacity)
+	{
+		freed_capacity = freed_capacity ? freed_capacity * 2 : 64;
+		freed_inodes = realloc(freed_inodes, freed_capacity * sizeof(int));
+	}
+	freed_inodes[freed_count++] = number;
+	pthread_mutex_unlock(&freed_lock);
+}
+
+void release_inode(filetype *node)
+{
+	node->valid = 0;
+	// 内核仍持有 lookup 引用或仍有打开的句柄时保留编号和数据，等它们都归还后再释放
+	if (node_forgotten(node))
+		forget_inode(node);
+	freed_inode_add(node->number);
+}
+
+/*
+ * node_to_disk / disk_to_node - 内存节点与磁盘记录互相转换
+ *
+ * 注意：
+ * - 磁盘记录不包含 children、parent 等指针，也不保存完整路径；文件类型保存在 permissions 中。
+ * - disk_to_node 之后还需要由 load_contents 连接父子关系。
+ * - 名称为空或没有结尾 '\0' 的记录无法驻留，disk_to_node 返回 NULL。
+ * - extent 较多的文件把 extent 存在数据块中，因此加载 inode 表之前必须先读入超级块。
+ */
+void node_to_disk(const filetype *node, disk_inode *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->valid = 1;
+	rec->parent = node->parent ? node->parent->number : 0;
+	memcpy(rec->name, name_str(&node->name), node->name.len);
+	rec->permissions = node->permissions;
+	rec->user_id = node->user_id;
+	rec->group_id = node->group_id;
+	rec->num_links = node->num_links;
+	rec->a_time = node->a_time;
+	rec->m_time = node->m_time;
+	rec->c_time = node->c_time;
+	rec->b_time = node->b_time;
+	rec->size = node->size;
+	rec->number = node->number;
+	rec->blocks = node->blocks;
+	// 目录没有 extent（与 children 共用 union）
+	if (S_ISDIR(node->permissions))
+		return;
+	rec->num_extents = node->num_extents;
+	if (node->num_extents <= EXTENT_INLINE)
+	{
+		if (node->num_extents > 0)
+			memcpy(rec->extents, node->extents, node->num_extents * sizeof(extent));
+	}
+	else
+	{
+		// extent 块已由 extent_reserve 预先分配，这里只填写内容
+		int done = 0;
+		rec->extent_block = node->extent_blocks[0];
+		for (int k = 0; k < node->num_extent_blocks; k++)
+		{
+			char block[block_size];
+			extent_block_header header;
+			int count = node->num_extents - done;
+
+			if (count > (int)EXTENTS_PER_BLOCK)
+				count = EXTENTS_PER_BLOCK;
+			header.next = k + 1 < node->num_extent_blocks ? node->extent_blocks[k + 1] : 0;
+			header.count = count;
+			memcpy(block, &header, sizeof(header));
+			memcpy(block + sizeof(header), node->extents + done, count * sizeof(extent));
+			if (image_write(block, sizeof(header) + count * sizeof(extent), block_offset(node->extent_blocks[k])) != 0)
+				perror("extent block");
+			done += count;
+		}
+	}
+}
+
+filetype *disk_to_node(const disk_inode *rec)
+{
+	name_ref name;
+	if (name_intern(rec->name, strnlen(rec->name, sizeof(rec->name)), &name) != 0)
+		return NULL;
+
+	filetype *node = node_alloc();
+
+	node->valid = 1;
+	node->name = name;
+	node->permissions = rec->permissions;
+	node->user_id = rec->user_id;
+	node->group_id = rec->group_id;
+	node->num_links = rec->num_links;
+	node->a_time = rec->a_time;
+	node->m_time = rec->m_time;
+	node->c_time = rec->c_time;
+	node->b_time = rec->b_time;
+	node->size = rec->size;
+	node->number = rec->number;
+	node->blocks = rec->blocks;
+	if (S_ISDIR(node->permissions))
+		return node;
+	node->extents_capacity = rec->num_extents;
+	node->extents = rec->num_extents ? malloc(rec->num_extents * sizeof(extent)) : NULL;
+	if (rec->num_extents <= EXTENT_INLINE)
+	{
+		node->num_extents = rec->num_extents;
+		if (node->num_extents > 0)
+			memcpy(node->extents, rec->extents, node->num_extents * sizeof(extent));
+	}
+	else
+	{
+		// 沿着 extent 块链读出全部 extent，块号记入 extent_blocks 以便继续使用
+		uint32_t next = rec->extent_block;
+		while (next != 0 && next < spblock.block_count)
+		{
+			char block[block_size];
+			extent_block_header header;
+
+			if (image_read(block, block_size, block_offset(next)) != 0)
+				break;
+			memcpy(&header, block, sizeof(header));
+			if (node->num_extents + header.count > rec->num_extents)
+				break;
+			memcpy(node->extents + node->num_extents, block + sizeof(header), header.count * sizeof(extent));
+			node->num_extents += header.count;
+			node->extent_blocks = realloc(node->extent_blocks, (node->num_extent_blocks + 1) * sizeof(int));
+			node->extent_blocks[node->num_extent_blocks++] = next;
+			next = header.next;
+		}
+	}
+
+	return node;
+}
+
+/*
+ * save_contents - 保存文件系统内容到磁盘
+ *
+ * 功能：
+ * 1. 把被修改过的节点写入 `file_structure.bin` 中按 inode 编号定位的记录。
+ * 2. 把被删除节点的记录清零。
+ * 3. 位图有变化时把超级块和位图写入镜像文件 `fs.img`。
+ *
+ * 文件布局：
+ * - `file_structure.bin` 的格式见上方 meta_header / disk_inode 的说明。
+ * - `fs.img` 的格式见 superblock 的说明；数据块在写入时已经直接写入镜像。
+ *
+ * 返回值：
+ * - 成功返回 0；任何一次写入或同步失败返回 -EIO，此时脏标记、dirty_inodes 和 freed_inodes
+ *   都保持原样，下一次调用重新写入。
+ *
+ * 流程：
+ * 1. 首次保存时截断并重建 `file_structure.bin`，写入 meta_header。
+ * 2. 清零已删除节点的记录。
+ * 3. 按 dirty_inodes 用 pwrite 重写 dirty = 1 的节点记录，然后 fsync。
+ * 4. 记录落盘之后才用 write_superblock 写回超级块和位图并同步镜像：崩溃时新的位图和
+ *    checkpoint_lsn 不会和旧的或写了一半的节点记录一起出现。
+ * 5. 清空 dirty_inodes 和 freed_inodes。
+ *
+ * 注意：
+ * - 没有节点数量和子节点数量的限制；只访问被修改过的节点，代价与修改量成正比，与文件总数无关。
+ * - 修改类回调不直接调用本方法，而是由 journal_checkpoint 在检查点时调用。
+ */
+int save_contents()
+{
+	int ok = 1, saved = 0;
+
+	log_info("SAVING\n");
+
+	int fd = open("file_structure.bin", O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		perror("save_contents");
+		return -EIO;
+	}
+
+	if (!image_written)
+	{
+		// 首次保存：重建文件，未写入的记录和数据块保持为全 0
+		meta_header header = {META_MAGIC, META_VERSION, sizeof(disk_inode), root->number};
+		ok = ftruncate(fd, 0) == 0 && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+		bitmap_dirty = 1;
+	}
+
+	disk_inode rec;
+	memset(&rec, 0, sizeof(rec));
+	for (int i = 0; ok && i < freed_count; i++)
+	{
+		off_t pos = sizeof(meta_header) + (off_t)freed_inodes[i] * sizeof(disk_inode);
+		ok = pwrite(fd, &rec, sizeof(rec), pos) == sizeof(rec);
+	}
+
+	for (int i = 0; ok && i < dirty_inode_count; i++)
+	{
+		int number = dirty_inodes[i];
+		filetype *node = (size_t)number < inode_table_size ? inode_table[number] : NULL;
+
+		// 已删除的节点只清零记录；编号被重新使用时由新节点的标记决定
+		if (node == NULL || !node->valid || !node->dirty)
+			continue;
+		node_to_disk(node, &rec);
+		ok = pwrite(fd, &rec, sizeof(rec), sizeof(meta_header) + (off_t)node->number * sizeof(disk_inode)) == sizeof(rec);
+		node->dirty = 0;
+		saved++;
+	}
+
+	ok = ok && fsync(fd) == 0;
+	close(fd);
+
+	if (ok && bitmap_dirty)
+		ok = write_superblock() == 0 && (image_fd < 0 || fdatasync(image_fd) == 0);
+
+	if (!ok)
+	{
+		// 已经写过的节点重新标记，整批留到下一次
+		for (int i = 0; i < dirty_inode_count; i++)
+		{
+			int number = dirty_inodes[i];
+			filetype *node = (size_t)number < inode_table_size ? inode_table[number] : NULL;
+			if (node != NULL && node->valid)
+				node->dirty = 1;
+		}
+		perror("save_contents");
+		return -EIO;
+	}
+
+	image_written = 1;
+	bitmap_dirty = 0;
+	freed_count = 0;
+	dirty_inode_count = 0;
+
+	log_debug("%d\n", saved);
+	return 0;
+}
+
+/*
+ * load_contents - 从 `file_structure.bin` 加载文件树
+ *
+ * 功能：
+ * 1. 校验 meta_header 的魔数、版本号和记录大小。
+ * 2. 顺序读取 inode 表，为每条有效记录创建节点并放入 inode_table。
+ * 3. 按 inode 编号顺序扫描一遍，把每个节点加入其父目录。
+ * 4. 从根目录开始广度优先遍历，从根目录不可达的节点从 inode_table 中移除并释放，
+ *    它们的 inode 编号和数据块被归还，记录在下一次检查点时清零。
+ *
+ * 参数：
+ * - fd: 已打开的 `file_structure.bin` 文件。
+ *
+ * 返回值：
+ * - 成功时返回 0。
+ * - 格式不符或缺少根目录时返回 -1。
+ *
+ * 注意：
+ * - 每一步都是线性的，加载时间与节点数成正比。
+ * - 父目录不存在（或者不是目录）的记录从根目录不可达，按删除处理并输出一条警告；
+ *   加载之后请求一次检查点，把归还的编号和数据块落盘。
+ */
+int load_contents(FILE *fd)
+{
+	meta_header header;
+	if (fread(&header, sizeof(header), 1, fd) != 1 || header.magic != META_MAGIC ||
+		header.version != META_VERSION || header.record_size != sizeof(disk_inode))
+	{
+		log_error("UNSUPPORTED FILE STRUCTURE FORMAT\n");
+		return -1;
+	}
+
+	// 第一遍：建立节点，同时记下 (子节点, 父目录编号)
+	size_t link_count = 0, link_capacity = 256;
+	struct
+	{
+		filetype *node;
+		uint32_t parent;
+	} *links = malloc(link_capacity * sizeof(*links));
+
+	disk_inode batch[256];
+	size_t n;
+	while ((n = fread(batch, sizeof(disk_inode), 256, fd)) > 0)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			if (!batch[i].valid)
+				continue;
+			filetype *node = disk_to_node(&batch[i]);
+			if (node == NULL)
+				continue;
+			node->dirty = 1; // 暂时表示“尚未从根目录到达”
+			inode_table_set(node->number, node);
+			if (link_count == link_capacity)
+			{
+				link_capacity *= 2;
+				links = realloc(links, link_capacity * sizeof(*links));
+			}
+			links[link_count].node = node;
+			links[link_count].parent = batch[i].parent;
+			link_count++;
+		}
+	}
+
+	if (header.root >= inode_table_size || inode_table[header.root] == NULL || !S_ISDIR(inode_table[header.root]->permissions))
+	{
+		log_error("ROOT DIRECTORY MISSING\n");
+		free(links);
+		return -1;
+	}
+	root = inode_table[header.root];
+
+	// 第二遍：把每个节点加入父目录
+	for (size_t i = 0; i < link_count; i++)
+	{
+		filetype *node = links[i].node;
+		uint32_t parent = links[i].parent;
+		if (node == root || parent >= inode_table_size || inode_table[parent] == NULL || !S_ISDIR(inode_table[parent]->permissions))
+			continue;
+		node->parent = inode_table[parent];
+		add_child(node->parent, node);
+	}
+	free(links);
+
+	// 第三遍：从根目录广度优先遍历，标记可达的节点
+	size_t head = 0, tail = 0;
+	filetype **queue = malloc(inode_table_size * sizeof(filetype *));
+	queue[tail++] = root;
+	while (head < tail)
+	{
+		filetype *node = queue[head++];
+		node->dirty = 0;
+		for (int i = 0; S_ISDIR(node->permissions) && i < node->num_children; i++)
+		{
+			// 加载期间只有 add_child，列表中没有空位
+			queue[tail++] = node->children[i];
+		}
+	}
+	free(queue);
+
+	// 从根目录不可达的节点像被删除一样处理：归还编号和数据块，记录在下一次写回时清零。
+	// 不可达的节点只会出现在不可达的目录中，整体释放不会留下悬空的指针
+	size_t unreachable = 0;
+	for (size_t i = 0; i < inode_table_size; i++)
+	{
+		filetype *node = inode_table[i];
+		if (node == NULL || !node->dirty)
+			continue;
+		inode_table[i] = NULL;
+		if (bitmap_test(inode_bitmap, node->number))
+			free_inode_number(node->number);
+		if (!S_ISDIR(node->permissions))
+			extent_free_all(node);
+		freed_inode_add(node->number);
+		node_free(node);
+		unreachable++;
+	}
+	if (unreachable > 0)
+	{
+		log_warn("%zu UNREACHABLE INODES FREED\n", unreachable);
+		checkpoint_wanted = 1;
+	}
+	image_written = 1;
+
+	return 0;
+}
+
+/*
+ * 元数据/数据日志（journal）
+ *
+ * 功能：
+ * 1. 修改类回调（mkdir、create、write、truncate、rename、unlink、rmdir）不再整体重写
+ *    file_structure.bin 和 fs.img，而是向 journal.bin 顺序追加一条逻辑记录。
+ * 2. 追加的记录数或字节数超过阈值时做一次检查点：调用 save_contents 落盘完整状态，
+ *    然后清空日志。
+ * 3. 挂载时先加载最近一次检查点，再按顺序重放日志中剩余的记录。
+ *
+ * 记录格式：
+ * - 每条记录由 journal_record 头部和紧随其后的负载组成。
+ * - 负载依次为 path、path2（仅 rename 使用）和 data（仅 write 使用），
+ *   path 和 path2 的长度包含结尾的 '\0'。
+ * - lsn 单调递增。超级块中的 checkpoint_lsn 表示检查点已经包含的最大 lsn，
+ *   重放时跳过不大于它的记录（检查点写完、日志尚未清空时崩溃的情况）。
+ * - checksum 覆盖头部和负载，重放遇到校验失败的记录即认为日志尾部写坏，
+ *   在此处截断并停止重放。
+ *
+ * 示例：
+ * 执行 mkdir /home、touch /home/a.txt 之后，journal.bin 的内容如下：
+ * [lsn=1 MKDIR "/home"][lsn=2 CREATE "/home/a.txt"]
+ *
+ * 持久化（fsync）：
+ * - 日志记录中已经包含写入的数据，fsync 只需要保证日志落盘，不必写回缓存中的脏块。
+ * - 多个并发的 fsync 共享一次 fdatasync（组提交），见 journal_sync。
+ *
+ * 注意：
+ * - 日志记录的是逻辑操作而不是磁盘块，重放时直接调用对应的回调函数。
+ * - 重放期间 journal_replaying 为 1，回调函数不会再次追加日志，
+ *   fs_now 返回记录中保存的时间，保证时间戳与原操作一致。
+ */
+#define JOURNAL_FILE "journal.bin"
+#define JOURNAL_MAGIC 0x4a524e4cu
+#define JOURNAL_CHECKPOINT_RECORDS 1024
+#define JOURNAL_CHECKPOINT_BYTES (4 * 1024 * 1024)
+
+enum journal_op
+{
+	JOURNAL_MKDIR = 1,
+	JOURNAL_CREATE,
+	JOURNAL_WRITE,
+	JOURNAL_RENAME,
+	JOURNAL_UNLINK,
+	JOURNAL_RMDIR,
+	JOURNAL_TRUNCATE,
+};
+
+typedef struct journal_record
+{
+	uint32_t magic;		// JOURNAL_MAGIC
+	uint32_t op;		// enum journal_op
+	uint64_t lsn;		// 日志序列号
+	int64_t time;		// 操作发生的时间
+	uint64_t offset;	// write 的偏移量，truncate 的目标大小
+	uint32_t path_len;	// path 长度（含 '\0'）
+	uint32_t path2_len; // path2 长度（含 '\0'）
+	uint32_t data_len;	// data 长度
+	uint32_t checksum;	// 头部和负载的校验和
+} journal_record;
+
+int journal_fd = -1;
+unsigned long journal_next_lsn = 1;
+unsigned long journal_records = 0; // 自上次检查点以来的记录数
+off_t journal_bytes = 0;		   // 自上次检查点以来的日志字节数
+int journal_replaying = 0;
+time_t journal_replay_time = 0;
+unsigned long journal_synced_lsn = 0; // 已经确认落盘的最大 lsn
+int journal_syncing = 0;			  // 是否有线程正在执行 fdatasync
+unsigned long journal_syncs = 0;	  // fdatasync 的次数
+int journal_error = 0;				  // 追加失败后置为 -EIO，直到下一次检查点成功，见 journal_check
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;	  // 保护 lsn 分配、追加和以上状态
+pthread_cond_t journal_sync_cond = PTHREAD_COND_INITIALIZER; // 一次 fdatasync 完成时广播
+
+/*
+ * fs_now - 获取当前时间
+ *
+ * 返回值：
+ * - 正常运行时返回 time(NULL)；重放日志时返回记录中保存的时间。
+ */
+time_t fs_now()
+{
+	if (journal_replaying)
+		return journal_replay_time;
+	return time(NULL);
+}
+
+/*
+ * journal_checksum - 计算日志记录的校验和（FNV-1a）
+ *
+ * 参数：
+ * - hdr: 记录头部，计算时 checksum 字段按 0 处理。
+ * - payload: 负载数据。
+ * - len: 负载长度。
+ */
+uint32_t journal_checksum(const journal_record *hdr, const char *payload, size_t len)
+{
+	journal_record tmp = *hdr;
+	uint32_t hash = 2166136261u;
+
+	tmp.checksum = 0;
+	for (size_t i = 0; i < sizeof(tmp); i++)
+		hash = (hash ^ ((const unsigned char *)&tmp)[i]) * 16777619u;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)payload[i]) * 16777619u;
+
+	return hash;
+}
+
+/*
+ * journal_checkpoint - 做一次检查点
+ *
+ * 功能：
+ * 1. 写回缓存中的全部脏块，等待镜像落盘。
+ * 2. 将 checkpoint_lsn 更新为最后一条已追加记录的 lsn。
+ * 3. 归还延迟释放的数据块（pending_release），调用 save_contents 将完整状态写入
+ *    file_structure.bin 和 fs.img，并等待镜像落盘。
+ * 4. 清空日志文件。
+ * 5. 名称池增长过多时整理名称池（name_pool_compact）。
+ *
+ * 返回值：
+ * - 成功返回 0；任何一步失败返回 -EIO，此时日志、checkpoint_lsn 和延迟释放的块都保持原样，
+ *   日志中的记录仍然可以重放，下一次检查点重新写入全部状态。
+ *
+ * 注意：
+ * - 先写检查点再清空日志，两步之间崩溃时依靠 checkpoint_lsn 跳过已包含的记录。
+ * - 检查点包含的记录都已经落盘，journal_synced_lsn 随之前进。
+ * - 成功之后内存中的状态全部落盘，清除 journal_error。
+ * - 调用方独占 fs_lock（见 fs_leave），遍历文件树时不需要再锁节点。
+ */
+int journal_checkpoint()
+{
+	uint64_t checkpoint_start = stats_now();
+	uint64_t old_lsn = spblock.checkpoint_lsn;
+	int res = 0;
+
+	__atomic_store_n(&checkpoint_wanted, 0, __ATOMIC_RELAXED);
+	// 日志中的数据被清空之前，缓存中的脏块必须先写入镜像并落盘，元数据才能指向它们
+	if (cache_flush() != 0 || (image_fd >= 0 && fdatasync(image_fd) != 0))
+		res = -EIO;
+	if (res == 0)
+	{
+		spblock.checkpoint_lsn = journal_next_lsn - 1;
+		bitmap_dirty = 1;
+		pending_release();
+		uint64_t start = stats_now();
+		res = save_contents();
+		stats_record(OP_SAVE, start);
+		if (res != 0)
+		{
+			pending_restore();
+			spblock.checkpoint_lsn = old_lsn;
+		}
+	}
+	if (res != 0)
+	{
+		log_error("CHECKPOINT FAILED, JOURNAL KEPT\n");
+		stats_record(OP_CHECKPOINT, checkpoint_start);
+		return res;
+	}
+	pending_count = 0;
+
+	if (journal_fd >= 0 && ftruncate(journal_fd, 0) != 0)
+		perror("journal truncate");
+
+	pthread_mutex_lock(&journal_lock);
+	if (spblock.checkpoint_lsn > journal_synced_lsn)
+		journal_synced_lsn = spblock.checkpoint_lsn;
+	journal_records = 0;
+	journal_bytes = 0;
+	__atomic_store_n(&journal_error, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&journal_lock);
+	name_pool_compact();
+	stats_record(OP_CHECKPOINT, checkpoint_start);
+	return 0;
+}
+
+/*
+ * journal_append - 向日志追加一条记录
+ *
+ * 功能：
+ * 1. 将操作类型、路径和数据在 scratch 中打包成一条记录，一次 write 追加到 journal.bin 末尾。
+ * 2. 记录数或字节数超过阈值时置 checkpoint_wanted，当前回调结束时由 fs_leave 做检查点。
+ *
+ * 参数：
+ * - op: 操作类型（enum journal_op）。
+ * - path: 操作的路径。
+ * - path2: 第二个路径（rename 的目标路径），其他操作传 NULL。
+ * - offset: write 的偏移量，其他操作传 0。
+ * - data: write 写入的数据，其他操作传 NULL。
+ * - data_len: data 的长度。
+ *
+ * 返回值：
+ * - 成功时返回 0，重放期间直接返回 0。
+ * - 追加失败时返回 -EIO，置 journal_error 并请求一次检查点整体落盘；journal_error 已经置位时
+ *   不再追加，直接返回它。
+ *
+ * 注意：
+ * - 调用方在内存中完成修改之后才追加，失败时修改已经生效，只能把错误返回给 FUSE；
+ *   之后的修改由 journal_check 拒绝，直到检查点把内存中的状态整体落盘。
+ */
+int journal_append(int op, const char *path, const char *path2, off_t offset, const char *data, size_t data_len)
+{
+	if (journal_replaying)
+		return 0;
+
+	journal_record hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = JOURNAL_MAGIC;
+	hdr.op = op;
+	hdr.time = time(NULL);
+	hdr.offset = offset;
+	hdr.path_len = strlen(path) + 1;
+	hdr.path2_len = path2 ? strlen(path2) + 1 : 0;
+	hdr.data_len = data_len;
+
+	size_t payload_len = hdr.path_len + hdr.path2_len + hdr.data_len;
+	size_t mark = scratch_mark();
+	char *record = scratch_alloc(sizeof(hdr) + payload_len);
+	char *payload = record + sizeof(hdr);
+
+	memcpy(payload, path, hdr.path_len);
+	if (path2)
+		memcpy(payload + hdr.path_len, path2, hdr.path2_len);
+	if (data_len)
+		memcpy(payload + hdr.path_len + hdr.path2_len, data, data_len);
+
+	// lsn 的分配和追加在同一把锁下完成，lsn 小于 journal_next_lsn 的记录都已经写入日志；
+	// 写入失败时截掉写了一半的记录、不消耗 lsn，否则之后的记录接在残片后面，重放时读不到
+	pthread_mutex_lock(&journal_lock);
+	if (journal_error != 0)
+	{
+		int err = journal_error;
+		pthread_mutex_unlock(&journal_lock);
+		scratch_reset(mark);
+		return err;
+	}
+	hdr.lsn = journal_next_lsn;
+	hdr.checksum = journal_checksum(&hdr, payload, payload_len);
+	memcpy(record, &hdr, sizeof(hdr));
+
+	ssize_t written = write(journal_fd, record, sizeof(hdr) + payload_len);
+	int ok = written == (ssize_t)(sizeof(hdr) + payload_len);
+	if (ok)
+	{
+		journal_next_lsn++;
+		journal_records++;
+		journal_bytes += written;
+	}
+	else
+	{
+		__atomic_store_n(&journal_error, -EIO, __ATOMIC_RELAXED);
+		if (ftruncate(journal_fd, journal_bytes) != 0)
+			perror("journal truncate");
+	}
+	int full = journal_records >= JOURNAL_CHECKPOINT_RECORDS || journal_bytes >= JOURNAL_CHECKPOINT_BYTES;
+	pthread_mutex_unlock(&journal_lock);
+	scratch_reset(mark);
+
+	// 调用方持有节点锁，不能在这里做检查点
+	if (!ok || full)
+		__atomic_store_n(&checkpoint_wanted, 1, __ATOMIC_RELAXED);
+	if (!ok)
+	{
+		perror("journal append");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * journal_check - 修改操作开始之前检查日志是否可用
+ *
+ * 返回值：
+ * - 日志可用返回 0；之前的追加失败、检查点还没有成功时返回 journal_error（-EIO）。
+ *
+ * 注意：
+ * - 追加失败的修改已经生效但没有记录，之后的记录重放时会接在缺失的操作后面，
+ *   所以在检查点把状态整体落盘之前拒绝新的修改。
+ * - 返回错误时再请求一次检查点（上一次可能也失败了），由调用方的 fs_leave 重试，
+ *   调用方因此要在 fs_enter 之后调用。
+ */
+int journal_check()
+{
+	int err = journal_replaying ? 0 : __atomic_load_n(&journal_error, __ATOMIC_RELAXED);
+
+	if (err != 0)
+		__atomic_store_n(&checkpoint_wanted, 1, __ATOMIC_RELAXED);
+	return err;
+}
+
+/*
+ * journal_sync - 保证目前为止追加的日志记录全部落盘（组提交）
+ *
+ * 功能：
+ * 1. 记下调用时最后一条记录的 lsn，已经落盘则直接返回。
+ * 2. 没有线程在执行 fdatasync 时，当前线程成为 leader：记下此刻最后一条记录的 lsn，
+ *    释放锁执行一次 fdatasync，完成后推进 journal_synced_lsn 并唤醒所有等待者。
+ * 3. 已有 leader 时等待它完成。如果它覆盖了自己的记录就直接返回；否则由等待者中的一个
+ *    成为下一轮的 leader，一次 fdatasync 提交等待期间到达的所有记录。
+ *
+ * 返回值：
+ * - 成功返回 0，fdatasync 失败返回 -EIO。
+ * - 之前有记录追加失败、检查点还没有成功时返回 journal_error（-EIO）：那条修改没有进入日志，
+ *   日志落盘也不能让它持久。
+ *
+ * 示例：
+ * 10 个线程同时 fsync 时，第一个线程执行 fdatasync，其余 9 个线程的记录在它返回后
+ * 由第二次 fdatasync 一起提交，总共只需要 2 次设备刷新。
+ */
+int journal_sync()
+{
+	int res = 0;
+
+	pthread_mutex_lock(&journal_lock);
+	unsigned long lsn = journal_next_lsn - 1;
+	while (journal_error == 0 && journal_synced_lsn < lsn)
+	{
+		if (journal_syncing)
+		{
+			pthread_cond_wait(&journal_sync_cond, &journal_lock);
+			continue;
+		}
+
+		unsigned long target = journal_next_lsn - 1;
+		journal_syncing = 1;
+		pthread_mutex_unlock(&journal_lock);
+		int err = fdatasync(journal_fd);
+		pthread_mutex_lock(&journal_lock);
+		journal_syncing = 0;
+		journal_syncs++;
+		pthread_cond_broadcast(&journal_sync_cond);
+		if (err != 0)
+		{
+			perror("journal sync");
+			res = -EIO;
+			break;
+		}
+		if (target > journal_synced_lsn)
+			journal_synced_lsn = target;
+	}
+	if (res == 0)
+		res = journal_error;
+	pthread_mutex_unlock(&journal_lock);
+	return res;
+}
+
+/*
+ * journal_open - 打开（或创建）日志文件
+ *
+ * 注意：
+ * - 以 O_APPEND 方式打开，每次追加都是一次顺序写。
+ */
+void journal_open()
+{
+	journal_fd = open(JOURNAL_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (journal_fd < 0)
+	{
+		perror("journal open");
+		exit(1);
+	}
+}
+
+/*
+ * initialize_root_directory - 初始化根目录
+ *
+ * 功能：
+ * 1. 创建并初始化文件系统的根目录。
+ * 2. 设置根目录的元数据，包括路径、名称、类型、权限、时间戳等。
+ * 3. 标记根目录的 inode 为已使用。
+ * 4. 调用 save_contents 方法将初始化后的文件系统保存到磁盘。
+ *
+ * 实现逻辑：
+ * 1. 在 inode 位图中标记根目录的 inode 为已使用（bitmap_set(inode_bitmap, 2)）。
+ * 2. 分配内存并初始化根目录结构（filetype）。
+ * 3. 设置根目录的名称为 "/"。
+ * 4. 设置根目录的模式为 S_IFDIR | 0777。
+ * 5. 初始化时间戳（创建时间、访问时间、修改时间等）。
+ * 6. 设置根目录的 inode 编号为 2。
+ * 7. 调用 save_contents 方法保存文件系统。
+ *
+ * 初始化后的根目录结构示例：
+ * Filetype (Root):
+ * - valid: 1
+ * - name: "/"
+ * - permissions: S_IFDIR | 0777
+ * - user_id: 当前用户ID
+ * - group_id: 当前组ID
+ * - a_time: 当前时间
+ * - m_time: 当前时间
+ * - c_time: 当前时间
+ * - b_time: 当前时间
+ * - size: 0
+ * - number: 2 (inode 编号)
+ * - blocks: 0
+ * - children: NULL
+ * - num_children: 0
+ * - parent: NULL
+ * - num_links: 2
+ *
+ * 注意：
+ * - 根目录的 inode 编号固定为 2。
+ * - 根目录是文件系统的起点，所有其他文件和目录都是其子节点。
+ */
+void initialize_root_directory()
+{
+
+	bitmap_set(inode_bitmap, 2); // 根目录固定使用 2 号 inode
+	spblock.free_inodes--;
+	bitmap_dirty = 1;
+	root = node_alloc();
+
+	name_intern("/", 1, &root->name);
+
+	root->children = NULL;
+	root->num_children = 0;
+	root->parent = NULL;
+	root->num_links = 2;
+	root->valid = 1;
+
+	root->c_time = fs_now();
+	root->a_time = fs_now();
+	root->m_time = fs_now();
+	root->b_time = fs_now();
+
+	root->permissions = S_IFDIR | 0777;
+
+	root->size = 0;
+	root->group_id = getgid();
+	root->user_id = getuid();
+
+	root->number = 2;
+	// root -> size = 0;
+	root->blocks = 0;
+	inode_table_set(root->number, root);
+	node_mark_dirty(root);
+
+	save_contents();
+}
+
+/*
+ * walk_path - 根据路径逐级查找对应的文件节点
+ *
+ * 功能：
+ * 1. 根据给定的路径，在文件树中查找对应的文件或目录节点。
+ * 2. 支持绝对路径（以 "/" 开头）的解析。
+ * 3. 如果路径不存在，返回 NULL。
+ *
+ * 参数：
+ * - path: 要查找的路径字符串（必须以 "/" 开头）。
+ *
+ * 返回值：
+ * - 成功时返回对应的文件节点指针（filetype *）。
+ * - 如果路径不存在或路径格式错误，返回 NULL。
+ *
+ * 实现逻辑：
+ * 1. 检查路径是否以 "/" 开头，如果不是则报错并退出。
+ * 2. 从根节点开始，逐级解析路径中的目录名（不复制字符串）。
+ * 3. 通过当前目录的哈希索引（dir_lookup）查找匹配的目录或文件，平均 O(1)。
+ * 4. 如果找到匹配的节点，返回该节点；否则返回 NULL。
+ *
+ * 示例：
+ * 假设文件树结构如下：
+ * /
+ * ├── home
+ * │   └── user
+ * └── test.txt
+ *
+ * 调用示例：
+ * 1. walk_path("/") -> 返回根节点
+ * 2. walk_path("/home") -> 返回 home 目录节点
+ * 3. walk_path("/home/user") -> 返回 user 目录节点
+ * 4. walk_path("/test.txt") -> 返回 test.txt 文件节点
+ * 5. walk_path("/invalid") -> 返回 NULL
+ *
+ * 注意：
+ * - 路径必须以 "/" 开头。
+ * - 路径末尾的 "/" 和连续的 "/" 会被忽略。
+ * - 如果路径不存在，返回 NULL。
+ * - 回调函数应调用 filetype_from_path，它会先查询路径缓存。
+ * - 不获取任何目录锁，见 dir_lookup。
+ */
+filetype *walk_path(const char *path)
+{
+	filetype *curr_node = root;
+
+	if (path[0] != '/')
+	{
+		log_error("INCORRECT PATH\n");
+		exit(1);
+	}
+
+	const char *name = path + 1;
+	while (*name != '\0')
+	{
+		const char *index = strchr(name, '/');
+		size_t len = index ? (size_t)(index - name) : strlen(name);
+
+		if (len > 0)
+		{
+			curr_node = dir_lookup(curr_node, name, len);
+			if (curr_node == NULL)
+				return NULL;
+		}
+
+		if (index == NULL)
+			break;
+		name = index + 1;
+	}
+
+	return curr_node;
+}
+
+/*
+ * 路径缓存（dentry cache）
+ *
+ * 功能：
+ * 1. 以完整路径为键缓存路径到节点的映射，命中时只需计算一次哈希、比较一次字符串。
+ * 2. 表是直接映射的：路径哈希决定唯一的槽位，冲突时新条目覆盖旧条目。
+ *    条目写入后不再修改，替换时用原子交换换下旧条目，查找不加锁。
+ * 3. 每个条目记录写入时的全局代数 dcache_generation；rename、rmdir、unlink
+ *    会使代数加 1，之前的所有条目随即失效，不需要逐个清除。
+ *
+ * 示例：
+ * 1. mygetattr("/home/user/a.txt") 第一次调用时逐级查找并写入缓存。
+ * 2. 随后对同一路径的 getattr/open/read 直接命中缓存。
+ * 3. myrename("/home/user", "/home/u2") 之后代数变化，旧条目全部失效。
+ *
+ * 注意：
+ * - 只缓存存在的路径，mkdir、create 不会使已有条目失效。
+ * - 超过 DCACHE_PATH_MAX 的路径不进入缓存。
+ * - 换下的旧条目交给 rcu_retire_with，可能仍在比较它的读者离开后才归还（dcache_free）。
+ */
+#define DCACHE_SIZE 4096
+#define DCACHE_PATH_MAX 128
+#define DCACHE_SLAB_COUNT 64
+
+typedef struct dcache_entry
+{
+	unsigned long generation;	// 写入时的代数
+	unsigned int hash;			// 路径的哈希值
+	filetype *node;				// 路径对应的节点
+	struct dcache_entry *next;	// 空闲时：空闲链表中的下一个条目
+	char path[DCACHE_PATH_MAX]; // 完整路径
+} dcache_entry;
+
+dcache_entry *dcache[DCACHE_SIZE];
+unsigned long dcache_generation = 1;
+
+/*
+ * dcache_alloc / dcache_free - 分配和归还路径缓存条目
+ *
+ * 实现逻辑：
+ * 1. 条目大小固定，按 DCACHE_SLAB_COUNT 个一组整块分配，空闲的条目挂在当前线程
+ *    reader_record 的 dcache_free 链表上，分配和归还都不加锁、不调用 malloc / free。
+ * 2. dcache_free 只由 rcu_reclaim 调用，回收的总是本线程 limbo 中的条目，归还到本线程的链表；
+ *    条目可以在一个线程分配、在另一个线程归还，各线程的链表之和不超过条目数的峰值。
+ *
+ * 注意：
+ * - 与节点 slab 一样，整块内存不归还给系统；线程退出后链表随记录留给下一个线程。
+ */
+dcache_entry *dcache_alloc()
+{
+	reader_record *self = reader_self_record();
+
+	if (self->dcache_free == NULL)
+	{
+		dcache_entry *slab = malloc(DCACHE_SLAB_COUNT * sizeof(dcache_entry));
+		if (slab == NULL)
+			abort();
+		for (int i = DCACHE_SLAB_COUNT - 1; i >= 0; i--)
+		{
+			slab[i].next = self->dcache_free;
+			self->dcache_free = &slab[i];
+		}
+	}
+	dcache_entry *entry = self->dcache_free;
+	self->dcache_free = entry->next;
+	return entry;
+}
+
+void dcache_free(void *ptr)
+{
+	reader_record *self = reader_self_record();
+	dcache_entry *entry = ptr;
+
+	entry->next = self->dcache_free;
+	self->dcache_free = entry;
+}
+
+/*
+ * dcache_invalidate - 使所有路径缓存条目失效
+ *
+ * 注意：
+ * - 在删除节点或改变节点路径（rename、rmdir、unlink）时调用。
+ */
+void dcache_invalidate()
+{
+	__atomic_add_fetch(&dcache_generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * filetype_from_path - 根据路径查找对应的文件节点
+ *
+ * 功能：
+ * 1. 先在路径缓存中查找，命中且代数有效时直接返回。
+ * 2. 未命中时调用 walk_path 逐级查找，并把找到的节点写入缓存。
+ *
+ * 参数：
+ * - path: 要查找的路径字符串（必须以 "/" 开头）。
+ *
+ * 返回值：
+ * - 成功时返回对应的文件节点指针（filetype *）。
+ * - 如果路径不存在，返回 NULL。
+ */
+filetype *filetype_from_path(const char *path)
+{
+	size_t len = strlen(path);
+	unsigned int hash = name_hash(path, len);
+	unsigned int slot = hash & (DCACHE_SIZE - 1);
+	// 先读代数再查找：查找期间发生的删除会让本次写入的条目立即失效
+	unsigned long generation = __atomic_load_n(&dcache_generation, __ATOMIC_ACQUIRE);
+	dcache_entry *entry = __atomic_load_n(&dcache[slot], __ATOMIC_ACQUIRE);
+
+	if (entry != NULL && entry->generation == generation && entry->hash == hash && strcmp(entry->path, path) == 0)
+		return entry->node;
+
+	filetype *node = walk_path(path);
+	if (node != NULL && len < DCACHE_PATH_MAX)
+	{
+		entry = dcache_alloc();
+		entry->generation = generation;
+		entry->hash = hash;
+		entry->node = node;
+		memcpy(entry->path, path, len + 1);
+		entry = __atomic_exchange_n(&dcache[slot], entry, __ATOMIC_ACQ_REL);
+		if (entry != NULL)
+			rcu_retire_with(entry, dcache_free);
+	}
+
+	return node;
+}
+/*
+ * 统计文件 /.fsstats
+ *
+ * 功能：
+ * 1. 根目录下的隐藏只读文件，不出现在 readdir 中，也不保存到磁盘。
+ * 2. 打开时生成当前统计的文本快照（stats_render），之后的读取都从快照中复制，
+ *    同一次打开读到的内容是一致的。
+ *
+ * 示例：
+ * cat /mnt/fs/.fsstats
+ * op                count     mean_us      p50_us      p90_us      p99_us    p99.9_us      max_us
+ * getattr            1024       0.812       0.767       1.023       3.071      12.287      15.911
+ * ...
+ *
+ * 注意：
+ * - 句柄设置 direct_io，内核不缓存内容，也不依赖 getattr 报告的大小（始终为 0）。
+ * - 不能创建、删除、重命名或写入同名文件。
+ * - 低层接口中它的 inode 编号是 STATS_INO，不在 inode_table 中。
+ */
+#define STATS_NAME ".fsstats"
+#define STATS_INO ((fuse_ino_t)0x7fffffff)
+
+int stats_path(const char *path)
+{
+	return path != NULL && strcmp(path, "/" STATS_NAME) == 0;
+}
+
+void stats_fill_stat(struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_ino = STATS_INO;
+	st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_atime = st->st_mtime = st->st_ctime = time(NULL);
+}
+
+/*
+ * stats_render - 把统计结果格式化为文本
+ *
+ * 返回值：
+ * - malloc 分配的文本，长度保存在 *len 中；失败返回 NULL。
+ */
+char *stats_render(size_t *len)
+{
+	op_stats *sum = malloc(sizeof(op_stats));
+	char *text = NULL;
+	FILE *out;
+
+	if (sum == NULL)
+		return NULL;
+	if ((out = open_memstream(&text, len)) == NULL)
+	{
+		free(sum);
+		return NULL;
+	}
+	stats_collect(sum);
+
+	fprintf(out, "%-14s %8s %11s %11s %11s %11s %11s %11s\n", "op", "count", "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us");
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		uint64_t count = sum->count[op];
+		if (count == 0)
+			continue;
+		fprintf(out, "%-14s %8llu %11.3f %11.3f %11.3f %11.3f %11.3f %11.3f\n", op_names[op], (unsigned long long)count,
+				sum->total_ns[op] / 1000.0 / count,
+				hist_percentile(sum->hist[op], count, sum->max_ns[op], 0.5) / 1000.0,
+				hist_percentile(sum->hist[op], count, sum->max_ns[op], 0.9) / 1000.0,
+				hist_percentile(sum->hist[op], count, sum->max_ns[op], 0.99) / 1000.0,
+				hist_percentile(sum->hist[op], count, sum->max_ns[op], 0.999) / 1000.0,
+				sum->max_ns[op] / 1000.0);
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	fprintf(out, "\ncache hits %lu misses %lu flushes %lu prefetch_dropped %lu\n", cache.hits, cache.misses, cache.flushes,
+			cache.prefetch_dropped);
+	pthread_mutex_unlock(&cache.lock);
+	pthread_mutex_lock(&journal_lock);
+	fprintf(out, "journal records %lu bytes %lld syncs %lu\n", journal_records, (long long)journal_bytes, journal_syncs);
+	pthread_mutex_unlock(&journal_lock);
+	pthread_mutex_lock(&node_slab.lock);
+	fprintf(out, "nodes in_use %zu slabs %zu\n", node_slab.in_use, node_slab.slabs);
+	pthread_mutex_unlock(&node_slab.lock);
+	fprintf(out, "names interned %zu bytes %llu\n", name_pool_interned(), (unsigned long long)__atomic_load_n(&name_pool.top, __ATOMIC_RELAXED));
+
+	// 每种操作的非空桶：桶的上界（微秒）和样本数
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		if (sum->count[op] == 0)
+			continue;
+		fprintf(out, "\nhistogram %s\n", op_names[op]);
+		for (int b = 0; b < HIST_BUCKETS; b++)
+		{
+			if (sum->hist[op][b] != 0)
+				fprintf(out, "%14.3f %llu\n", hist_bucket_high(b) / 1000.0, (unsigned long long)sum->hist[op][b]);
+		}
+	}
+
+	fclose(out);
+	free(sum);
+	return text;
+}
+
+/*
+ * stats_open - 打开统计文件，生成快照保存在句柄中
+ */
+int stats_open(struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+
+	open_file *of = calloc(1, sizeof(open_file));
+	if (of == NULL || (of->snapshot = stats_render(&of->snapshot_len)) == NULL)
+	{
+		free(of);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&of->lock, NULL);
+	fi->fh = (uint64_t)(uintptr_t)of;
+	fi->direct_io = 1;
+	return 0;
+}
+
+int stats_read(open_file *of, char *buf, size_t size, off_t offset)
+{
+	if (offset < 0)
+		return -EINVAL;
+	if ((size_t)offset >= of->snapshot_len)
+		return 0;
+	if (size > of->snapshot_len - offset)
+		size = of->snapshot_len - offset;
+	memcpy(buf, of->snapshot + offset, size);
+	return size;
+}
+
+/*
+ * 负载记录（-o trace=FILE）
+ *
+ * 功能：
+ * 1. 把每次回调（操作、路径、偏移、大小、开始时间和耗时）以二进制格式追加到记录文件，
+ *    replay.c 可以把记录重新交给文件系统执行，离线对比路径解析、分配器或持久化的改动。
+ * 2. 文件以 trace_header 开头，之后每条记录是一个 trace_entry，紧跟 path_len 字节的路径
+ *    和 path2_len 字节的第二个路径（只有 rename 有），路径不带 '\0'。
+ *
+ * 实现逻辑：
+ * 1. 记录在回调返回后由 STATS_OP / STATS_LL_OP 的包装函数写入，文件中的顺序是完成顺序：
+ *    依赖另一个操作结果的操作（例如 open 之后的 read）一定排在它后面，回放时按文件顺序执行。
+ * 2. 每条记录先在栈上拼好，一次 fwrite 写入；stdio 的流锁保证多个线程的记录不会交错。
+ * 3. 低层接口的请求只带 inode 编号，包装函数在调用前把编号解析成路径（trace_ll_paths），
+ *    两种接口的记录格式相同；低层接口的结果通过 fuse_reply_* 发给内核，记为 TRACE_NO_RESULT。
+ *
+ * 注意：
+ * - 不记录写入的数据内容，回放时用固定的字节填充。
+ * - 所有线程共用一个流锁，记录会增加并发回调的开销，只在需要采集负载时打开。
+ */
+#define TRACE_MAGIC "FSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_PATH_MAX 256
+#define TRACE_NO_RESULT INT32_MIN
+
+typedef struct trace_header
+{
+	char magic[8];		 // TRACE_MAGIC
+	uint32_t version;	 // TRACE_VERSION
+	uint32_t entry_size; // sizeof(trace_entry)
+} trace_header;
+
+typedef struct __attribute__((packed)) trace_entry
+{
+	uint64_t start_ns;	  // 相对于开始记录的时间
+	uint64_t duration_ns; // 回调耗时
+	uint64_t offset;	  // read / write / readdir 的偏移
+	uint64_t fh;		  // fuse_file_info->fh，回放时用来把 open / create 与之后的读写对应起来
+	uint32_t size;		  // read / write 的大小
+	uint32_t mode;		  // mkdir / create 的权限
+	uint32_t flags;		  // open / create 的打开标志，fsync 的 datasync
+	int32_t result;		  // 回调的返回值
+	uint8_t op;			  // OP_*
+	uint8_t reserved;
+	uint16_t path_len;
+	uint16_t path2_len;
+} trace_entry;
+
+FILE *trace_file;
+uint64_t trace_start;
+uint64_t trace_records;
+int trace_failed;
+
+/*
+ * trace_open - 创建记录文件并写入文件头
+ *
+ * 返回值：
+ * - 成功返回 0，无法创建文件时返回 -1。
+ *
+ * 注意：
+ * - 在 FUSE 转入后台之前调用，相对路径按启动时的工作目录解析。
+ */
+int trace_open(const char *path)
+{
+	trace_header hdr = {TRACE_MAGIC, TRACE_VERSION, sizeof(trace_entry)};
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	setvbuf(file, NULL, _IOFBF, 1 << 20);
+	// 文件头在转入后台（fork）之前写出，避免父子进程各自刷出一份缓冲区
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 || fflush(file) != 0)
+	{
+		perror(path);
+		fclose(file);
+		return -1;
+	}
+	trace_start = stats_now();
+	trace_file = file;
+	return 0;
+}
+
+/*
+ * trace_record - 追加一条记录
+ *
+ * 参数：
+ * - op / start: 操作编号和 stats_now() 记下的开始时间。
+ * - result: 回调的返回值，低层接口为 TRACE_NO_RESULT。
+ * - path / path2: 操作的路径，没有时为 NULL 或空串；超过 TRACE_PATH_MAX 的部分被截断。
+ * - fh: 回调的文件句柄，见 trace_fh。
+ */
+void trace_record(int op, uint64_t start, int result, uint64_t fh, const char *path, const char *path2,
+				  uint64_t offset, uint64_t size, uint32_t mode, uint32_t flags)
+{
+	char buf[sizeof(trace_entry) + 2 * TRACE_PATH_MAX];
+	trace_entry *e = (trace_entry *)buf;
+	size_t len = path != NULL ? strnlen(path, TRACE_PATH_MAX) : 0;
+	size_t len2 = path2 != NULL ? strnlen(path2, TRACE_PATH_MAX) : 0;
+
+	memset(e, 0, sizeof(*e));
+	e->start_ns = start - trace_start;
+	e->duration_ns = stats_now() - start;
+	e->offset = offset;
+	e->fh = fh;
+	e->size = size;
+	e->mode = mode;
+	e->flags = flags;
+	e->result = result;
+	e->op = op;
+	e->path_len = len;
+	e->path2_len = len2;
+	if (len > 0)
+		memcpy(buf + sizeof(*e), path, len);
+	if (len2 > 0)
+		memcpy(buf + sizeof(*e) + len, path2, len2);
+
+	if (fwrite(buf, 1, sizeof(*e) + len + len2, trace_file) != sizeof(*e) + len + len2)
+	{
+		if (!__atomic_exchange_n(&trace_failed, 1, __ATOMIC_RELAXED))
+			log_error("TRACE WRITE FAILED: %s\n", strerror(errno));
+		return;
+	}
+	__atomic_fetch_add(&trace_records, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * trace_fh - 记录使用的文件句柄：fi->fh 非零时取 fi->fh，否则取 before
+ *
+ * 注意：
+ * - open / create 在回调中设置 fh，release 在回调中把它清零，包装函数在调用前后各取一次，
+ *   调用后取到 0 时使用调用前的值。
+ */
+uint64_t trace_fh(struct fuse_file_info *fi, uint64_t before)
+{
+	return fi != NULL && fi->fh != 0 ? fi->fh : before;
+}
+
+/*
+ * trace_close - 写出缓冲区中剩余的记录并关闭记录文件
+ *
+ * 注意：
+ * - 在 mydestroy 中调用，此时会话循环已经结束，没有并发的回调。
+ */
+void trace_close()
+{
+	if (trace_file == NULL)
+		return;
+	if (fclose(trace_file) != 0)
+		log_error("TRACE CLOSE FAILED: %s\n", strerror(errno));
+	trace_file = NULL;
+	log_info("TRACE RECORDS %lu\n", trace_records);
+}
+
+/*
+ * mymkdir - 创建新目录
+ *
+ * 功能：
+ * 1. 在指定路径下创建一个新目录。
+ * 2. 分配并初始化新目录的元数据，包括路径、名称、类型、权限、时间戳等。
+ * 3. 将新目录添加到父目录的子节点列表中。
+ * 4. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
+ *
+ * 参数：
+ * - path: 新目录的完整路径（必须以 "/" 开头）。
+ * - mode: 目录的权限模式（未直接使用，固定为 0777）。
+ *
+ * 返回值：
+ * - 成功时返回 0。
+ * - 如果父目录不存在，返回 -ENOENT；父路径不是目录时返回 -ENOTDIR。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check。
+ *
+ * 实现逻辑：
+ * 1. 查找一个空闲的 inode 编号。
+ * 2. 解析路径，获取新目录的名称和父目录路径。
+ * 3. 分配内存并初始化新目录结构（filetype）。
+ * 4. 设置新目录的元数据，包括路径、名称、类型、权限、时间戳等。
+ * 5. 将新目录添加到父目录的子节点列表中。
+ * 6. 调用 journal_append 记录本次操作。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /
+ * └── home
+ *
+ * 调用示例：
+ * 1. mymkdir("/home/user", 0777) -> 在 /home 下创建 user 目录
+ *    - 新目录路径: "/home/user"
+ *    - 新目录名称: "user"
+ *    - 父目录: "/home"
+ * 2. mymkdir("/invalid/path", 0777) -> 返回 -ENOENT（父目录不存在）
+ *
+ * 注意：
+ * - 路径必须以 "/" 开头。
+ * - 新目录的权限固定为 0777。
+ * - 如果父目录不存在，操作失败。
+ */
+static int mymkdir(const char *path, mode_t mode)
+{
+	log_debug("MKDIR\n");
+
+	if (stats_path(path))
+		return -EEXIST;
+
+	fs_enter();
+	char *pathname;
+	const char *name = split_path(path, &pathname);
+	name_ref ref;
+	int res = journal_check();
+	if (res == 0)
+		res = name_intern(name, strlen(name), &ref);
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
+
+	int index = find_free_inode();
+	if (index < 0)
+	{
+		fs_leave();
+		return -ENOSPC;
+	}
+
+	filetype *new_folder = node_alloc();
+
+	new_folder->name = ref;
+	new_folder->children = NULL;
+	new_folder->num_children = 0;
+	new_folder->parent = filetype_from_path(pathname);
+	new_folder->num_links = 2;
+	new_folder->valid = 1;
+
+	if (new_folder->parent == NULL || !S_ISDIR(new_folder->parent->permissions))
+	{
+		res = new_folder->parent == NULL ? -ENOENT : -ENOTDIR;
+		node_free(new_folder);
+		free_inode_number(index);
+		fs_leave();
+		return res;
+	}
+
+	node_wrlock(new_folder->parent);
+	// 查找之后、加锁之前父目录可能已经被删除
+	if (!new_folder->parent->valid || dir_lookup(new_folder->parent, name, ref.len) != NULL)
+	{
+		res = new_folder->parent->valid ? -EEXIST : -ENOENT;
+
+		node_unlock(new_folder->parent);
+		node_free(new_folder);
+		free_inode_number(index);
+		fs_leave();
+		return res;
+	}
+
+	new_folder->c_time = fs_now();
+	new_folder->a_time = fs_now();
+	new_folder->m_time = fs_now();
+	new_folder->b_time = fs_now();
+
+	new_folder->permissions = S_IFDIR | 0777;
+
+	new_folder->size = 0;
+	new_folder->group_id = getgid();
+	new_folder->user_id = getuid();
+
+	new_folder->number = index;
+	new_folder->blocks = 0;
+
+	// 属性填好之后再加入父目录：不加锁的查找一旦找到节点，就可能读取它的属性
+	add_child(new_folder->parent, new_folder);
+	inode_table_set(index, new_folder);
+
+	res = journal_append(JOURNAL_MKDIR, path, NULL, 0, NULL, 0);
+	node_unlock(new_folder->parent);
+	fs_leave();
+
+	return res;
+}
+
+/*
+ * myreaddir - 读取目录内容
+ *
+ * 功能：
+ * 1. 读取指定目录下的所有文件和子目录。
+ * 2. 使用 FUSE 提供的 filler 函数将目录项添加到缓冲区。
+ * 3. 更新目录的访问时间。
+ *
+ * 参数：
+ * - path: 要读取的目录路径。
+ * - buffer: 用于存储目录项的缓冲区。
+ * - filler: FUSE 提供的回调函数，用于将目录项添加到缓冲区。
+ * - offset: 读取偏移量（未使用）。
+ * - fi: 文件信息结构（未使用）。
+ *
+ * 返回值：
+ * - 成功时返回 0。
+ * - 如果目录不存在，返回 -ENOENT。
+ *
+ * 实现逻辑：
+ * 1. 使用 filler 函数添加 "." 和 ".." 目录项。
+ * 2. 根据路径查找对应的目录节点。
+ * 3. 如果目录存在，遍历其子节点，使用 filler 函数将每个子节点添加到缓冲区。
+ * 4. 更新目录的访问时间。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /
+ * ├── home
+ * │   └── user
+ * └── test.txt
+ *
+ * 调用示例：
+ * 1. myreaddir("/", buffer, filler, 0, fi) -> 缓冲区包含 ["home", "test.txt"]
+ * 2. myreaddir("/home", buffer, filler, 0, fi) -> 缓冲区包含 ["user"]
+ * 3. myreaddir("/invalid", buffer, filler, 0, fi) -> 返回 -ENOENT
+ *
+ * 注意：
+ * - 每次读取目录时，都会更新目录的访问时间。
+ * - 如果目录不存在，返回 -ENOENT；路径不是目录时返回 -ENOTDIR。
+ */
+int myreaddir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+	log_debug("READDIR\n");
+
+	filler(buffer, ".", NULL, 0);
+	filler(buffer, "..", NULL, 0);
+
+	fs_enter();
+	filetype *dir_node = filetype_from_path(path);
+
+	if (dir_node == NULL || !S_ISDIR(dir_node->permissions))
+	{
+		fs_leave();
+		return dir_node == NULL ? -ENOENT : -ENOTDIR;
+	}
+	else
+	{
+		node_rdlock(dir_node);
+		__atomic_store_n(&dir_node->a_time, time(NULL), __ATOMIC_RELAXED);
+		for (int i = 0; i < dir_node->children_end; i++)
+		{
+			if (dir_node->children[i] == NULL)
+				continue;
+			const char *name = name_str(&dir_node->children[i]->name);
+			log_debug(":%s:\n", name);
+			filler(buffer, name, NULL, 0);
+		}
+		node_unlock(dir_node);
+	}
+	fs_leave();
+
+	return 0;
+}
+
+/*
+ * mygetattr - 获取文件或目录属性
+ *
+ * 功能：
+ * 1. 获取指定路径的文件或目录的属性信息。
+ * 2. 将属性信息填充到 stat 结构中。
+ * 3. 支持文件和目录的属性查询。
+ *
+ * 参数：
+ * - path: 要查询的文件或目录的完整路径。
+ * - statit: 用于存储属性信息的 stat 结构指针。
+ *
+ * 返回值：
+ * - 成功时返回 0。
+ * - 如果文件或目录不存在，返回 -ENOENT。
+ *
+ * 实现逻辑：
+ * 1. 根据路径查找对应的文件或目录节点。
+ * 2. 如果节点存在，将属性信息填充到 stat 结构中，包括：
+ *    - 用户 ID (st_uid)
+ *    - 组 ID (st_gid)
+ *    - 访问时间 (st_atime)
+ *    - 修改时间 (st_mtime)
+ *    - 创建时间 (st_ctime)
+ *    - 权限模式 (st_mode)
+ *    - 硬链接数 (st_nlink)
+ *    - 文件大小 (st_size)
+ *    - 数据块数 (st_blocks)
+ * 3. 如果节点不存在，返回错误码。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /
+ * ├── home
+ * │   └── user
+ * └── test.txt
+ *
+ * 调用示例：
+ * 1. mygetattr("/test.txt", statit) -> 获取 test.txt 文件的属性
+ * 2. mygetattr("/home", statit) -> 获取 home 目录的属性
+ * 3. mygetattr("/invalid", statit) -> 返回 -ENOENT（文件或目录不存在）
+ *
+ * 注意：
+ * - 必须正确处理文件和目录的属性查询。
+ */
+/*
+ * fill_stat - 用节点的元数据填充 stat 结构
+ *
+ * 注意：
+ * - 路径接口（mygetattr）和低层接口（ll_getattr、ll_lookup）共用。
+ * - 调用方持有节点锁。
+ */
+void fill_stat(filetype *file_node, struct stat *statit)
+{
+	memset(statit, 0, sizeof(*statit));
+	statit->st_ino = file_node->number;
+	statit->st_uid = file_node->user_id;  // The owner of the file/directory is the user who mounted the filesystem
+	statit->st_gid = file_node->group_id; // The group of the file/directory is the same as the group of the user who mounted the filesystem
+	statit->st_atime = __atomic_load_n(&file_node->a_time, __ATOMIC_RELAXED); // The last "a"ccess of the file/directory is right now
+	statit->st_mtime = file_node->m_time; // The last "m"odification of the file/directory is right now
+	statit->st_ctime = file_node->c_time;
+	statit->st_mode = file_node->permissions;
+	statit->st_nlink = file_node->num_links + (S_ISDIR(file_node->permissions) ? file_node->num_children : 0);
+	statit->st_size = file_node->size;
+	statit->st_blocks = file_node->blocks;
+}
+
+static int mygetattr(const char *path, struct stat *statit)
+{
+	if (stats_path(path))
+	{
+		stats_fill_stat(statit);
+		return 0;
+	}
+
+	log_debug("GETATTR %s\n", path);
+
+	fs_enter();
+	filetype *file_node = filetype_from_path(path);
+	if (file_node == NULL)
+	{
+		fs_leave();
+		return -ENOENT;
+	}
+
+	node_rdlock(file_node);
+	fill_stat(file_node, statit);
+	node_unlock(file_node);
+	fs_leave();
+
+	return 0;
+}
 /*
- * find_free_inode - 查找空闲的 inode
+ * myrmdir - 删除目录
  *
  * 功能：
- * 1. 查找当前文件系统中空闲的 inode 编号。
- * 2. 用于创建新文件或目录时分配 inode。
+ * 1. 删除指定路径的目录。
+ * 2. 从父目录的子节点列表中移除该目录。
+ * 3. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
  *
  * 参数：
- * - 无。
+ * - path: 要删除的目录的完整路径。
  *
  * 返回值：
- * - 成功时返回空闲的 inode 编号。
- * - 如果没有空闲 inode，返回 -1。
+ * - 成功时返回 0。
+ * - 如果目录不存在，返回 -ENOENT。
+ * - 如果目录非空，返回 -ENOTEMPTY。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check。
  *
  * 实现逻辑：
- * 1. 遍历 inode 表，查找第一个空闲的 inode。
- * 2. 返回找到的 inode 编号。
+ * 1. 解析路径，获取目录名称和父目录路径。
+ * 2. 通过父目录的哈希索引查找匹配的目录。
+ * 3. 如果找到匹配的目录且为空，将其从子节点列表和哈希索引中移除。
+ * 4. 调用 journal_append 记录本次操作。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /
+ * ├── home
+ * │   └── user
+ * └── test
+ *
+ * 调用示例：
+ * 1. myrmdir("/test") -> 删除 test 目录
+ * 2. myrmdir("/home/user") -> 返回 -ENOTEMPTY（user 目录非空）
+ * 3. myrmdir("/invalid") -> 返回 -ENOENT（目录不存在）
  *
  * 注意：
- * - 如果 inode 表已满，需扩展文件系统。
+ * - 只能删除空目录。
+ * - 如果目录非空，操作失败。
  */
-int find_free_inode()
+int myrmdir(const char *path)
 {
-	for (int i = 2; i < 100; i++)
+	if (stats_path(path))
+		return -ENOTDIR;
+
+	char *pathname;
+	const char *folder_delete = split_path(path, &pathname);
+
+	fs_enter();
+	int res = journal_check();
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
+	filetype *parent = filetype_from_path(pathname);
+
+	if (parent == NULL)
+	{
+		fs_leave();
+		return -ENOENT;
+	}
+
+	node_wrlock(parent);
+	filetype *child = dir_lookup(parent, folder_delete, strlen(folder_delete));
+	if (child == NULL)
+		res = -ENOENT;
+	else
 	{
-		if (spblock.inode_bitmap[i] == '0')
+		node_wrlock(child);
+		if (S_ISDIR(child->permissions) && child->num_children != 0)
+			res = -ENOTEMPTY;
+		else
 		{
-			spblock.inode_bitmap[i] = '1';
+			remove_child(parent, child);
+			release_inode(child);
+			dcache_invalidate();
+
+			res = journal_append(JOURNAL_RMDIR, path, NULL, 0, NULL, 0);
 		}
-		return i;
+		node_unlock(child);
 	}
+	node_unlock(parent);
+	fs_leave();
+
+	return res;
 }
 /*
- * find_free_db - 查找空闲的数据块
+ * myrm - 删除文件
  *
  * 功能：
- * 1. 查找当前文件系统中空闲的数据块编号。
- * 2. 用于存储文件数据时分配数据块。
+ * 1. 删除指定路径的文件。
+ * 2. 从父目录的子节点列表中移除该文件。
+ * 3. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
  *
  * 参数：
- * - 无。
+ * - path: 要删除的文件的完整路径。
  *
  * 返回值：
- * - 成功时返回空闲的数据块编号。
- * - 如果没有空闲数据块，返回 -1。
+ * - 成功时返回 0。
+ * - 如果文件不存在，返回 -ENOENT。
+ * - 如果文件是目录且非空，返回 -ENOTEMPTY。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check。
  *
  * 实现逻辑：
- * 1. 遍历数据块位图，查找第一个空闲的数据块。
- * 2. 返回找到的数据块编号。
+ * 1. 解析路径，获取文件名和父目录路径。
+ * 2. 通过父目录的哈希索引查找匹配的文件。
+ * 3. 如果找到匹配的文件，将其从子节点列表和哈希索引中移除。
+ * 4. 调用 journal_append 记录本次操作。
+ *
+ * 示例：
+ * 假设文件系统结构如下：
+ * /
+ * ├── home
+ * │   └── user
+ * └── test.txt
+ *
+ * 调用示例：
+ * 1. myrm("/test.txt") -> 删除 test.txt 文件
+ * 2. myrm("/home/user") -> 返回 -ENOTEMPTY（user 是目录且非空）
+ * 3. myrm("/invalid") -> 返回 -ENOENT（文件不存在）
  *
  * 注意：
- * - 如果数据块已满，需扩展文件系统。
+ * - 只能删除文件，不能删除目录。
+ * - 如果文件是目录且非空，操作失败。
  */
-int find_free_db()
+int myrm(const char *path)
 {
-	for (int i = 1; i < 100; i++)
+	if (stats_path(path))
+		return -EPERM;
+
+	char *pathname;
+	const char *folder_delete = split_path(path, &pathname);
+
+	fs_enter();
+	int res = journal_check();
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
+	filetype *parent = filetype_from_path(pathname);
+
+	if (parent == NULL)
+	{
+		fs_leave();
+		return -ENOENT;
+	}
+
+	node_wrlock(parent);
+	filetype *child = dir_lookup(parent, folder_delete, strlen(folder_delete));
+	if (child == NULL)
+		res = -ENOENT;
+	else
 	{
-		if (spblock.inode_bitmap[i] == '0')
+		node_wrlock(child);
+		if (S_ISDIR(child->permissions) && child->num_children != 0)
+			res = -ENOTEMPTY;
+		else
 		{
-			spblock.inode_bitmap[i] = '1';
+			remove_child(parent, child);
+			release_inode(child);
+			dcache_invalidate();
+
+			res = journal_append(JOURNAL_UNLINK, path, NULL, 0, NULL, 0);
 		}
-		return i;
+		node_unlock(child);
 	}
+	node_unlock(parent);
+	fs_leave();
+
+	return res;
 }
 
 /*
- * add_child - 添加子节点
+ * 预读
  *
  * 功能：
- * 1. 将指定节点添加到父目录的子节点列表中。
- * 2. 更新父目录的子节点数量和列表。
+ * 1. 每个打开句柄根据最近的读请求识别访问模式：
+ *    - 顺序读：本次 offset 等于上次读取结束的位置。
+ *    - 跨步读：本次与上次 offset 的差等于上一次的差（例如每隔 64 KB 读 4 KB）。
+ * 2. 连续两次命中同一种模式后，提前把后面将要读的数据所在的块预读进内存，
+ *    读者追上来时数据已经在块缓存中。
+ *
+ * 实现逻辑：
+ * 1. 顺序读的窗口从 RA_MIN_BLOCKS 个块开始，每次推进翻倍，直到 fs_config.readahead。
+ *    读者进入窗口的后半段时才预读下一个窗口。
+ * 2. 跨步读预读后面 RA_STRIDE_DEPTH 次请求的位置。
+ * 3. 读者只把区间对应的块号放入预读队列（cache_queue_prefetch）并用
+ *    posix_fadvise(POSIX_FADV_WILLNEED) 通知内核，然后立即返回；预读线程在后台把块读入
+ *    块缓存（T1），读者追上来时在 ARC 中命中，预读与读者的处理因此真正重叠进行。
+ *    关闭缓存（-o cache=0）时只有 posix_fadvise。
+ *
+ * 注意：
+ * - 模式被打破（随机读）时窗口回到最小值，不会为随机读浪费带宽。
+ */
+#define RA_MIN_BLOCKS 16
+#define RA_STRIDE_DEPTH 4
+
+/*
+ * extent_prefetch - 预读文件的字节区间 [off, off + len)，空洞跳过
+ *
+ * 注意：
+ * - 调用方持有文件的读锁，这里只查 extent 和提交请求，不读镜像。
+ */
+void extent_prefetch(filetype *file, off_t off, off_t len, int cursor)
+{
+	if (off + len > file->size)
+		len = file->size - off;
+
+	while (len > 0)
+	{
+		uint32_t run;
+		int block = extent_map(file, off / block_size, &run, &cursor);
+		off_t in_block = off % block_size;
+		off_t span = (off_t)run * block_size - in_block;
+
+		if (span > len)
+			span = len;
+		if (block != 0)
+		{
+			posix_fadvise(image_fd, block_offset(block) + in_block, span, POSIX_FADV_WILLNEED);
+			if (cache.capacity > 0)
+				cache_queue_prefetch(block, (in_block + span + block_size - 1) / block_size);
+		}
+		off += span;
+		len -= span;
+	}
+}
+
+/*
+ * readahead_reset - 回到初始状态：重新识别模式，窗口回到最小值
+ */
+void readahead_reset(open_file *of)
+{
+	off_t max = (off_t)fs_config.readahead * 1024;
+
+	of->hits = 0;
+	of->ra_end = 0;
+	of->ra_size = RA_MIN_BLOCKS * block_size;
+	if ((off_t)of->ra_size > max)
+		of->ra_size = max;
+}
+
+/*
+ * readahead_update - 根据本次读请求 [offset, offset + size) 更新访问模式，返回需要预读的区间
  *
  * 参数：
- * - parent: 父目录节点。
- * - child: 要添加的子节点。
+ * - ra: 返回需要预读的区间（起点、长度），最多 RA_STRIDE_DEPTH 个。
  *
  * 返回值：
- * - 无。
+ * - 区间的个数。
  *
- * 实现逻辑：
- * 1. 扩展父目录的子节点列表（如果需要）。
- * 2. 将子节点添加到列表中。
- * 3. 更新父目录的子节点数量。
+ * 注意：
+ * - 调用方持有句柄锁，释放之后再调用 extent_prefetch 提交预读。
+ */
+int readahead_update(open_file *of, off_t offset, size_t size, off_t ra[][2])
+{
+	filetype *file = of->node;
+	off_t max = (off_t)fs_config.readahead * 1024;
+	off_t end = offset + size;
+	int n = 0;
+
+	if (max == 0)
+		return 0;
+
+	if (offset == of->next_offset)
+	{
+		of->hits++;
+		if (of->hits >= 2 && end + (off_t)of->ra_size / 2 >= of->ra_end)
+		{
+			off_t start = of->ra_end > end ? of->ra_end : end;
+			ra[n][0] = start;
+			ra[n++][1] = of->ra_size;
+			of->ra_end = start + of->ra_size;
+			if ((off_t)of->ra_size * 2 <= max)
+				of->ra_size *= 2;
+		}
+	}
+	else if (of->stride != 0 && offset - of->last_offset == of->stride)
+	{
+		of->hits++;
+		if (of->hits >= 2)
+		{
+			for (int k = 1; k <= RA_STRIDE_DEPTH; k++)
+			{
+				off_t next = offset + k * of->stride;
+				if (next < 0 || next >= file->size)
+					break;
+				// 前几次预读过的位置不再重复提交
+				if (k == RA_STRIDE_DEPTH || of->hits == 2)
+				{
+					ra[n][0] = next;
+					ra[n++][1] = size;
+				}
+			}
+		}
+	}
+	else
+	{
+		// 模式被打破，重新开始识别
+		of->stride = offset - of->last_offset;
+		readahead_reset(of);
+	}
+
+	of->last_offset = offset;
+	of->next_offset = end;
+	return n;
+}
+
+/*
+ * file_handle_open / file_handle_close / file_handle - 管理 fuse_file_info->fh 中的打开句柄
  *
  * 注意：
- * - 确保父目录是目录类型。
+ * - file_handle_open 在节点已经被删除并释放（查找之后被并发删除）时返回 -ENOENT。
  */
-void add_child(filetype *parent, filetype *child)
+int file_handle_open(filetype *file, struct fuse_file_info *fi)
 {
-	(parent->num_children)++;
+	node_wrlock(file);
+	if (node_forgotten(file))
+	{
+		node_unlock(file);
+		return -ENOENT;
+	}
+	file->open_count++;
+	node_unlock(file);
+
+	open_file *of = calloc(1, sizeof(open_file));
+
+	of->node = file;
+	of->extent_cursor = -1;
+	pthread_mutex_init(&of->lock, NULL);
+	readahead_reset(of);
+	fi->fh = (uint64_t)(uintptr_t)of;
+	return 0;
+}
+
+open_file *file_handle(struct fuse_file_info *fi)
+{
+	return fi != NULL ? (open_file *)(uintptr_t)fi->fh : NULL;
+}
 
-	parent->children = realloc(parent->children, (parent->num_children) * sizeof(filetype *));
+void file_handle_close(struct fuse_file_info *fi)
+{
+	open_file *of = file_handle(fi);
 
-	(parent->children)[parent->num_children - 1] = child;
+	if (of == NULL)
+		return;
+	if (of->node != NULL)
+	{
+		node_wrlock(of->node);
+		of->node->open_count--;
+		if (node_forgotten(of->node))
+			forget_inode(of->node);
+		node_unlock(of->node);
+	}
+	free(of->snapshot);
+	pthread_mutex_destroy(&of->lock);
+	free(of);
+	fi->fh = 0;
 }
 
 /*
- * mymkdir - 创建新目录
+ * mycreate - 创建新文件
  *
  * 功能：
- * 1. 在指定路径下创建一个新目录。
- * 2. 分配并初始化新目录的元数据，包括路径、名称、类型、权限、时间戳等。
- * 3. 将新目录添加到父目录的子节点列表中。
- * 4. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
+ * 1. 在指定路径下创建一个新文件。
+ * 2. 分配并初始化新文件的元数据，包括路径、名称、类型、权限、时间戳等。
+ * 3. 将新文件添加到父目录的子节点列表中。
+ * 4. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
  *
  * 参数：
- * - path: 新目录的完整路径（必须以 "/" 开头）。
- * - mode: 目录的权限模式（未直接使用，固定为 0777）。
+ * - path: 新文件的完整路径（必须以 "/" 开头）。
+ * - mode: 文件的权限模式（未直接使用，固定为 0777）。
+ * - fi: 文件信息结构（未使用）。
  *
  * 返回值：
  * - 成功时返回 0。
- * - 如果父目录不存在，返回 -ENOENT。
+ * - 如果父目录不存在，返回 -ENOENT；父路径不是目录时返回 -ENOTDIR。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check。
  *
  * 实现逻辑：
- * 1. 查找一个空闲的 inode 编号。
- * 2. 解析路径，获取新目录的名称和父目录路径。
- * 3. 分配内存并初始化新目录结构（filetype）。
- * 4. 设置新目录的元数据，包括路径、名称、类型、权限、时间戳等。
- * 5. 将新目录添加到父目录的子节点列表中。
- * 6. 调用 save_contents 方法保存文件系统。
+ * 1. 查找一个空闲的 inode 编号。
+ * 2. 解析路径，获取新文件的名称和父目录路径。
+ * 3. 分配内存并初始化新文件结构（filetype）。
+ * 4. 设置新文件的元数据，包括路径、名称、类型、权限、时间戳等。
+ * 5. 将新文件添加到父目录的子节点列表中。
+ * 6. 调用 journal_append 记录本次操作。
  *
  * 示例：
  * 假设文件系统结构如下：
@@ -776,332 +5892,369 @@ void add_child(filetype *parent, filetype *child)
  * └── home
  *
  * 调用示例：
- * 1. mymkdir("/home/user", 0777) -> 在 /home 下创建 user 目录
- *    - 新目录路径: "/home/user"
- *    - 新目录名称: "user"
+ * 1. mycreate("/home/test.txt", 0777, fi) -> 在 /home 下创建 test.txt 文件
+ *    - 新文件路径: "/home/test.txt"
+ *    - 新文件名称: "test.txt"
  *    - 父目录: "/home"
- * 2. mymkdir("/invalid/path", 0777) -> 返回 -ENOENT（父目录不存在）
+ * 2. mycreate("/invalid/path/file.txt", 0777, fi) -> 返回 -ENOENT（父目录不存在）
  *
  * 注意：
  * - 路径必须以 "/" 开头。
- * - 新目录的权限固定为 0777。
+ * - 新文件的权限固定为 0777。
  * - 如果父目录不存在，操作失败。
  */
-static int mymkdir(const char *path, mode_t mode)
+int mycreate(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	printf("MKDIR\n");
 
-	int index = find_free_inode();
+	log_debug("CREATEFILE\n");
 
-	filetype *new_folder = malloc(sizeof(filetype));
+	if (stats_path(path))
+		return -EEXIST;
 
-	char *pathname = malloc(strlen(path) + 2);
-	strcpy(pathname, path);
+	fs_enter();
+	char *pathname;
+	const char *name = split_path(path, &pathname);
+	name_ref ref;
+	int res = journal_check();
+	if (res == 0)
+		res = name_intern(name, strlen(name), &ref);
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
 
-	char *rindex = strrchr(pathname, '/');
+	int index = find_free_inode();
+	if (index < 0)
+	{
+		fs_leave();
+		return -ENOSPC;
+	}
 
-	// new_folder -> name = malloc(strlen(pathname)+2);
-	strcpy(new_folder->name, rindex + 1);
-	// new_folder -> path = malloc(strlen(pathname)+2);
-	strcpy(new_folder->path, pathname);
+	filetype *new_file = node_alloc();
 
-	*rindex = '\0';
+	new_file->name = ref;
+	new_file->parent = filetype_from_path(pathname);
+	new_file->num_links = 0;
+	new_file->valid = 1;
 
-	if (strlen(pathname) == 0)
-		strcpy(pathname, "/");
+	if (new_file->parent == NULL || !S_ISDIR(new_file->parent->permissions))
+	{
+		res = new_file->parent == NULL ? -ENOENT : -ENOTDIR;
+		node_free(new_file);
+		free_inode_number(index);
+		fs_leave();
+		return res;
+	}
 
-	new_folder->children = NULL;
-	new_folder->num_children = 0;
-	new_folder->parent = filetype_from_path(pathname);
-	new_folder->num_links = 2;
-	new_folder->valid = 1;
-	strcpy(new_folder->test, "test");
+	node_wrlock(new_file->parent);
+	// 查找之后、加锁之前父目录可能已经被删除
+	if (!new_file->parent->valid || dir_lookup(new_file->parent, name, ref.len) != NULL)
+	{
+		res = new_file->parent->valid ? -EEXIST : -ENOENT;
 
-	if (new_folder->parent == NULL)
-		return -ENOENT;
+		node_unlock(new_file->parent);
+		node_free(new_file);
+		free_inode_number(index);
+		fs_leave();
+		return res;
+	}
 
-	// printf(";;;;%p;;;;\n", new_folder);
+	new_file->c_time = fs_now();
+	new_file->a_time = fs_now();
+	new_file->m_time = fs_now();
+	new_file->b_time = fs_now();
 
-	add_child(new_folder->parent, new_folder);
+	new_file->permissions = S_IFREG | 0777;
 
-	// new_folder -> type = malloc(10);
-	strcpy(new_folder->type, "directory");
+	new_file->size = 0;
+	new_file->group_id = getgid();
+	new_file->user_id = getuid();
 
-	new_folder->c_time = time(NULL);
-	new_folder->a_time = time(NULL);
-	new_folder->m_time = time(NULL);
-	new_folder->b_time = time(NULL);
+	new_file->number = index;
 
-	new_folder->permissions = S_IFDIR | 0777;
+	// 数据块在写入时按需分配
+	new_file->blocks = 0;
 
-	new_folder->size = 0;
-	new_folder->group_id = getgid();
-	new_folder->user_id = getuid();
+	// 属性填好之后再加入父目录，见 mymkdir
+	add_child(new_file->parent, new_file);
+	inode_table_set(index, new_file);
 
-	new_folder->number = index;
-	new_folder->blocks = 0;
+	res = journal_append(JOURNAL_CREATE, path, NULL, 0, NULL, 0);
 
-	save_contents();
+	// 日志重放时 fi 为 NULL；在父目录解锁之前打开，新文件不会在此期间被删除。
+	// 追加日志失败时文件已经建立，仍然返回错误，FUSE 不会使用 fi
+	if (fi != NULL && res == 0)
+		file_handle_open(new_file, fi);
+	node_unlock(new_file->parent);
+	fs_leave();
 
-	return 0;
+	return res;
 }
 
 /*
- * myreaddir - 读取目录内容
+ * myopen - 打开文件
  *
  * 功能：
- * 1. 读取指定目录下的所有文件和子目录。
- * 2. 使用 FUSE 提供的 filler 函数将目录项添加到缓冲区。
- * 3. 更新目录的访问时间。
+ * 1. 打开指定路径的文件。
+ * 2. 检查文件是否存在。
+ * 3. 更新文件的访问时间。
  *
  * 参数：
- * - path: 要读取的目录路径。
- * - buffer: 用于存储目录项的缓冲区。
- * - filler: FUSE 提供的回调函数，用于将目录项添加到缓冲区。
- * - offset: 读取偏移量（未使用）。
- * - fi: 文件信息结构（未使用）。
+ * - path: 要打开的文件的完整路径。
+ * - fi: 文件信息结构，打开的句柄保存在 fi->fh 中。
  *
  * 返回值：
  * - 成功时返回 0。
- * - 如果目录不存在，返回 -ENOENT。
+ * - 如果文件不存在，返回 -ENOENT。
  *
  * 实现逻辑：
- * 1. 使用 filler 函数添加 "." 和 ".." 目录项。
- * 2. 根据路径查找对应的目录节点。
- * 3. 如果目录存在，遍历其子节点，使用 filler 函数将每个子节点添加到缓冲区。
- * 4. 更新目录的访问时间。
+ * 1. 根据路径查找对应的文件节点。
+ * 2. 如果文件存在，分配 open_file 句柄，之后的读写直接使用句柄中的节点。
+ * 3. 如果文件不存在，返回错误码。
  *
  * 示例：
  * 假设文件系统结构如下：
  * /
- * ├── home
- * │   └── user
  * └── test.txt
  *
  * 调用示例：
- * 1. myreaddir("/", buffer, filler, 0, fi) -> 缓冲区包含 ["home", "test.txt"]
- * 2. myreaddir("/home", buffer, filler, 0, fi) -> 缓冲区包含 ["user"]
- * 3. myreaddir("/invalid", buffer, filler, 0, fi) -> 返回 -ENOENT
+ * 1. myopen("/test.txt", fi) -> 成功打开 test.txt 文件
+ * 2. myopen("/invalid.txt", fi) -> 返回 -ENOENT（文件不存在）
  *
  * 注意：
- * - 每次读取目录时，都会更新目录的访问时间。
- * - 如果目录不存在，返回 -ENOENT。
+ * - 打开文件时会更新文件的访问时间。
+ * - 如果文件不存在，返回 -ENOENT。
  */
-int myreaddir(const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+int myopen(const char *path, struct fuse_file_info *fi)
 {
-	printf("READDIR\n");
+	log_debug("OPEN\n");
 
-	filler(buffer, ".", NULL, 0);
-	filler(buffer, "..", NULL, 0);
+	if (stats_path(path))
+		return stats_open(fi);
 
-	char *pathname = malloc(strlen(path) + 2);
-	strcpy(pathname, path);
+	fs_enter();
+	filetype *file = filetype_from_path(path);
+	int res = file == NULL ? -ENOENT : file_handle_open(file, fi);
+	fs_leave();
 
-	filetype *dir_node = filetype_from_path(pathname);
-
-	if (dir_node == NULL)
-	{
-		return -ENOENT;
-	}
-	else
-	{
-		dir_node->a_time = time(NULL);
-		for (int i = 0; i < dir_node->num_children; i++)
-		{
-			printf(":%s:\n", dir_node->children[i]->name);
-			filler(buffer, dir_node->children[i]->name, NULL, 0);
-		}
-	}
+	return res;
+}
 
+/*
+ * myrelease - 关闭文件
+ *
+ * 功能：
+ * 1. 最后一次关闭某个打开句柄时调用，释放 myopen / mycreate 分配的 open_file。
+ * 2. 文件已被删除且这是最后一个句柄时，释放它的 inode 编号和数据块。
+ */
+int myrelease(const char *path, struct fuse_file_info *fi)
+{
+	fs_enter();
+	file_handle_close(fi);
+	fs_leave();
 	return 0;
 }
 
 /*
- * mygetattr - 获取文件或目录属性
+ * myflush - 每次 close 文件描述符时调用
  *
- * 功能：
- * 1. 获取指定路径的文件或目录的属性信息。
- * 2. 将属性信息填充到 stat 结构中。
- * 3. 支持文件和目录的属性查询。
+ * 返回值：
+ * - 成功返回 0；之前有修改没能追加到日志时返回 -EIO（见 journal_check），close 因此能报告写入失败。
  *
- * 参数：
- * - path: 要查询的文件或目录的完整路径。
- * - statit: 用于存储属性信息的 stat 结构指针。
+ * 注意：
+ * - 写入在返回前已经进入日志和块缓存，句柄中没有需要提交的数据。
+ * - close 不保证持久化，需要持久化的应用应当调用 fsync。
+ */
+int myflush(const char *path, struct fuse_file_info *fi)
+{
+	return journal_check();
+}
+
+/*
+ * myfsync - 把文件的修改持久化
  *
- * 返回值：
- * - 成功时返回 0。
- * - 如果文件或目录不存在，返回 -ENOENT。
+ * 参数：
+ * - datasync: 非 0 时为 fdatasync。日志记录同时包含数据和元数据，两者的处理相同。
  *
  * 实现逻辑：
- * 1. 根据路径查找对应的文件或目录节点。
- * 2. 如果节点存在，将属性信息填充到 stat 结构中，包括：
- *    - 用户 ID (st_uid)
- *    - 组 ID (st_gid)
- *    - 访问时间 (st_atime)
- *    - 修改时间 (st_mtime)
- *    - 创建时间 (st_ctime)
- *    - 权限模式 (st_mode)
- *    - 硬链接数 (st_nlink)
- *    - 文件大小 (st_size)
- *    - 数据块数 (st_blocks)
- * 3. 如果节点不存在，返回错误码。
+ * - 修改都已经追加到日志中，调用 journal_sync 保证日志落盘即可，
+ *   并发的 fsync 共享一次 fdatasync。
+ * - 有修改没能追加到日志、检查点也还没有成功时返回 -EIO，见 journal_sync。
  *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
+ * 注意：
+ * - 同时作为 fsyncdir 使用：目录的修改同样记录在日志中。
+ */
+int myfsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	return journal_sync();
+}
+
+/*
+ * node_read - 读取节点的文件内容
  *
- * 调用示例：
- * 1. mygetattr("/test.txt", statit) -> 获取 test.txt 文件的属性
- * 2. mygetattr("/home", statit) -> 获取 home 目录的属性
- * 3. mygetattr("/invalid", statit) -> 返回 -ENOENT（文件或目录不存在）
+ * 功能：
+ * 1. 按 pread 的语义读取 [offset, offset + size) 与文件内容相交的部分。
+ * 2. 只访问覆盖这个区间的块，耗时与请求大小成正比，与文件大小无关。
+ *
+ * 返回值：
+ * - 实际读取的字节数，offset 位于文件末尾或之后时为 0；读镜像失败返回 -EIO，目录返回 -EISDIR。
  *
  * 注意：
- * - 必须正确处理文件和目录的属性查询。
+ * - myread 解析路径后调用；低层接口 ll_read 按 inode 编号找到节点后直接调用。
+ * - 数据按原样复制，不追加 '\0'。
+ * - 通过打开句柄读取时会更新预读状态，见 readahead_update。
+ * - 持有文件的读锁，同一文件上的多个读可以并发进行。
  */
-static int mygetattr(const char *path, struct stat *statit)
+int node_read(filetype *file, char *buf, size_t size, off_t offset, open_file *of)
 {
-	char *pathname;
-	pathname = (char *)malloc(strlen(path) + 2);
-
-	strcpy(pathname, path);
-
-	printf("GETATTR %s\n", pathname);
+	int res, cursor = -1;
 
-	filetype *file_node = filetype_from_path(pathname);
-	if (file_node == NULL)
-		return -ENOENT;
+	if (S_ISDIR(file->permissions))
+		return -EISDIR;
+	if (offset < 0)
+		return -EINVAL;
 
-	statit->st_uid = file_node->user_id;  // The owner of the file/directory is the user who mounted the filesystem
-	statit->st_gid = file_node->group_id; // The group of the file/directory is the same as the group of the user who mounted the filesystem
-	statit->st_atime = file_node->a_time; // The last "a"ccess of the file/directory is right now
-	statit->st_mtime = file_node->m_time; // The last "m"odification of the file/directory is right now
-	statit->st_ctime = file_node->c_time;
-	statit->st_mode = file_node->permissions;
-	statit->st_nlink = file_node->num_links + file_node->num_children;
-	statit->st_size = file_node->size;
-	statit->st_blocks = file_node->blocks;
+	node_rdlock(file);
+	if (offset >= file->size)
+		size = 0;
+	else if ((off_t)size > file->size - offset)
+		size = file->size - offset;
 
-	return 0;
+	if (of != NULL)
+	{
+		pthread_mutex_lock(&of->lock);
+		cursor = of->extent_cursor;
+		pthread_mutex_unlock(&of->lock);
+	}
+	if (size > 0 && (res = extent_io(file, buf, size, offset, 0, &cursor)) < 0)
+	{
+		node_unlock(file);
+		return res;
+	}
+	if (size > 0)
+	{
+		__atomic_store_n(&file->a_time, fs_now(), __ATOMIC_RELAXED);
+		if (of != NULL)
+		{
+			off_t ra[RA_STRIDE_DEPTH][2];
+
+			pthread_mutex_lock(&of->lock);
+			of->extent_cursor = cursor;
+			int n = readahead_update(of, offset, size, ra);
+			pthread_mutex_unlock(&of->lock);
+			for (int i = 0; i < n; i++)
+				extent_prefetch(file, ra[i][0], ra[i][1], cursor);
+		}
+	}
+	node_unlock(file);
+	return size;
 }
+
 /*
- * myrmdir - 删除目录
+ * myread - 读取文件内容
  *
  * 功能：
- * 1. 删除指定路径的目录。
- * 2. 从父目录的子节点列表中移除该目录。
- * 3. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
+ * 1. 读取指定文件的内容。
+ * 2. 只读取从 offset 开始的 size 个字节所在的数据块。
+ * 3. 将读取的数据存储到提供的缓冲区中。
+ * 4. 更新文件的访问时间。
  *
  * 参数：
- * - path: 要删除的目录的完整路径。
+ * - path: 要读取的文件的完整路径。
+ * - buf: 用于存储读取数据的缓冲区，至少 size 字节。
+ * - size: 要读取的数据大小。
+ * - offset: 读取的偏移量。
+ * - fi: 文件信息结构（未使用）。
  *
  * 返回值：
- * - 成功时返回 0。
- * - 如果目录不存在，返回 -ENOENT。
- * - 如果目录非空，返回 -ENOTEMPTY。
+ * - 成功时返回实际读取的字节数。
+ * - 如果文件不存在，返回 -ENOENT。
  *
  * 实现逻辑：
- * 1. 解析路径，获取目录名称和父目录路径。
- * 2. 在父目录的子节点列表中查找匹配的目录。
- * 3. 如果找到匹配的目录且为空，将其从子节点列表中移除。
- * 4. 调用 save_contents 方法保存文件系统。
+ * 1. 根据路径查找对应的文件节点。
+ * 2. 把读取范围截断到文件末尾。
+ * 3. 由 extent_io 把范围映射到数据块，每段连续的块用一次 pread 读入 buf。
+ * 4. 更新文件的访问时间。
  *
  * 示例：
  * 假设文件系统结构如下：
  * /
- * ├── home
- * │   └── user
- * └── test
+ * └── test.txt
  *
  * 调用示例：
- * 1. myrmdir("/test") -> 删除 test 目录
- * 2. myrmdir("/home/user") -> 返回 -ENOTEMPTY（user 目录非空）
- * 3. myrmdir("/invalid") -> 返回 -ENOENT（目录不存在）
+ * 1. myread("/test.txt", buf, 1024, 0, fi) -> 读取 test.txt 文件的前 1024 字节
+ * 2. myread("/test.txt", buf, 4096, 1048576, fi) -> 只读取 1 MB 处的 4 KB
+ * 3. myread("/invalid.txt", buf, 1024, 0, fi) -> 返回 -ENOENT（文件不存在）
  *
  * 注意：
- * - 只能删除空目录。
- * - 如果目录非空，操作失败。
+ * - 读取数据时会更新文件的访问时间。
+ * - 如果文件不存在，返回 -ENOENT。
  */
-int myrmdir(const char *path)
+int myread(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
 
-	char *pathname = malloc(strlen(path) + 2);
-	strcpy(pathname, path);
-
-	char *rindex = strrchr(pathname, '/');
-
-	char *folder_delete = malloc(strlen(rindex + 1) + 2);
-
-	strcpy(folder_delete, rindex + 1);
-
-	*rindex = '\0';
-
-	if (strlen(pathname) == 0)
-		strcpy(pathname, "/");
-
-	filetype *parent = filetype_from_path(pathname);
-
-	if (parent == NULL)
-		return -ENOENT;
-
-	if (parent->num_children == 0)
-		return -ENOENT;
-
-	filetype *curr_child = (parent->children)[0];
-	int index = 0;
-	while (index < (parent->num_children))
-	{
-		if (strcmp(curr_child->name, folder_delete) == 0)
-		{
-			break;
-		}
-		index++;
-		curr_child = (parent->children)[index];
-	}
+	log_debug("READ\n");
 
-	if (index < (parent->num_children))
-	{
-		if (((parent->children)[index]->num_children) != 0)
-			return -ENOTEMPTY;
-		for (int i = index + 1; i < (parent->num_children); i++)
-		{
-			(parent->children)[i - 1] = (parent->children)[i];
-		}
-		(parent->num_children) -= 1;
-	}
+	open_file *of = file_handle(fi);
+	if (of != NULL && of->snapshot != NULL)
+		return stats_read(of, buf, size, offset);
 
-	else
-	{
-		return -ENOENT;
-	}
+	fs_enter();
+	filetype *file = of ? of->node : filetype_from_path(path);
+	int res = file == NULL ? -ENOENT : node_read(file, buf, size, offset, of);
+	fs_leave();
 
-	save_contents();
+	return res;
+}
 
+/*
+ * myaccess - 检查文件访问权限
+ *
+ * 功能：
+ * 1. 检查指定路径的文件或目录是否可访问。
+ * 2. 目前仅作为占位符实现，始终返回成功。
+ *
+ * 参数：
+ * - path: 要检查的文件或目录的完整路径。
+ * - mask: 访问权限掩码（未使用）。
+ *
+ * 返回值：
+ * - 始终返回 0，表示成功。
+ *
+ * 注意：
+ * - 当前实现未实际检查权限，需根据需求完善。
+ */
+int myaccess(const char *path, int mask)
+{
 	return 0;
 }
+
 /*
- * myrm - 删除文件
+ * myrename - 重命名文件或目录
  *
  * 功能：
- * 1. 删除指定路径的文件。
- * 2. 从父目录的子节点列表中移除该文件。
- * 3. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
+ * 1. 将文件或目录从旧路径重命名为新路径。
+ * 2. 更新文件或目录的名称和路径。
+ * 3. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
  *
  * 参数：
- * - path: 要删除的文件的完整路径。
+ * - from: 文件或目录的原始路径。
+ * - to: 文件或目录的新路径。
  *
  * 返回值：
  * - 成功时返回 0。
- * - 如果文件不存在，返回 -ENOENT。
- * - 如果文件是目录且非空，返回 -ENOTEMPTY。
+ * - 如果原始路径或新路径的父目录不存在，返回 -ENOENT；新路径的父路径不是目录时返回 -ENOTDIR。
+ * - 如果新路径已存在且是非空目录，返回 -ENOTEMPTY。
+ * - 如果要把目录移动到它自己的子目录下，返回 -EINVAL。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check。
  *
  * 实现逻辑：
- * 1. 解析路径，获取文件名和父目录路径。
- * 2. 在父目录的子节点列表中查找匹配的文件。
- * 3. 如果找到匹配的文件，将其从子节点列表中移除。
- * 4. 调用 save_contents 方法保存文件系统。
+ * 1. 解析原始路径，获取文件或目录的节点。
+ * 2. 解析新路径，获取新名称和新的父目录。
+ * 3. 如果新路径已存在，先将其删除（与 rename(2) 一致）。
+ * 4. 从原父目录移除节点，更新名称后加入新父目录，两边的哈希索引同步更新。
+ * 5. 调用 journal_append 记录本次操作。
  *
  * 示例：
  * 假设文件系统结构如下：
@@ -1111,197 +6264,287 @@ int myrmdir(const char *path)
  * └── test.txt
  *
  * 调用示例：
- * 1. myrm("/test.txt") -> 删除 test.txt 文件
- * 2. myrm("/home/user") -> 返回 -ENOTEMPTY（user 是目录且非空）
- * 3. myrm("/invalid") -> 返回 -ENOENT（文件不存在）
+ * 1. myrename("/test.txt", "/home/test.txt") -> 将 test.txt 移动到 /home 目录下
+ * 2. myrename("/home/user", "/home/new_user") -> 将 user 目录重命名为 new_user
+ * 3. myrename("/invalid", "/new_path") -> 返回 -ENOENT（文件或目录不存在）
  *
  * 注意：
- * - 只能删除文件，不能删除目录。
- * - 如果文件是目录且非空，操作失败。
+ * - 只修改节点的名称和父目录，子孙节点的路径由父目录链推导，不需要逐个更新。
+ * - 如果原始路径对应的文件或目录不存在，返回 -ENOENT。
+ * - 独占 fs_lock，执行期间没有其他回调在运行，不需要再锁节点。
  */
-int myrm(const char *path)
+int myrename(const char *from, const char *to)
 {
+	log_debug("RENAME: %s\n", from);
+	log_debug("RENAME: %s\n", to);
 
-	char *pathname = malloc(strlen(path) + 2);
-	strcpy(pathname, path);
-
-	char *rindex = strrchr(pathname, '/');
-
-	char *folder_delete = malloc(strlen(rindex + 1) + 2);
-
-	strcpy(folder_delete, rindex + 1);
+	if (stats_path(from) || stats_path(to))
+		return -EPERM;
 
-	*rindex = '\0';
-
-	if (strlen(pathname) == 0)
-		strcpy(pathname, "/");
-
-	filetype *parent = filetype_from_path(pathname);
+	// rename 改变父目录链，不加锁拼接路径（node_path）的读者不能同时运行，独占 fs_lock
+	fs_enter_exclusive();
+	int res = journal_check();
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
 
-	if (parent == NULL)
+	filetype *file = filetype_from_path(from);
+	if (file == NULL)
+	{
+		fs_leave();
 		return -ENOENT;
+	}
+	if (file == root)
+	{
+		fs_leave();
+		return -EBUSY;
+	}
 
-	if (parent->num_children == 0)
-		return -ENOENT;
+	char *pathname2;
+	const char *new_name = split_path(to, &pathname2);
+	name_ref ref;
+	res = name_intern(new_name, strlen(new_name), &ref);
+	if (res != 0)
+	{
+		fs_leave();
+		return res;
+	}
 
-	filetype *curr_child = (parent->children)[0];
-	int index = 0;
-	while (index < (parent->num_children))
+	filetype *new_parent = filetype_from_path(pathname2);
+	if (new_parent == NULL || !S_ISDIR(new_parent->permissions))
 	{
-		if (strcmp(curr_child->name, folder_delete) == 0)
-		{
-			break;
-		}
-		index++;
-		curr_child = (parent->children)[index];
+		fs_leave();
+		return new_parent == NULL ? -ENOENT : -ENOTDIR;
 	}
 
-	if (index < (parent->num_children))
+	for (filetype *node = new_parent; node != NULL; node = node->parent)
 	{
-		if (((parent->children)[index]->num_children) != 0)
-			return -ENOTEMPTY;
-		for (int i = index + 1; i < (parent->num_children); i++)
+		if (node == file)
 		{
-			(parent->children)[i - 1] = (parent->children)[i];
+			fs_leave();
+			return -EINVAL;
 		}
-		(parent->num_children) -= 1;
 	}
 
-	else
+	filetype *target = dir_lookup(new_parent, new_name, ref.len);
+	if (target == file)
 	{
-		return -ENOENT;
+		fs_leave();
+		return 0;
+	}
+	if (target != NULL)
+	{
+		if (S_ISDIR(target->permissions) && target->num_children != 0)
+		{
+			fs_leave();
+			return -ENOTEMPTY;
+		}
+		remove_child(new_parent, target);
+		release_inode(target);
 	}
 
-	save_contents();
+	dcache_invalidate();
+	remove_child(file->parent, file);
+	file->name = ref;
+	file->parent = new_parent;
+	add_child(new_parent, file);
 
-	return 0;
+	log_debug(":%s:\n", name_str(&file->name));
+
+	res = journal_append(JOURNAL_RENAME, from, to, 0, NULL, 0);
+
+	fs_leave();
+	return res;
 }
 
 /*
- * mycreate - 创建新文件
+ * node_truncate - 把文件截断或扩展到 size 字节
  *
  * 功能：
- * 1. 在指定路径下创建一个新文件。
- * 2. 分配并初始化新文件的元数据，包括路径、名称、类型、权限、时间戳等。
- * 3. 将新文件添加到父目录的子节点列表中。
- * 4. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
- *
- * 参数：
- * - path: 新文件的完整路径（必须以 "/" 开头）。
- * - mode: 文件的权限模式（未直接使用，固定为 0777）。
- * - fi: 文件信息结构（未使用）。
+ * 1. 缩小时归还新末尾之后的整块（extent_truncate）；扩展时不分配数据块，新增部分读出为 0。
+ * 2. 调用 journal_append 记录一条 JOURNAL_TRUNCATE，重放时按路径再截断一次。
  *
  * 返回值：
- * - 成功时返回 0。
- * - 如果父目录不存在，返回 -ENOENT。
- *
- * 实现逻辑：
- * 1. 查找一个空闲的 inode 编号。
- * 2. 解析路径，获取新文件的名称和父目录路径。
- * 3. 分配内存并初始化新文件结构（filetype）。
- * 4. 设置新文件的元数据，包括路径、名称、类型、权限、时间戳等。
- * 5. 将新文件添加到父目录的子节点列表中。
- * 6. 调用 save_contents 方法保存文件系统。
- *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * └── home
- *
- * 调用示例：
- * 1. mycreate("/home/test.txt", 0777, fi) -> 在 /home 下创建 test.txt 文件
- *    - 新文件路径: "/home/test.txt"
- *    - 新文件名称: "test.txt"
- *    - 父目录: "/home"
- * 2. mycreate("/invalid/path/file.txt", 0777, fi) -> 返回 -ENOENT（父目录不存在）
+ * - 成功返回 0；目录返回 -EISDIR，size 为负返回 -EINVAL，文件已被删除返回 -ENOENT，
+ *   写镜像失败、日志不可用或追加失败返回 -EIO。
  *
  * 注意：
- * - 路径必须以 "/" 开头。
- * - 新文件的权限固定为 0777。
- * - 如果父目录不存在，操作失败。
+ * - 缩小之后原末尾所在块中可能还留着旧数据，扩展时先把原末尾到块尾的部分清零（与 node_write 相同）。
+ * - 持有文件的写锁，与读写互相排斥。
  */
-int mycreate(const char *path, mode_t mode, struct fuse_file_info *fi)
+int node_truncate(filetype *file, off_t size)
 {
+	static const char zero_block[block_size];
+	int res = 0;
 
-	printf("CREATEFILE\n");
-
-	int index = find_free_inode();
-
-	filetype *new_file = malloc(sizeof(filetype));
-
-	char *pathname = malloc(strlen(path) + 2);
-	strcpy(pathname, path);
-
-	char *rindex = strrchr(pathname, '/');
-
-	strcpy(new_file->name, rindex + 1);
-	strcpy(new_file->path, pathname);
-
-	*rindex = '\0';
-
-	if (strlen(pathname) == 0)
-		strcpy(pathname, "/");
-
-	new_file->children = NULL;
-	new_file->num_children = 0;
-	new_file->parent = filetype_from_path(pathname);
-	new_file->num_links = 0;
-	new_file->valid = 1;
+	if (S_ISDIR(file->permissions))
+		return -EISDIR;
+	if (size < 0)
+		return -EINVAL;
+	if ((res = journal_check()) != 0)
+		return res;
 
-	if (new_file->parent == NULL)
-		return -ENOENT;
+	node_wrlock(file);
+	if (node_forgotten(file))
+		res = -ENOENT;
 
-	add_child(new_file->parent, new_file);
+	if (res == 0 && size > file->size && file->size % block_size != 0)
+	{
+		off_t gap = block_size - file->size % block_size;
+		if (gap > size - file->size)
+			gap = size - file->size;
+		res = extent_io(file, (char *)zero_block, gap, file->size, 1, NULL);
+	}
+	if (res < 0)
+	{
+		node_unlock(file);
+		return res;
+	}
 
-	// new_file -> type = malloc(10);
-	strcpy(new_file->type, "file");
+	if (size < file->size)
+		extent_truncate(file, (size + block_size - 1) / block_size);
+	file->size = size;
+	file->m_time = fs_now();
+	file->c_time = file->m_time;
+	node_mark_dirty(file);
+	// 已删除但仍打开的文件不写日志，见 node_write
+	if (file->valid)
+		res = journal_append(JOURNAL_TRUNCATE, node_path(file), NULL, size, NULL, 0);
+	node_unlock(file);
+
+	return res;
+}
 
-	new_file->c_time = time(NULL);
-	new_file->a_time = time(NULL);
-	new_file->m_time = time(NULL);
-	new_file->b_time = time(NULL);
+/*
+ * mytruncate / myftruncate - 截断文件
+ *
+ * 功能：
+ * 1. 将指定文件截断或扩展到 size 字节，见 node_truncate。
+ * 2. 以 O_TRUNC 打开已有文件（例如 echo hi > file）时，FUSE 先调用本函数把文件截成 0。
+ *
+ * 参数：
+ * - path: 要截断的文件的完整路径。
+ * - size: 目标文件大小。
+ * - fi: ftruncate 的文件句柄，直接从句柄取得节点。
+ *
+ * 返回值：
+ * - 成功时返回 0。
+ * - 文件不存在返回 -ENOENT，/.fsstats 返回 -EACCES，其余见 node_truncate。
+ */
+int myftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	open_file *of = file_handle(fi);
+	if ((of != NULL && of->snapshot != NULL) || (of == NULL && stats_path(path)))
+		return -EACCES;
 
-	new_file->permissions = S_IFREG | 0777;
+	fs_enter();
+	filetype *file = of ? of->node : filetype_from_path(path);
+	int res = file == NULL ? -ENOENT : node_truncate(file, size);
+	fs_leave();
 
-	new_file->size = 0;
-	new_file->group_id = getgid();
-	new_file->user_id = getuid();
+	return res;
+}
 
-	new_file->number = index;
+int mytruncate(const char *path, off_t size)
+{
+	return myftruncate(path, size, NULL);
+}
 
-	for (int i = 0; i < 16; i++)
+/*
+ * node_write - 向节点写入数据
+ *
+ * 功能：
+ * 1. 按 pwrite 的语义把 buf 中的 size 个字节写到文件的 offset 处，数据可以包含 '\0'。
+ * 2. 写入范围超出文件末尾时扩展文件，中间未写过的部分读出为 0。
+ *
+ * 返回值：
+ * - 成功时返回 size；空间不足返回 -ENOSPC，写镜像失败返回 -EIO，目录返回 -EISDIR。
+ * - 日志不可用或追加失败返回 -EIO，见 journal_check / journal_append。
+ *
+ * 注意：
+ * - mywrite 解析路径后调用；低层接口 ll_write 按 inode 编号找到节点后直接调用。
+ * - 日志记录使用由父目录链拼出的完整路径（node_path）。
+ * - 持有文件的写锁：同一文件上的写互相排斥，也与读互相排斥。
+ */
+int node_write(filetype *file, const char *buf, size_t size, off_t offset, open_file *of)
+{
+	static const char zero_block[block_size];
+	int res = 0;
+
+	if (S_ISDIR(file->permissions))
+		return -EISDIR;
+	if (offset < 0)
+		return -EINVAL;
+	if (size == 0)
+		return 0;
+	if ((res = journal_check()) != 0)
+		return res;
+
+	node_wrlock(file);
+	// 通过路径找到节点之后，文件可能已经被并发删除
+	if (node_forgotten(file))
+		res = -ENOENT;
+
+	// 在文件末尾之后写入时，原最后一个块中文件末尾之后的部分要读出 0
+	if (res == 0 && offset > file->size && file->size % block_size != 0)
 	{
-		(new_file->datablocks)[i] = find_free_db();
+		off_t gap = block_size - file->size % block_size;
+		if (gap > offset - file->size)
+			gap = offset - file->size;
+		res = extent_io(file, (char *)zero_block, gap, file->size, 1, NULL);
 	}
 
-	// new_file -> size = 0;
-	new_file->blocks = 0;
-
-	save_contents();
+	if (res == 0)
+		res = extent_alloc(file, offset / block_size, (offset + size - 1) / block_size - offset / block_size + 1);
+	if (res == 0)
+		res = extent_io(file, (char *)buf, size, offset, 1, of ? &of->extent_cursor : NULL);
+	if (res < 0)
+	{
+		node_unlock(file);
+		return res;
+	}
 
-	return 0;
+	if (offset + (off_t)size > file->size)
+		file->size = offset + size;
+	file->m_time = fs_now();
+	file->c_time = file->m_time;
+	node_mark_dirty(file);
+	// 已删除但仍打开的文件不写日志：它的路径可能已经属于别的文件，崩溃后数据也不需要恢复
+	if (file->valid)
+		res = journal_append(JOURNAL_WRITE, node_path(file), NULL, offset, buf, size);
+	node_unlock(file);
+
+	return res < 0 ? res : (int)size;
 }
 
 /*
- * myopen - 打开文件
+ * mywrite - 向文件写入数据
  *
  * 功能：
- * 1. 打开指定路径的文件。
- * 2. 检查文件是否存在。
- * 3. 更新文件的访问时间。
+ * 1. 将数据写入指定文件的 offset 处。
+ * 2. 根据写入范围覆盖已有的块，或者分配新的块。
+ * 3. 更新文件的大小和块使用情况。
+ * 4. 调用 journal_append 向日志追加一条记录，由检查点统一落盘。
  *
  * 参数：
- * - path: 要打开的文件的完整路径。
+ * - path: 要写入的文件的完整路径。
+ * - buf: 要写入的数据缓冲区（二进制安全，不要求以 '\0' 结尾）。
+ * - size: 要写入的数据大小。
+ * - offset: 写入的偏移量。
  * - fi: 文件信息结构（未使用）。
  *
  * 返回值：
- * - 成功时返回 0。
+ * - 成功时返回实际写入的字节数。
  * - 如果文件不存在，返回 -ENOENT。
  *
  * 实现逻辑：
  * 1. 根据路径查找对应的文件节点。
- * 2. 如果文件存在，更新文件的访问时间。
- * 3. 如果文件不存在，返回错误码。
+ * 2. 用 extent_alloc 为 [offset, offset + size) 覆盖的块中尚未分配的部分分配空间。
+ * 3. 用 extent_io 把数据复制到对应的数据块，连续的块只需一次 pwrite。
+ * 4. 更新文件的大小和块使用情况。
+ * 5. 调用 journal_append 记录本次操作。
  *
  * 示例：
  * 假设文件系统结构如下：
@@ -1309,366 +6552,873 @@ int mycreate(const char *path, mode_t mode, struct fuse_file_info *fi)
  * └── test.txt
  *
  * 调用示例：
- * 1. myopen("/test.txt", fi) -> 成功打开 test.txt 文件
- * 2. myopen("/invalid.txt", fi) -> 返回 -ENOENT（文件不存在）
+ * 1. mywrite("/test.txt", "Hello", 5, 0, fi) -> 将 "Hello" 写入 test.txt 文件
+ *    - 文件大小更新为 5
+ *    - 第一个数据块包含 "Hello"
+ * 2. mywrite("/test.txt", " World", 6, 5, fi) -> 将 " World" 写到 "Hello" 之后
+ *    - 文件大小更新为 11
+ *    - 第一个数据块包含 "Hello World"
+ * 3. mywrite("/test.txt", "J", 1, 0, fi) -> 覆盖第一个字节，文件变为 "Jello World"，大小不变
+ * 4. mywrite("/invalid.txt", "Data", 4, 0, fi) -> 返回 -ENOENT（文件不存在）
+ * 5. 空间不足时返回 -ENOSPC。
  *
  * 注意：
- * - 打开文件时会更新文件的访问时间。
+ * - 以 O_APPEND 打开时由内核把 offset 设为文件末尾。
  * - 如果文件不存在，返回 -ENOENT。
  */
-int myopen(const char *path, struct fuse_file_info *fi)
+int mywrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
-	printf("OPEN\n");
 
-	char *pathname = malloc(sizeof(path) + 1);
-	strcpy(pathname, path);
+	log_debug("WRITING\n");
 
-	filetype *file = filetype_from_path(pathname);
+	open_file *of = file_handle(fi);
+	if (of != NULL && of->snapshot != NULL)
+		return -EBADF;
 
-	return 0;
+	fs_enter();
+	filetype *file = of ? of->node : filetype_from_path(path);
+	int res = file == NULL ? -ENOENT : node_write(file, buf, size, offset, of);
+	fs_leave();
+
+	return res;
 }
 
 /*
- * myread - 读取文件内容
+ * journal_replay - 挂载时重放日志
  *
  * 功能：
- * 1. 读取指定文件的内容。
- * 2. 根据文件的大小和数据块分布，从磁盘中读取数据。
- * 3. 将读取的数据存储到提供的缓冲区中。
- * 4. 更新文件的访问时间。
+ * 1. 从头依次读取 journal.bin 中的记录并校验。
+ * 2. 对 lsn 大于 checkpoint_lsn 的记录，调用对应的回调函数重新执行。
+ * 3. 遇到不完整或校验失败的记录时，把日志截断到最后一条完整记录之后。
+ *
+ * 4. 重放了记录时做一次检查点，重放的结果落盘，日志清空。
+ *
+ * 注意：
+ * - 必须在加载检查点（file_structure.bin 和 fs.img）之后调用。
+ * - 头部中的长度在校验之前先和文件大小比较，残缺的尾部不会引起过大的分配。
+ * - 重放期间回调请求的检查点（日志写满、没有空闲块时等待延迟释放的块）由 fs_leave 推迟到
+ *   重放结束，不会在读日志的途中把它清空。
+ */
+void journal_replay()
+{
+	journal_record hdr;
+	struct stat st;
+	off_t pos = 0;
+	unsigned long replayed = 0;
+
+	if (fstat(journal_fd, &st) != 0)
+		st.st_size = 0;
+	while (pread(journal_fd, &hdr, sizeof(hdr), pos) == sizeof(hdr) && hdr.magic == JOURNAL_MAGIC)
+	{
+		size_t payload_len = (size_t)hdr.path_len + hdr.path2_len + hdr.data_len;
+		// 头部还没有校验，长度超出文件末尾的是残缺的记录，不能按它分配内存
+		if (hdr.path_len == 0 || payload_len > (size_t)(st.st_size - pos - sizeof(hdr)))
+			break;
+		size_t mark = scratch_mark();
+		char *payload = scratch_alloc(payload_len + 1);
+
+		if (pread(journal_fd, payload, payload_len, pos + sizeof(hdr)) != (ssize_t)payload_len ||
+			journal_checksum(&hdr, payload, payload_len) != hdr.checksum)
+		{
+			scratch_reset(mark);
+			break;
+		}
+		payload[payload_len] = '\0';
+
+		char *path = payload;
+		char *path2 = payload + hdr.path_len;
+		char *data = path2 + hdr.path2_len;
+
+		if (hdr.lsn > spblock.checkpoint_lsn)
+		{
+			journal_replaying = 1;
+			journal_replay_time = hdr.time;
+			switch (hdr.op)
+			{
+			case JOURNAL_MKDIR:
+				mymkdir(path, 0777);
+				break;
+			case JOURNAL_CREATE:
+				mycreate(path, 0777, NULL);
+				break;
+			case JOURNAL_WRITE:
+				mywrite(path, data, hdr.data_len, hdr.offset, NULL);
+				break;
+			case JOURNAL_RENAME:
+				myrename(path, path2);
+				break;
+			case JOURNAL_UNLINK:
+				myrm(path);
+				break;
+			case JOURNAL_RMDIR:
+				myrmdir(path);
+				break;
+			case JOURNAL_TRUNCATE:
+				mytruncate(path, hdr.offset);
+				break;
+			}
+			journal_replaying = 0;
+			replayed++;
+		}
+		scratch_reset(mark);
+
+		journal_next_lsn = hdr.lsn + 1;
+		journal_records++;
+		pos += sizeof(hdr) + payload_len;
+	}
+
+	if (ftruncate(journal_fd, pos) != 0)
+		perror("journal truncate");
+	journal_bytes = pos;
+
+	if (journal_next_lsn <= spblock.checkpoint_lsn)
+		journal_next_lsn = spblock.checkpoint_lsn + 1;
+
+	log_info("REPLAYED %lu\n", replayed);
+	if (replayed > 0 || checkpoint_wanted)
+	{
+		fs_enter_exclusive();
+		journal_checkpoint();
+		fs_leave();
+	}
+}
+
+/*
+ * mydestroy - 卸载文件系统
+ *
+ * 功能：
+ * 1. 停止写回线程，做一次检查点（写回全部脏块），下次挂载无需重放日志。
+ * 2. 关闭负载记录文件（-o trace=FILE）。
+ * 3. 输出块缓存的命中、未命中和写回次数，停止日志线程并输出剩余的日志。
+ */
+void mydestroy(void *private_data)
+{
+	cache_stop_flusher();
+	fs_enter_exclusive();
+	journal_checkpoint();
+	fs_leave();
+	trace_close();
+	log_info("CACHE HITS %lu MISSES %lu FLUSHES %lu\n", cache.hits, cache.misses, cache.flushes);
+	log_stop();
+}
+
+/*
+ * myinit / ll_init - 文件系统挂载完成（FUSE 已经转入后台）后调用，启动日志线程和写回线程
+ */
+void *myinit(struct fuse_conn_info *conn)
+{
+	log_start();
+	cache_start_flusher();
+	return NULL;
+}
+
+void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	log_start();
+	cache_start_flusher();
+}
+
+/*
+ * STATS_OP / STATS_LL_OP - 生成记录耗时的回调包装函数，注册到 operations / ll_operations 中
+ *
+ * 功能：
+ * 1. 记录回调的耗时（stats_record），打开负载记录时追加一条记录（trace_record）。
+ * 2. 回调返回后归还它在 scratch 中分配的临时内存。
  *
  * 参数：
- * - path: 要读取的文件的完整路径。
- * - buf: 用于存储读取数据的缓冲区。
- * - size: 要读取的数据大小。
- * - offset: 读取的偏移量（未使用）。
- * - fi: 文件信息结构（未使用）。
+ * - name: 包装函数名。
+ * - op: 统计编号（OP_*）。
+ * - fn: 被包装的回调。
+ * - params / args: 回调的参数声明和参数列表（带括号）。
+ * - paths: 低层接口中需要解析成路径的 (inode, 名称, inode, 名称)，见 trace_ll_paths。
+ * - trace: 负载记录的参数（带括号），第一个是文件句柄 fi（没有时为 NULL），其余交给 trace_record，
+ *   高层接口从 path 开始，低层接口从 offset 开始。
+ */
+#define TRACE_ARGS(...) __VA_ARGS__
+#define TRACE_FI(fi, ...) (fi)
+#define TRACE_REST(fi, ...) __VA_ARGS__
+
+#define STATS_OP(name, op, fn, params, args, trace)                    \
+	int name params                                                    \
+	{                                                                  \
+		uint64_t fh = trace_fh(TRACE_FI trace, 0);                     \
+		size_t mark = scratch_mark();                                  \
+		uint64_t start = stats_now();                                  \
+		int res = fn args;                                             \
+		stats_record(op, start);                                       \
+		scratch_reset(mark);                                           \
+		if (trace_file != NULL)                                        \
+			trace_record(op, start, res, trace_fh(TRACE_FI trace, fh), \
+						 TRACE_REST trace);                            \
+		return res;                                                    \
+	}
+
+#define STATS_LL_OP(name, op, fn, params, args, paths, trace)                      \
+	void name params                                                               \
+	{                                                                              \
+		char tpath[2][TRACE_PATH_MAX];                                             \
+		int traced = trace_file != NULL;                                           \
+		if (traced)                                                                \
+			trace_ll_paths(tpath, TRACE_ARGS paths);                               \
+		uint64_t fh = trace_fh(TRACE_FI trace, 0);                                 \
+		size_t mark = scratch_mark();                                              \
+		uint64_t start = stats_now();                                              \
+		fn args;                                                                   \
+		stats_record(op, start);                                                   \
+		scratch_reset(mark);                                                       \
+		if (traced)                                                                \
+			trace_record(op, start, TRACE_NO_RESULT, trace_fh(TRACE_FI trace, fh), \
+						 tpath[0], tpath[1], TRACE_REST trace);                    \
+	}
+
+STATS_OP(timed_mkdir, OP_MKDIR, mymkdir, (const char *path, mode_t mode), (path, mode), (NULL, path, NULL, 0, 0, mode, 0))
+STATS_OP(timed_getattr, OP_GETATTR, mygetattr, (const char *path, struct stat *st), (path, st), (NULL, path, NULL, 0, 0, 0, 0))
+STATS_OP(timed_readdir, OP_READDIR, myreaddir, (const char *path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi), (path, buffer, filler, offset, fi), (fi, path, NULL, offset, 0, 0, 0))
+STATS_OP(timed_rmdir, OP_RMDIR, myrmdir, (const char *path), (path), (NULL, path, NULL, 0, 0, 0, 0))
+STATS_OP(timed_open, OP_OPEN, myopen, (const char *path, struct fuse_file_info *fi), (path, fi), (fi, path, NULL, 0, 0, 0, fi->flags))
+STATS_OP(timed_release, OP_RELEASE, myrelease, (const char *path, struct fuse_file_info *fi), (path, fi), (fi, path, NULL, 0, 0, 0, 0))
+STATS_OP(timed_flush, OP_FLUSH, myflush, (const char *path, struct fuse_file_info *fi), (path, fi), (fi, path, NULL, 0, 0, 0, 0))
+STATS_OP(timed_fsync, OP_FSYNC, myfsync, (const char *path, int datasync, struct fuse_file_info *fi), (path, datasync, fi), (fi, path, NULL, 0, 0, 0, datasync))
+STATS_OP(timed_fsyncdir, OP_FSYNCDIR, myfsync, (const char *path, int datasync, struct fuse_file_info *fi), (path, datasync, fi), (fi, path, NULL, 0, 0, 0, datasync))
+STATS_OP(timed_read, OP_READ, myread, (const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi), (path, buf, size, offset, fi), (fi, path, NULL, offset, size, 0, 0))
+STATS_OP(timed_write, OP_WRITE, mywrite, (const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi), (path, buf, size, offset, fi), (fi, path, NULL, offset, size, 0, 0))
+STATS_OP(timed_create, OP_CREATE, mycreate, (const char *path, mode_t mode, struct fuse_file_info *fi), (path, mode, fi), (fi, path, NULL, 0, 0, mode, fi->flags))
+STATS_OP(timed_rename, OP_RENAME, myrename, (const char *from, const char *to), (from, to), (NULL, from, to, 0, 0, 0, 0))
+STATS_OP(timed_unlink, OP_UNLINK, myrm, (const char *path), (path), (NULL, path, NULL, 0, 0, 0, 0))
+STATS_OP(timed_truncate, OP_TRUNCATE, mytruncate, (const char *path, off_t size), (path, size), (NULL, path, NULL, size, 0, 0, FUSE_SET_ATTR_SIZE))
+STATS_OP(timed_ftruncate, OP_TRUNCATE, myftruncate, (const char *path, off_t size, struct fuse_file_info *fi), (path, size, fi), (fi, path, NULL, size, 0, 0, FUSE_SET_ATTR_SIZE))
+
+static struct fuse_operations operations =
+{
+    .mkdir = timed_mkdir,       // 创建目录
+    .getattr = timed_getattr,   // 获取文件/目录属性
+    .readdir = timed_readdir,   // 读取目录内容
+    .rmdir = timed_rmdir,       // 删除目录
+    .open = timed_open,         // 打开文件
+    .release = timed_release,   // 关闭文件
+    .flush = timed_flush,       // close 时调用
+    .fsync = timed_fsync,       // 持久化文件
+    .fsyncdir = timed_fsyncdir, // 持久化目录
+    .read = timed_read,         // 读取文件内容
+    .write = timed_write,       // 写入文件内容
+    .create = timed_create,     // 创建文件
+    .rename = timed_rename,     // 重命名文件/目录
+    .unlink = timed_unlink,     // 删除文件
+    .truncate = timed_truncate, // 截断文件
+    .ftruncate = timed_ftruncate, // 截断打开的文件
+    .init = myinit,             // 启动日志线程和写回线程
+    .destroy = mydestroy,       // 卸载时做检查点
+};
+
+/*
+ * 低层接口（fuse_lowlevel_ops）
  *
- * 返回值：
- * - 成功时返回实际读取的字节数。
- * - 如果文件不存在，返回 -ENOENT。
+ * 功能：
+ * 1. 内核请求直接携带 inode 编号（fuse_ino_t），通过 inode_table 在 O(1) 时间内找到节点，
+ *    不再需要每次把完整路径交给 filetype_from_path 逐级解析。
+ * 2. lookup 只在父目录的哈希索引中查找一个名称。
  *
- * 实现逻辑：
- * 1. 根据路径查找对应的文件节点。
- * 2. 如果文件存在，根据文件的大小和数据块分布，从磁盘中读取数据。
- * 3. 将读取的数据存储到提供的缓冲区中。
- * 4. 更新文件的访问时间。
+ * 注意：
+ * - 内核的根目录编号固定为 FUSE_ROOT_ID（1），本文件系统的根目录编号是 2，由 ll_ino / ll_node 转换。
+ * - 每次成功回复 entry 都会让内核持有一次 lookup 引用，forget 归还后才允许复用已删除节点的编号。
+ * - 创建、删除、重命名等修改操作仍交给高层回调完成，以便共用日志与目录缓存失效逻辑。
+ */
+fuse_ino_t ll_ino(filetype *node)
+{
+	return node == root ? FUSE_ROOT_ID : (fuse_ino_t)node->number;
+}
+
+filetype *ll_node(fuse_ino_t ino)
+{
+	if (ino == FUSE_ROOT_ID)
+		return root;
+	if (ino >= (fuse_ino_t)inode_table_size)
+		return NULL;
+	return inode_table[ino];
+}
+
+/*
+ * ll_child_path - 拼出父目录下某个名称的完整路径，供修改类操作调用高层回调
  *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * └── test.txt
+ * 返回值：
+ * - 分配在 scratch 中的路径；父目录不存在或已被删除时返回 NULL。
+ */
+char *ll_child_path(fuse_ino_t parent, const char *name)
+{
+	filetype *dir = ll_node(parent);
+
+	if (dir == NULL || !dir->valid)
+		return NULL;
+
+	const char *dir_path = dir == root ? "" : node_path(dir);
+	size_t size = strlen(dir_path) + strlen(name) + 2;
+	char *path = scratch_alloc(size);
+	snprintf(path, size, "%s/%s", dir_path, name);
+	return path;
+}
+
+/*
+ * trace_ll_paths - 把低层接口请求中的 (inode, 名称) 解析成负载记录使用的完整路径
  *
- * 调用示例：
- * 1. myread("/test.txt", buf, 1024, 0, fi) -> 读取 test.txt 文件的前 1024 字节
- * 2. myread("/invalid.txt", buf, 1024, 0, fi) -> 返回 -ENOENT（文件不存在）
+ * 参数：
+ * - path: 输出的两个路径；inode 为 0 或找不到节点时为空串。
+ * - ino / name: name 为 NULL 时解析 ino 本身，否则解析 ino 目录下的 name。
+ * - ino2 / name2: 第二个路径（rename 的目标），同上。
  *
  * 注意：
- * - 读取数据时会更新文件的访问时间。
- * - 如果文件不存在，返回 -ENOENT。
+ * - 已删除但仍打开的节点没有路径，记为空串。
  */
-int myread(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+void trace_ll_path(char *path, fuse_ino_t ino, const char *name)
 {
+	filetype *node = ino != 0 ? ll_node(ino) : NULL;
 
-	printf("READ\n");
+	path[0] = '\0';
+	if (ino == STATS_INO)
+		snprintf(path, TRACE_PATH_MAX, "/" STATS_NAME);
+	else if (node != NULL && node->valid)
+		snprintf(path, TRACE_PATH_MAX, "%s", name != NULL ? ll_child_path(ino, name) : node_path(node));
+}
 
-	char *pathname = malloc(sizeof(path) + 1);
-	strcpy(pathname, path);
+void trace_ll_paths(char path[2][TRACE_PATH_MAX], fuse_ino_t ino, const char *name, fuse_ino_t ino2, const char *name2)
+{
+	size_t mark = scratch_mark();
 
-	filetype *file = filetype_from_path(pathname);
-	if (file == NULL)
+	fs_enter();
+	trace_ll_path(path[0], ino, name);
+	trace_ll_path(path[1], ino2, name2);
+	fs_leave();
+	scratch_reset(mark);
+}
+
+/*
+ * ll_fill_entry - 填写目录项应答并增加节点的 lookup 引用
+ *
+ * 返回值：
+ * - 成功返回 0；节点在不加锁查找之后已被删除并释放编号时返回 -ENOENT。
+ */
+int ll_fill_entry(filetype *node, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->ino = ll_ino(node);
+	e->attr_timeout = 1.0;
+	e->entry_timeout = 1.0;
+	node_wrlock(node);
+	if (node_forgotten(node))
+	{
+		node_unlock(node);
 		return -ENOENT;
+	}
+	fill_stat(node, &e->attr);
+	node->nlookup++;
+	node_unlock(node);
+	e->attr.st_ino = e->ino;
+	return 0;
+}
+
+void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	filetype *dir, *node;
+	struct fuse_entry_param e;
+	int res = -ENOENT;
+
+	if (parent == FUSE_ROOT_ID && strcmp(name, STATS_NAME) == 0)
+	{
+		memset(&e, 0, sizeof(e));
+		e.ino = STATS_INO;
+		stats_fill_stat(&e.attr);
+		fuse_reply_entry(req, &e);
+		return;
+	}
+
+	fs_enter();
+	if ((dir = ll_node(parent)) != NULL && (node = dir_lookup(dir, name, strlen(name))) != NULL)
+		res = ll_fill_entry(node, &e);
+	fs_leave();
 
+	if (res != 0)
+		fuse_reply_err(req, -res);
 	else
+		fuse_reply_entry(req, &e);
+}
+
+void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	fs_enter();
+	filetype *node = ll_node(ino);
+
+	if (node != NULL && node != root)
+	{
+		node_wrlock(node);
+		node->nlookup = node->nlookup > nlookup ? node->nlookup - nlookup : 0;
+		// 已删除的节点在最后一个引用归还后才释放编号
+		if (node_forgotten(node))
+			forget_inode(node);
+		node_unlock(node);
+	}
+	fs_leave();
+	fuse_reply_none(req);
+}
+
+void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct stat st;
+
+	if (ino == STATS_INO)
 	{
-		char *str = malloc(sizeof(char) * 1024 * (file->blocks));
+		stats_fill_stat(&st);
+		fuse_reply_attr(req, &st, 0);
+		return;
+	}
 
-		printf(":%ld:\n", file->size);
-		strcpy(str, "");
-		int i;
-		for (i = 0; i < (file->blocks) - 1; i++)
-		{
-			strncat(str, &spblock.datablocks[block_size * (file->datablocks[i])], 1024);
-			printf("--> %s", str);
-		}
-		strncat(str, &spblock.datablocks[block_size * (file->datablocks[i])], (file->size) % 1024);
-		printf("--> %s", str);
-		// strncpy(str, &spblock.datablocks[block_size*(file -> datablocks[0])], file->size);
-		strcpy(buf, str);
+	fs_enter();
+	filetype *node = ll_node(ino);
+	if (node != NULL)
+	{
+		node_rdlock(node);
+		fill_stat(node, &st);
+		node_unlock(node);
+	}
+	fs_leave();
+
+	if (node == NULL)
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
 	}
-	return file->size;
+	st.st_ino = ino;
+	fuse_reply_attr(req, &st, 1.0);
 }
 
 /*
- * myaccess - 检查文件访问权限
- *
- * 功能：
- * 1. 检查指定路径的文件或目录是否可访问。
- * 2. 目前仅作为占位符实现，始终返回成功。
- *
- * 参数：
- * - path: 要检查的文件或目录的完整路径。
- * - mask: 访问权限掩码（未使用）。
+ * node_readdir - 从偏移量 off 开始，把目录项按 fuse_add_direntry 的格式填入 buf
  *
  * 返回值：
- * - 始终返回 0，表示成功。
+ * - 填入的字节数，0 表示已经读完。
  *
  * 注意：
- * - 当前实现未实际检查权限，需根据需求完善。
+ * - 偏移量 0、1 对应 "." 和 ".."，之后的偏移量 off 表示从位置（dir_pos）不小于 off - 2 的
+ *   子节点继续，用 dir_seek 二分查找。位置在删除其他子节点时不变，一边读一边删除（rm -rf）
+ *   不会跳过目录项。
+ * - 每次调用只生成本次缓冲区放得下的目录项，大目录不需要反复构造完整列表。
+ * - 调用方已经 fs_enter；req 只交给 fuse_add_direntry，可以为 NULL（见 check.c）。
  */
-int myaccess(const char *path, int mask)
+size_t node_readdir(fuse_req_t req, filetype *dir, char *buf, size_t size, off_t off)
 {
-	return 0;
+	size_t used = 0;
+	off_t i;
+
+	node_rdlock(dir);
+	// i < 2 为 "." 和 ".."，之后是 children 的下标加 2
+	i = off < 2 ? off : dir_seek(dir, off - 2 > UINT32_MAX ? UINT32_MAX : off - 2) + 2;
+	for (; i < dir->children_end + 2; i++)
+	{
+		const char *name;
+		filetype *node;
+		struct stat st;
+		off_t next;
+		size_t len;
+
+		if (i == 0)
+		{
+			name = ".";
+			node = dir;
+			next = 1;
+		}
+		else if (i == 1)
+		{
+			name = "..";
+			node = dir->parent ? dir->parent : dir;
+			next = 2;
+		}
+		else if ((node = dir->children[i - 2]) == NULL)
+			continue;
+		else
+		{
+			name = name_str(&node->name);
+			next = (off_t)node->dir_pos + 3;
+		}
+
+		memset(&st, 0, sizeof(st));
+		st.st_ino = ll_ino(node);
+		st.st_mode = node->permissions;
+		len = fuse_add_direntry(req, buf + used, size - used, name, &st, next);
+		if (len > size - used)
+			break;
+		used += len;
+	}
+	node_unlock(dir);
+	return used;
 }
 
 /*
- * myrename - 重命名文件或目录
- *
- * 功能：
- * 1. 将文件或目录从旧路径重命名为新路径。
- * 2. 更新文件或目录的名称和路径。
- * 3. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
- *
- * 参数：
- * - from: 文件或目录的原始路径。
- * - to: 文件或目录的新路径。
- *
- * 返回值：
- * - 成功时返回 0。
- * - 如果原始路径对应的文件或目录不存在，返回 -ENOENT。
- *
- * 实现逻辑：
- * 1. 解析原始路径，获取文件或目录的节点。
- * 2. 解析新路径，获取新名称和父目录路径。
- * 3. 更新文件或目录的名称和路径。
- * 4. 调用 save_contents 方法保存文件系统。
- *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * ├── home
- * │   └── user
- * └── test.txt
- *
- * 调用示例：
- * 1. myrename("/test.txt", "/home/test.txt") -> 将 test.txt 移动到 /home 目录下
- * 2. myrename("/home/user", "/home/new_user") -> 将 user 目录重命名为 new_user
- * 3. myrename("/invalid", "/new_path") -> 返回 -ENOENT（文件或目录不存在）
- *
- * 注意：
- * - 重命名操作会同时更新文件或目录的名称和路径。
- * - 如果原始路径对应的文件或目录不存在，返回 -ENOENT。
+ * ll_readdir - 读取目录，见 node_readdir
  */
-int myrename(const char *from, const char *to)
+void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-	printf("RENAME: %s\n", from);
-	printf("RENAME: %s\n", to);
+	filetype *dir;
+	char *buf;
+	size_t used;
 
-	char *pathname = malloc(strlen(from) + 2);
-	strcpy(pathname, from);
+	fs_enter();
+	dir = ll_node(ino);
+	if (dir == NULL)
+	{
+		fs_leave();
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	if (!S_ISDIR(dir->permissions))
+	{
+		fs_leave();
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
 
-	char *rindex1 = strrchr(pathname, '/');
+	buf = scratch_alloc(size);
+	used = node_readdir(req, dir, buf, size, off);
+	fs_leave();
 
-	filetype *file = filetype_from_path(pathname);
+	fuse_reply_buf(req, buf, used);
+}
 
-	*rindex1 = '\0';
+void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int res;
 
-	char *pathname2 = malloc(strlen(to) + 2);
-	strcpy(pathname2, to);
+	if (ino == STATS_INO)
+		res = stats_open(fi);
+	else
+	{
+		fs_enter();
+		filetype *file = ll_node(ino);
+		res = file == NULL ? -ENOENT : file_handle_open(file, fi);
+		fs_leave();
+	}
 
-	char *rindex2 = strrchr(pathname2, '/');
+	if (res != 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_open(req, fi);
+}
 
-	if (file == NULL)
-		return -ENOENT;
+void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	myrelease(NULL, fi);
+	fuse_reply_err(req, 0);
+}
 
-	// file -> name = realloc(file -> name, strlen(rindex2+1)+2);
-	strcpy(file->name, rindex2 + 1);
-	// file -> path = realloc(file -> path, strlen(to)+2);
-	strcpy(file->path, to);
+void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, -myflush(NULL, fi));
+}
 
-	printf(":%s:\n", file->name);
-	printf(":%s:\n", file->path);
+void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, -myfsync(NULL, datasync, fi));
+}
 
-	save_contents();
+void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	open_file *of = file_handle(fi);
+	char *content = scratch_alloc(size);
+	int n;
 
-	return 0;
+	if (of != NULL && of->snapshot != NULL)
+		n = stats_read(of, content, size, off);
+	else
+	{
+		fs_enter();
+		filetype *file = of ? of->node : ll_node(ino);
+		n = file == NULL ? -ENOENT : node_read(file, content, size, off, of);
+		fs_leave();
+	}
+
+	if (n < 0)
+		fuse_reply_err(req, -n);
+	else
+		fuse_reply_buf(req, content, n);
 }
 
-/*
- * mytruncate - 截断文件
- *
- * 功能：
- * 1. 将指定文件截断到指定大小。
- * 2. 目前仅作为占位符实现，未实际实现功能。
- *
- * 参数：
- * - path: 要截断的文件的完整路径。
- * - size: 目标文件大小。
- *
- * 返回值：
- * - 始终返回 0，表示成功。
- *
- * 注意：
- * - 当前实现未实际截断文件，需根据需求完善。
- */
-int mytruncate(const char *path, off_t size)
+void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
-	return 0;
+	open_file *of = file_handle(fi);
+	int n;
+
+	if (of != NULL && of->snapshot != NULL)
+		n = -EBADF;
+	else
+	{
+		fs_enter();
+		filetype *file = of ? of->node : ll_node(ino);
+		n = file == NULL ? -ENOENT : node_write(file, buf, size, off, of);
+		fs_leave();
+	}
+
+	if (n < 0)
+		fuse_reply_err(req, -n);
+	else
+		fuse_reply_write(req, n);
 }
 
 /*
- * mywrite - 向文件写入数据
- *
- * 功能：
- * 1. 将数据写入指定文件。
- * 2. 根据文件当前大小和数据块使用情况，将数据写入合适的块。
- * 3. 更新文件的大小和块使用情况。
- * 4. 调用 save_contents 方法将更新后的文件系统保存到磁盘。
- *
- * 参数：
- * - path: 要写入的文件的完整路径。
- * - buf: 要写入的数据缓冲区。
- * - size: 要写入的数据大小。
- * - offset: 写入的偏移量（未使用）。
- * - fi: 文件信息结构（未使用）。
- *
- * 返回值：
- * - 成功时返回实际写入的字节数。
- * - 如果文件不存在，返回 -ENOENT。
- *
- * 实现逻辑：
- * 1. 根据路径查找对应的文件节点。
- * 2. 如果文件当前大小为 0，直接将数据写入第一个数据块。
- * 3. 如果文件已有数据，检查最后一个数据块是否有剩余空间：
- *    - 如果有剩余空间，将数据写入剩余空间。
- *    - 如果没有剩余空间，分配新的数据块并写入数据。
- * 4. 更新文件的大小和块使用情况。
- * 5. 调用 save_contents 方法保存文件系统。
- *
- * 示例：
- * 假设文件系统结构如下：
- * /
- * └── test.txt
- *
- * 调用示例：
- * 1. mywrite("/test.txt", "Hello", 5, 0, fi) -> 将 "Hello" 写入 test.txt 文件
- *    - 文件大小更新为 5
- *    - 数据块 0 包含 "Hello"
- * 2. mywrite("/test.txt", " World", 6, 0, fi) -> 将 " World" 追加到 test.txt 文件
- *    - 文件大小更新为 11
- *    - 数据块 0 包含 "Hello World"
- * 3. mywrite("/invalid.txt", "Data", 4, 0, fi) -> 返回 -ENOENT（文件不存在）
+ * ll_setattr - 修改属性
  *
  * 注意：
- * - 写入数据时会自动追加到文件末尾。
- * - 如果文件不存在，返回 -ENOENT。
+ * - 只支持修改大小（truncate、以 O_TRUNC 打开），见 node_truncate；
+ *   与高层接口一样不支持修改模式、属主和时间，这些字段被忽略，应答中是节点当前的属性。
  */
-int mywrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
 {
+	open_file *of = file_handle(fi);
+	struct stat st;
+	int res = 0;
 
-	printf("WRITING\n");
-
-	char *pathname = malloc(sizeof(path) + 1);
-	strcpy(pathname, path);
-
-	filetype *file = filetype_from_path(pathname);
-	if (file == NULL)
-		return -ENOENT;
+	if (ino == STATS_INO || (of != NULL && of->snapshot != NULL))
+	{
+		fuse_reply_err(req, EACCES);
+		return;
+	}
 
-	int indexno = (file->blocks) - 1;
+	fs_enter();
+	filetype *node = of ? of->node : ll_node(ino);
+	if (node == NULL)
+		res = -ENOENT;
+	else if (to_set & FUSE_SET_ATTR_SIZE)
+		res = node_truncate(node, attr->st_size);
+	if (res == 0)
+	{
+		node_rdlock(node);
+		fill_stat(node, &st);
+		node_unlock(node);
+	}
+	fs_leave();
 
-	if (file->size == 0)
+	if (res != 0)
 	{
-		strcpy(&spblock.datablocks[block_size * ((file->datablocks)[0])], buf);
-		file->size = strlen(buf);
-		(file->blocks)++;
+		fuse_reply_err(req, -res);
+		return;
 	}
-	else
+	st.st_ino = ino;
+	fuse_reply_attr(req, &st, 1.0);
+}
+
+void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	struct fuse_entry_param e;
+	filetype *dir, *node = NULL;
+
+	// 拼路径、创建和回填 entry 都在 fs_lock 下完成，期间路径不会因 rename 改变
+	fs_enter();
+	char *path = ll_child_path(parent, name);
+	int res = path != NULL ? mymkdir(path, mode) : -ENOENT;
+	if (res == 0)
 	{
-		int currblk = (file->blocks) - 1;
-		int len1 = 1024 - (file->size % 1024);
-		if (len1 >= strlen(buf))
-		{
-			strcat(&spblock.datablocks[block_size * ((file->datablocks)[currblk])], buf);
-			file->size += strlen(buf);
-			printf("---> %s\n", &spblock.datablocks[block_size * ((file->datablocks)[currblk])]);
-		}
+		dir = ll_node(parent);
+		// 新目录可能已经被并发删除
+		if ((node = dir_lookup(dir, name, strlen(name))) != NULL)
+			res = ll_fill_entry(node, &e);
 		else
-		{
-			char *cpystr = malloc(1024 * sizeof(char));
-			strncpy(cpystr, buf, len1 - 1);
-			strcat(&spblock.datablocks[block_size * ((file->datablocks)[currblk])], cpystr);
-			strcpy(cpystr, buf);
-			strcpy(&spblock.datablocks[block_size * ((file->datablocks)[currblk + 1])], (cpystr + len1 - 1));
-			file->size += strlen(buf);
-			printf("---> %s\n", &spblock.datablocks[block_size * ((file->datablocks)[currblk])]);
-			(file->blocks)++;
-		}
+			res = -ENOENT;
 	}
-	save_contents();
+	fs_leave();
 
-	return strlen(buf);
+	if (res != 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_entry(req, &e);
 }
 
-static struct fuse_operations operations =
+void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
 {
-    .mkdir = mymkdir,       // 创建目录
-    .getattr = mygetattr,   // 获取文件/目录属性
-    .readdir = myreaddir,   // 读取目录内容
-    .rmdir = myrmdir,       // 删除目录
-    .open = myopen,         // 打开文件
-    .read = myread,         // 读取文件内容
-    .write = mywrite,       // 写入文件内容
-    .create = mycreate,     // 创建文件
-    .rename = myrename,     // 重命名文件/目录
-    .unlink = myrm,         // 删除文件
-};
+	struct fuse_entry_param e;
+
+	fs_enter();
+	char *path = ll_child_path(parent, name);
+	int res = path != NULL ? mycreate(path, mode, fi) : -ENOENT;
+	// 打开的句柄保证节点不会被释放，直接从句柄取得新文件
+	if (res == 0)
+		res = ll_fill_entry(file_handle(fi)->node, &e);
+	fs_leave();
+
+	if (res != 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_create(req, &e, fi);
+}
 
-int main(int argc, char *argv[])
+void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-	// 二进制文件代表了基于磁盘的文件系统（file layout)
-	FILE *fd = fopen("file_structure.bin", "rb");
-	if (fd)
-	{
-		printf("LOADING\n");
-		// 如果文件存在，读取文件结构数据到 file_array
-		fread(&file_array, sizeof(filetype) * 31, 1, fd);
+	fs_enter();
+	char *path = ll_child_path(parent, name);
+	int res = path != NULL ? myrm(path) : -ENOENT;
+	fs_leave();
+	fuse_reply_err(req, -res);
+}
+
+void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	fs_enter();
+	char *path = ll_child_path(parent, name);
+	int res = path != NULL ? myrmdir(path) : -ENOENT;
+	fs_leave();
+	fuse_reply_err(req, -res);
+}
+
+void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
+{
+	fs_enter_exclusive();
+	char *from = ll_child_path(parent, name);
+	char *to = ll_child_path(newparent, newname);
+	int res = from != NULL && to != NULL ? myrename(from, to) : -ENOENT;
+	fs_leave();
+	fuse_reply_err(req, -res);
+}
+
+STATS_LL_OP(timed_ll_lookup, OP_LOOKUP, ll_lookup, (fuse_req_t req, fuse_ino_t parent, const char *name), (req, parent, name), (parent, name, 0, NULL), (NULL, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_forget, OP_FORGET, ll_forget, (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup), (req, ino, nlookup), (ino, NULL, 0, NULL), (NULL, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_setattr, OP_TRUNCATE, ll_setattr, (fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi), (req, ino, attr, to_set, fi), (ino, NULL, 0, NULL), (fi, attr->st_size, 0, 0, to_set))
+STATS_LL_OP(timed_ll_getattr, OP_GETATTR, ll_getattr, (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi), (req, ino, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_readdir, OP_READDIR, ll_readdir, (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi), (req, ino, size, off, fi), (ino, NULL, 0, NULL), (fi, off, size, 0, 0))
+STATS_LL_OP(timed_ll_open, OP_OPEN, ll_open, (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi), (req, ino, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, fi->flags))
+STATS_LL_OP(timed_ll_release, OP_RELEASE, ll_release, (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi), (req, ino, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_flush, OP_FLUSH, ll_flush, (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi), (req, ino, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_fsync, OP_FSYNC, ll_fsync, (fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi), (req, ino, datasync, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, datasync))
+STATS_LL_OP(timed_ll_fsyncdir, OP_FSYNCDIR, ll_fsync, (fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi), (req, ino, datasync, fi), (ino, NULL, 0, NULL), (fi, 0, 0, 0, datasync))
+STATS_LL_OP(timed_ll_read, OP_READ, ll_read, (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi), (req, ino, size, off, fi), (ino, NULL, 0, NULL), (fi, off, size, 0, 0))
+STATS_LL_OP(timed_ll_write, OP_WRITE, ll_write, (fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi), (req, ino, buf, size, off, fi), (ino, NULL, 0, NULL), (fi, off, size, 0, 0))
+STATS_LL_OP(timed_ll_mkdir, OP_MKDIR, ll_mkdir, (fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode), (req, parent, name, mode), (parent, name, 0, NULL), (NULL, 0, 0, mode, 0))
+STATS_LL_OP(timed_ll_create, OP_CREATE, ll_create, (fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi), (req, parent, name, mode, fi), (parent, name, 0, NULL), (fi, 0, 0, mode, fi->flags))
+STATS_LL_OP(timed_ll_unlink, OP_UNLINK, ll_unlink, (fuse_req_t req, fuse_ino_t parent, const char *name), (req, parent, name), (parent, name, 0, NULL), (NULL, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_rmdir, OP_RMDIR, ll_rmdir, (fuse_req_t req, fuse_ino_t parent, const char *name), (req, parent, name), (parent, name, 0, NULL), (NULL, 0, 0, 0, 0))
+STATS_LL_OP(timed_ll_rename, OP_RENAME, ll_rename, (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname), (req, parent, name, newparent, newname), (parent, name, newparent, newname), (NULL, 0, 0, 0, 0))
+
+static struct fuse_lowlevel_ops ll_operations =
+{
+    .lookup = timed_ll_lookup,     // 在父目录中按名称查找
+    .forget = timed_ll_forget,     // 内核归还 lookup 引用
+    .getattr = timed_ll_getattr,   // 获取属性
+    .setattr = timed_ll_setattr,   // 修改大小
+    .readdir = timed_ll_readdir,   // 读取目录内容
+    .open = timed_ll_open,         // 打开文件
+    .release = timed_ll_release,   // 关闭文件
+    .flush = timed_ll_flush,       // close 时调用
+    .fsync = timed_ll_fsync,       // 持久化文件
+    .fsyncdir = timed_ll_fsyncdir, // 持久化目录
+    .read = timed_ll_read,         // 读取文件内容
+    .write = timed_ll_write,       // 写入文件内容
+    .mkdir = timed_ll_mkdir,       // 创建目录
+    .create = timed_ll_create,     // 创建文件
+    .unlink = timed_ll_unlink,     // 删除文件
+    .rmdir = timed_ll_rmdir,       // 删除目录
+    .rename = timed_ll_rename,     // 重命名文件/目录
+    .init = ll_init,               // 启动日志线程和写回线程
+    .destroy = mydestroy,          // 卸载时做检查点
+};
 
-		// 初始化子节点索引
-		int child_startindex = 1;
-		// 设置根节点的父节点为 NULL
-		file_array[0].parent = NULL;
+/*
+ * lowlevel_main - 以低层接口挂载并运行会话循环
+ *
+ * 返回值：
+ * - 正常卸载返回 0，否则返回 1。
+ */
+int lowlevel_main(struct fuse_args *args)
+{
+	struct fuse_chan *ch;
+	char *mountpoint;
+	int multithreaded, foreground;
+	int err = -1;
 
-		// 遍历前 6 个节点，在内存中重建文件树结构
-		for (int i = 0; i < 6; i++)
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) != -1 &&
+		(ch = fuse_mount(mountpoint, args)) != NULL)
+	{
+		struct fuse_session *se = fuse_lowlevel_new(args, &ll_operations, sizeof(ll_operations), NULL);
+		if (se != NULL)
 		{
-			file_array[i].num_children = 0;
-			file_array[i].children = NULL;
-			// 为每个节点添加子节点
-			for (int j = child_startindex; j < child_startindex + 5; j++)
+			if (fuse_set_signal_handlers(se) != -1)
 			{
-				if (file_array[j].valid)
-				{
-					add_child(&file_array[i], &file_array[j]);
-				}
+				fuse_session_add_chan(se, ch);
+				fuse_daemonize(foreground);
+				err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
 			}
-			child_startindex += 5;
+			fuse_session_destroy(se);
 		}
+		fuse_unmount(mountpoint, ch);
+	}
+	return err ? 1 : 0;
+}
+
+/*
+ * main - 解析挂载选项，加载或初始化文件系统，然后交给 FUSE
+ *
+ * 注意：
+ * - 定义 FS_NO_MAIN 时不编译 main，其他程序可以直接包含本文件调用回调（见 bench.c）。
+ */
+#ifndef FS_NO_MAIN
+static struct fuse_opt fs_opts[] =
+{
+    {"lowlevel", offsetof(struct fs_config, lowlevel), 1},
+    {"blocks=%lu", offsetof(struct fs_config, blocks), 0},
+    {"inodes=%lu", offsetof(struct fs_config, inodes), 0},
+    {"readahead=%lu", offsetof(struct fs_config, readahead), 0},
+    {"cache=%lu", offsetof(struct fs_config, cache), 0},
+    {"flush_interval=%lu", offsetof(struct fs_config, flush_interval), 0},
+    {"dirty_ratio=%lu", offsetof(struct fs_config, dirty_ratio), 0},
+    {"trace=%s", offsetof(struct fs_config, trace), 0},
+    FUSE_OPT_END
+};
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	int ret;
 
-		// 设置根节点
-		root = &file_array[0];
+	// 先取出本文件系统自己的挂载选项，其余参数原样交给 FUSE
+	if (fuse_opt_parse(&args, &fs_config, fs_opts, NULL) == -1)
+		return 1;
+	if (fs_config.trace != NULL && trace_open(fs_config.trace) != 0)
+		return 1;
+	cache_init();
 
-		// 打开并读取超级块数据
-		FILE *fd1 = fopen("super.bin", "rb");
-		fread(&spblock, sizeof(superblock), 1, fd1);
+	// 二进制文件代表了基于磁盘的文件系统（file layout)
+	FILE *fd = fopen("file_structure.bin", "rb");
+	// 修改记录先追加到日志，检查点之后的部分在加载完成后重放
+	journal_open();
+	if (fd)
+	{
+		log_info("LOADING\n");
+		// 先读入超级块和位图，extent 较多的文件需要从数据块中读取 extent
+		if (load_superblock() != 0)
+			exit(1);
+
+		// 如果文件存在，按 inode 表重建文件树
+		if (load_contents(fd) != 0)
+			exit(1);
+		fclose(fd);
+
+		// 重放检查点之后的日志
+		journal_replay();
 	}
 	else
 	{
-		// 如果文件不存在，初始化超级块和根目录
-		initialize_superblock();
+		// 如果文件不存在，初始化超级块和根目录，旧日志不再适用
+		if (initialize_superblock() != 0)
+			exit(1);
 		initialize_root_directory();
+		if (ftruncate(journal_fd, 0) != 0)
+			perror("journal truncate");
 	}
 
+	// 加载阶段的日志在转入后台之前输出
+	log_flush();
+
 	// FUSE 库的主入口函数，用于启动文件系统, 指向 fuse_operations 结构体的指针
-	return fuse_main(argc, argv, &operations, NULL);
-}
\ No newline at end of file
+	if (fs_config.lowlevel)
+		ret = lowlevel_main(&args);
+	else
+		ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	fuse_opt_free_args(&args);
+	return ret;
+}
+#endif
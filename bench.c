@@ -0,0 +1,479 @@
+/*
+ * bench.c - 不挂载的进程内基准测试
+ *
+ * 功能：
+ * 1. 直接包含 FS.c（定义 FS_NO_MAIN 去掉它的 main），通过 operations 表调用回调，
+ *    不经过内核和 FUSE 通信，测得的是文件系统自身的开销。
+ * 2. 运行一组合成负载，输出每种负载的操作数、耗时、吞吐量和单次操作的延迟分布。
+ *
+ * 负载：
+ * - create:   每个线程在自己的目录下连续创建 -n 个文件。
+ * - getattr:  在深度为 -D 的目录下准备 1000 个文件，随机对它们 getattr -n 次。
+ * - seqwrite: 每个线程以 -c 大小的块顺序写一个 -s 大小的文件。
+ * - seqread:  顺序读 seqwrite 写出的文件。
+ * - randread / randwrite: 在同一个文件中按块对齐的随机位置读写 -n 次。
+ *
+ * 编译：
+ * gcc -O2 bench.c -o bench `pkg-config fuse --cflags --libs`
+ *
+ * 示例：
+ * ./bench                          运行全部负载
+ * ./bench -w create,getattr -t 4   4 个线程运行 create 和 getattr
+ * ./bench -w seqwrite,randread -s 256 -c 4
+ *
+ * 注意：
+ * - 在 -d 指定的目录（默认新建的临时目录）中创建 fs.img、file_structure.bin 和 journal.bin，
+ *   结束后删除。
+ * - 同一次运行中的负载按上面的顺序执行，后面的负载使用前面留下的文件系统状态；
+ *   单独运行读负载时先（不计时）写出需要的文件。
+ * - 输出的耗时不包括准备阶段（建立 getattr 的目录、写出读负载的文件）。
+ * - 随机位置由 -S 指定的种子生成，相同参数的两次运行执行相同的操作序列。
+ */
+#define FS_NO_MAIN
+// 基准测试只输出警告和错误，避免 SAVING 等日志混入结果
+#define LOG_LEVEL 1
+#include "FS.c"
+
+#include <getopt.h>
+
+#define BENCH_MAX_THREADS 64
+#define GETATTR_FILES 1000
+
+struct
+{
+	long count;			  // create / getattr / 随机读写的操作数
+	int threads;		  // 线程数
+	long file_mb;		  // 顺序读写的文件大小（MB）
+	long chunk_kb;		  // 每次读写的大小（KB）
+	int depth;			  // getattr 的目录深度
+	unsigned seed;		  // 随机种子
+	const char *dir;	  // 工作目录
+	const char *workload; // 要运行的负载，逗号分隔
+	int stats;			  // 结束时输出 /.fsstats
+} bench = {100000, 1, 64, 64, 16, 1, NULL, "create,getattr,seqwrite,seqread,randread,randwrite", 0};
+
+typedef struct bench_thread
+{
+	int id;
+	pthread_t tid;
+	unsigned seed;
+	uint64_t ops;				  // 完成的操作数
+	uint64_t bytes;				  // 读写的字节数
+	uint64_t max_ns;			  // 单次操作的最大耗时
+	uint64_t hist[HIST_BUCKETS]; // 单次操作的延迟直方图，分桶方式与 /.fsstats 相同
+	char *buf;					  // 读写缓冲区
+	int ready;					  // 本线程的读写文件是否已经准备好
+} bench_thread;
+
+typedef struct workload
+{
+	const char *name;
+	void (*setup)(bench_thread *t); // 计时之前的准备，可以为 NULL
+	void (*run)(bench_thread *t);
+} workload;
+
+void bench_fail(const char *what, const char *path, int res)
+{
+	fprintf(stderr, "%s %s: %s\n", what, path, strerror(-res));
+	exit(1);
+}
+
+void bench_op_done(bench_thread *t, uint64_t start, size_t bytes)
+{
+	uint64_t ns = stats_now() - start;
+
+	t->hist[hist_bucket(ns)]++;
+	if (ns > t->max_ns)
+		t->max_ns = ns;
+	t->ops++;
+	t->bytes += bytes;
+}
+
+/*
+ * setup_file - 准备读负载使用的文件：seqwrite 没有运行过时写满 -s 大小
+ */
+void setup_file(bench_thread *t)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	size_t chunk = bench.chunk_kb * 1024;
+	off_t file_size = (off_t)bench.file_mb * 1024 * 1024;
+
+	snprintf(path, sizeof(path), "/t%d/data", t->id);
+	if (t->ready)
+		return;
+
+	memset(&fi, 0, sizeof(fi));
+	int res = operations.create(path, 0644, &fi);
+	if (res != 0)
+		bench_fail("create", path, res);
+	for (off_t off = 0; off < file_size; off += chunk)
+	{
+		if ((res = operations.write(path, t->buf, chunk, off, &fi)) < 0)
+			bench_fail("write", path, res);
+	}
+	operations.release(path, &fi);
+	t->ready = 1;
+}
+
+void run_create(bench_thread *t)
+{
+	char path[64];
+	struct fuse_file_info fi;
+
+	for (long i = 0; i < bench.count; i++)
+	{
+		snprintf(path, sizeof(path), "/t%d/f%ld", t->id, i);
+		memset(&fi, 0, sizeof(fi));
+
+		uint64_t start = stats_now();
+		int res = operations.create(path, 0644, &fi);
+		if (res != 0)
+			bench_fail("create", path, res);
+		operations.release(path, &fi);
+		bench_op_done(t, start, 0);
+	}
+}
+
+/*
+ * getattr_dir - getattr 负载的目录：/t<id>/deep 之下再嵌套 depth - 1 层 "d"
+ */
+void getattr_dir(bench_thread *t, char *dir, size_t size)
+{
+	int len = snprintf(dir, size, "/t%d/deep", t->id);
+
+	for (int i = 1; i < bench.depth; i++)
+		len += snprintf(dir + len, size - len, "/d");
+}
+
+// 逐层建立目录，最深一层放 GETATTR_FILES 个文件
+void setup_getattr(bench_thread *t)
+{
+	char dir[100], path[128]; // path = dir + "/f<n>"
+	struct fuse_file_info fi;
+	int len = snprintf(dir, sizeof(dir), "/t%d/deep", t->id);
+
+	operations.mkdir(dir, 0755);
+	for (int i = 1; i < bench.depth; i++)
+	{
+		len += snprintf(dir + len, sizeof(dir) - len, "/d");
+		operations.mkdir(dir, 0755);
+	}
+	for (int i = 0; i < GETATTR_FILES; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		memset(&fi, 0, sizeof(fi));
+		if (operations.create(path, 0644, &fi) == 0)
+			operations.release(path, &fi);
+	}
+}
+
+void run_getattr(bench_thread *t)
+{
+	char dir[100], path[128]; // path = dir + "/f<n>"
+	struct stat st;
+
+	getattr_dir(t, dir, sizeof(dir));
+	for (long i = 0; i < bench.count; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%d", dir, rand_r(&t->seed) % GETATTR_FILES);
+
+		uint64_t start = stats_now();
+		int res = operations.getattr(path, &st);
+		if (res != 0)
+			bench_fail("getattr", path, res);
+		bench_op_done(t, start, 0);
+	}
+}
+
+void run_seqwrite(bench_thread *t)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	size_t chunk = bench.chunk_kb * 1024;
+	off_t file_size = (off_t)bench.file_mb * 1024 * 1024;
+
+	snprintf(path, sizeof(path), "/t%d/data", t->id);
+	memset(&fi, 0, sizeof(fi));
+	int res = t->ready ? operations.open(path, &fi) : operations.create(path, 0644, &fi);
+	if (res != 0)
+		bench_fail("open", path, res);
+
+	for (off_t off = 0; off < file_size; off += chunk)
+	{
+		uint64_t start = stats_now();
+		if ((res = operations.write(path, t->buf, chunk, off, &fi)) < 0)
+			bench_fail("write", path, res);
+		bench_op_done(t, start, res);
+	}
+	operations.release(path, &fi);
+	t->ready = 1;
+}
+
+void run_seqread(bench_thread *t)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	size_t chunk = bench.chunk_kb * 1024;
+	off_t file_size = (off_t)bench.file_mb * 1024 * 1024;
+
+	snprintf(path, sizeof(path), "/t%d/data", t->id);
+	memset(&fi, 0, sizeof(fi));
+	int res = operations.open(path, &fi);
+	if (res != 0)
+		bench_fail("open", path, res);
+
+	for (off_t off = 0; off < file_size; off += chunk)
+	{
+		uint64_t start = stats_now();
+		if ((res = operations.read(path, t->buf, chunk, off, &fi)) < 0)
+			bench_fail("read", path, res);
+		bench_op_done(t, start, res);
+	}
+	operations.release(path, &fi);
+}
+
+void run_random(bench_thread *t, int write)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	size_t chunk = bench.chunk_kb * 1024;
+	long chunks = (long)bench.file_mb * 1024 / bench.chunk_kb;
+
+	snprintf(path, sizeof(path), "/t%d/data", t->id);
+	memset(&fi, 0, sizeof(fi));
+	int res = operations.open(path, &fi);
+	if (res != 0)
+		bench_fail("open", path, res);
+
+	for (long i = 0; i < bench.count; i++)
+	{
+		off_t off = (off_t)(rand_r(&t->seed) % chunks) * chunk;
+
+		uint64_t start = stats_now();
+		if (write)
+			res = operations.write(path, t->buf, chunk, off, &fi);
+		else
+			res = operations.read(path, t->buf, chunk, off, &fi);
+		if (res < 0)
+			bench_fail(write ? "write" : "read", path, res);
+		bench_op_done(t, start, res);
+	}
+	operations.release(path, &fi);
+}
+
+void run_randread(bench_thread *t)
+{
+	run_random(t, 0);
+}
+
+void run_randwrite(bench_thread *t)
+{
+	run_random(t, 1);
+}
+
+workload workloads[] = {
+	{"create", NULL, run_create},
+	{"getattr", setup_getattr, run_getattr},
+	{"seqwrite", NULL, run_seqwrite},
+	{"seqread", setup_file, run_seqread},
+	{"randread", setup_file, run_randread},
+	{"randwrite", setup_file, run_randwrite},
+};
+
+bench_thread threads[BENCH_MAX_THREADS];
+workload *current;
+int current_setup;
+
+void *bench_worker(void *arg)
+{
+	bench_thread *t = (bench_thread *)arg;
+
+	if (current_setup)
+		current->setup(t);
+	else
+		current->run(t);
+	return NULL;
+}
+
+void run_threads(int setup)
+{
+	current_setup = setup;
+	for (int i = 0; i < bench.threads; i++)
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	for (int i = 0; i < bench.threads; i++)
+		pthread_join(threads[i].tid, NULL);
+}
+
+/*
+ * run_workload - 所有线程先完成准备，再同时运行一种负载，汇总并输出结果
+ */
+void run_workload(workload *w)
+{
+	uint64_t hist[HIST_BUCKETS] = {0}, ops = 0, bytes = 0, max_ns = 0;
+
+	current = w;
+	for (int i = 0; i < bench.threads; i++)
+	{
+		threads[i].ops = threads[i].bytes = threads[i].max_ns = 0;
+		memset(threads[i].hist, 0, sizeof(threads[i].hist));
+	}
+
+	if (w->setup != NULL)
+		run_threads(1);
+
+	uint64_t start = stats_now();
+	run_threads(0);
+	double seconds = (stats_now() - start) / 1e9;
+
+	for (int i = 0; i < bench.threads; i++)
+	{
+		ops += threads[i].ops;
+		bytes += threads[i].bytes;
+		if (threads[i].max_ns > max_ns)
+			max_ns = threads[i].max_ns;
+		for (int b = 0; b < HIST_BUCKETS; b++)
+			hist[b] += threads[i].hist[b];
+	}
+
+	printf("%-10s %7d %9llu %9.3f %11.1f %9.1f %9.3f %9.3f %9.3f\n", w->name, bench.threads, (unsigned long long)ops, seconds,
+		   ops / seconds, bytes / seconds / (1024 * 1024),
+		   hist_percentile(hist, ops, max_ns, 0.5) / 1000.0,
+		   hist_percentile(hist, ops, max_ns, 0.99) / 1000.0,
+		   max_ns / 1000.0);
+	fflush(stdout);
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [-w workloads] [-n count] [-t threads] [-s file_mb] [-c chunk_kb]\n"
+			"          [-D depth] [-S seed] [-d dir] [-b blocks] [-i inodes] [-m cache_mb] [-x] [-h]\n"
+			"workloads: create,getattr,seqwrite,seqread,randread,randwrite (default: all)\n"
+			"-x: print /.fsstats at the end\n",
+			prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	char tmpdir[] = "/tmp/fsbench.XXXXXX";
+	int opt;
+
+	fs_config.blocks = 1 << 20;
+	fs_config.inodes = 1 << 20;
+	while ((opt = getopt(argc, argv, "w:n:t:s:c:D:S:d:b:i:m:xh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			bench.workload = optarg;
+			break;
+		case 'n':
+			bench.count = atol(optarg);
+			break;
+		case 't':
+			bench.threads = atoi(optarg);
+			break;
+		case 's':
+			bench.file_mb = atol(optarg);
+			break;
+		case 'c':
+			bench.chunk_kb = atol(optarg);
+			break;
+		case 'D':
+			bench.depth = atoi(optarg);
+			break;
+		case 'S':
+			bench.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			bench.dir = optarg;
+			break;
+		case 'b':
+			fs_config.blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			fs_config.inodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			fs_config.cache = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			bench.stats = 1;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (bench.threads < 1 || bench.threads > BENCH_MAX_THREADS || bench.count < 1 || bench.chunk_kb < 1 ||
+		bench.file_mb * 1024 < bench.chunk_kb || bench.depth < 1 || bench.depth > 16)
+		usage(argv[0]);
+
+	if (bench.dir == NULL && (bench.dir = mkdtemp(tmpdir)) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	if (chdir(bench.dir) != 0)
+	{
+		perror(bench.dir);
+		return 1;
+	}
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+
+	// 与 main 中首次挂载的流程相同
+	cache_init();
+	journal_open();
+	if (initialize_superblock() != 0)
+		return 1;
+	initialize_root_directory();
+	if (ftruncate(journal_fd, 0) != 0)
+		perror("journal truncate");
+	operations.init(NULL);
+
+	for (int i = 0; i < bench.threads; i++)
+	{
+		char path[32];
+
+		threads[i].id = i;
+		threads[i].seed = bench.seed + i;
+		threads[i].buf = malloc(bench.chunk_kb * 1024);
+		memset(threads[i].buf, 'a' + i % 26, bench.chunk_kb * 1024);
+		snprintf(path, sizeof(path), "/t%d", i);
+		operations.mkdir(path, 0755);
+	}
+
+	printf("%-10s %7s %9s %9s %11s %9s %9s %9s %9s\n", "workload", "threads", "ops", "seconds", "ops/s", "MB/s", "p50_us", "p99_us", "max_us");
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+	{
+		const char *p = strstr(bench.workload, workloads[i].name);
+		size_t len = strlen(workloads[i].name);
+
+		// 按逗号分隔的完整名称匹配
+		while (p != NULL && ((p != bench.workload && p[-1] != ',') || (p[len] != '\0' && p[len] != ',')))
+			p = strstr(p + 1, workloads[i].name);
+		if (p != NULL)
+			run_workload(&workloads[i]);
+	}
+
+	if (bench.stats)
+	{
+		size_t len;
+		char *text = stats_render(&len);
+		if (text != NULL)
+			fwrite(text, 1, len, stdout);
+		free(text);
+	}
+
+	operations.destroy(NULL);
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+	if (bench.dir == tmpdir)
+		rmdir(tmpdir);
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * check.c - 不挂载的进程内回归检查
+ *
+ * 功能：
+ * 1. 与 bench.c 一样直接包含 FS.c（定义 FS_NO_MAIN 去掉它的 main），通过回调表和内部函数
+ *    检查那些不容易在挂载状态下复现的行为。
+ * 2. 每项检查在单独的子进程和新建的镜像中运行，互不影响；输出每项的结果，有失败时返回 1。
+ *
+ * 检查：
+ * - scan: 读两遍的热点文件经过一次比缓存大得多的顺序扫描（带预读）后仍然全部命中。
+ * - journal: 日志追加失败后 write、flush、fsync 都返回 -EIO，检查点成功之后恢复正常。
+ * - readdir: 像 rm -rf 一样分批读取目录、每读一批就删除这一批，最后目录中的文件全部被删除。
+ * - orphan: file_structure.bin 中从根目录不可达的节点在加载时被释放，编号和数据块归还给位图。
+ *
+ * 编译：
+ * gcc -O2 check.c -o check `pkg-config fuse --cflags --libs`
+ *
+ * 示例：
+ * ./check              运行全部检查
+ * ./check -c scan      只运行 scan
+ *
+ * 注意：
+ * - 在 -d 指定的目录（默认新建的临时目录）中创建镜像文件，结束后删除。
+ * - 注入故障的检查（journal）会输出预期中的错误日志。
+ */
+#define FS_NO_MAIN
+#define LOG_LEVEL 1
+#include "FS.c"
+
+#include <getopt.h>
+#include <sys/wait.h>
+
+// 条件不成立时输出位置并以失败结束当前检查
+#define CHECK(cond)                                                             \
+	do                                                                          \
+	{                                                                           \
+		if (!(cond))                                                            \
+		{                                                                       \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1);                                                            \
+		}                                                                       \
+	} while (0)
+
+typedef struct check
+{
+	const char *name;
+	void (*run)();
+} check;
+
+/*
+ * check_mount - 在当前目录新建镜像并完成初始化，与 main 中首次挂载的流程相同
+ *
+ * 注意：
+ * - 不启动后台线程，检查在准备好数据之后自己调用 operations.init。
+ */
+void check_mount()
+{
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+	cache_init();
+	journal_open();
+	CHECK(initialize_superblock() == 0);
+	initialize_root_directory();
+	CHECK(ftruncate(journal_fd, 0) == 0);
+}
+
+/*
+ * check_remount - 丢弃内存中的文件树，按 main 中再次挂载的流程重新加载并重放日志
+ *
+ * 注意：
+ * - 旧的节点、位图和镜像描述符不释放，检查在子进程中运行，结束时一并回收。
+ */
+void check_remount()
+{
+	FILE *fd;
+
+	cache_init();
+	root = NULL;
+	inode_table = NULL;
+	inode_table_size = 0;
+	dcache_invalidate();
+	CHECK(load_superblock() == 0);
+	CHECK((fd = fopen("file_structure.bin", "rb")) != NULL);
+	CHECK(load_contents(fd) == 0);
+	fclose(fd);
+	journal_replay();
+}
+
+/*
+ * check_write_file - 创建 path 并写入 size 字节的 data
+ */
+void check_write_file(const char *path, const char *data, size_t size)
+{
+	struct fuse_file_info fi;
+
+	memset(&fi, 0, sizeof(fi));
+	CHECK(operations.create(path, 0644, &fi) == 0);
+	for (size_t off = 0; off < size; off += 65536)
+	{
+		size_t n = size - off < 65536 ? size - off : 65536;
+		CHECK(operations.write(path, data + off, n, off, &fi) == (int)n);
+	}
+	operations.release(path, &fi);
+}
+
+/*
+ * check_read_file - 以 4 KB 为单位顺序读 path 并与 data 比较
+ */
+void check_read_file(const char *path, const char *data, size_t size)
+{
+	struct fuse_file_info fi;
+	char buf[4096];
+
+	memset(&fi, 0, sizeof(fi));
+	CHECK(operations.open(path, &fi) == 0);
+	for (size_t off = 0; off < size; off += sizeof(buf))
+	{
+		CHECK(operations.read(path, buf, sizeof(buf), off, &fi) == (int)sizeof(buf));
+		CHECK(memcmp(buf, data + off, sizeof(buf)) == 0);
+	}
+	operations.release(path, &fi);
+}
+
+/*
+ * check_scan - 预读的块不能把热点块挤出缓存
+ *
+ * 实现逻辑：
+ * 1. 1 MB 缓存，512 KB 的热点文件读两遍，进入 T2。
+ * 2. 顺序读 8 MB 的文件，预读的块第一次被读到时只留在 T1。
+ * 3. 再读一遍热点文件，不应该有未命中。
+ */
+void check_scan()
+{
+	size_t hot = 512 * 1024, scan = 8 * 1024 * 1024;
+	char *data = malloc(scan);
+
+	for (size_t i = 0; i < scan; i++)
+		data[i] = (char)(i * 13 + (i >> 11));
+	fs_config.cache = 1;
+	fs_config.readahead = 256;
+	check_mount();
+	check_write_file("/hot", data, hot);
+	check_write_file("/scan", data, scan);
+	// 写回后清空缓存，相当于重新挂载后的冷缓存
+	CHECK(cache_flush() == 0);
+	cache_init();
+	operations.init(NULL);
+
+	check_read_file("/hot", data, hot);
+	check_read_file("/hot", data, hot);
+	check_read_file("/scan", data, scan);
+	// 关掉预读再读，未命中数才反映热点块是否还在缓存中
+	fs_config.readahead = 0;
+	unsigned long misses = cache.misses;
+	check_read_file("/hot", data, hot);
+	CHECK(cache.misses == misses);
+
+	operations.destroy(NULL);
+	free(data);
+}
+
+/*
+ * check_journal - 追加日志失败的修改不能被 fsync 当作已经持久
+ *
+ * 实现逻辑：
+ * 1. 把日志和镜像换成只读的描述符：追加失败，随后的检查点写回脏块也失败。
+ * 2. 失败的 write 返回 -EIO；之后的修改、flush 和 fsync 都返回 -EIO。
+ * 3. 换回原来的描述符，下一个回调重试检查点，成功后一切恢复正常。
+ */
+void check_journal()
+{
+	struct fuse_file_info fi;
+	char buf[8];
+
+	check_mount();
+	memset(&fi, 0, sizeof(fi));
+	CHECK(operations.create("/f", 0644, &fi) == 0);
+	CHECK(operations.write("/f", "a", 1, 0, &fi) == 1);
+
+	int good_journal = journal_fd, good_image = image_fd;
+	journal_fd = open("journal.bin", O_RDONLY);
+	image_fd = open("fs.img", O_RDONLY);
+	CHECK(operations.write("/f", "hello", 5, 0, &fi) == -EIO);
+	CHECK(operations.fsync("/f", 0, &fi) == -EIO);
+	CHECK(operations.flush("/f", &fi) == -EIO);
+	CHECK(operations.mkdir("/d", 0755) == -EIO);
+	CHECK(operations.fsync("/f", 0, &fi) == -EIO);
+
+	close(journal_fd);
+	close(image_fd);
+	journal_fd = good_journal;
+	image_fd = good_image;
+	// 这一次仍然被拒绝，它结束时的检查点成功之后才恢复
+	CHECK(operations.mkdir("/d", 0755) == -EIO);
+	CHECK(operations.fsync("/f", 0, &fi) == 0);
+	CHECK(operations.mkdir("/d", 0755) == 0);
+	CHECK(operations.read("/f", buf, 5, 0, &fi) == 5);
+	CHECK(memcmp(buf, "hello", 5) == 0);
+	operations.release("/f", &fi);
+}
+
+// 与 fuse_kernel.h 中的 struct fuse_dirent 相同，fuse_add_direntry 按这个格式填写目录项
+struct check_dirent
+{
+	uint64_t ino;
+	uint64_t off;
+	uint32_t namelen;
+	uint32_t type;
+	char name[];
+};
+
+/*
+ * check_readdir - 一边分批读目录一边删除，不能漏掉目录项
+ *
+ * 实现逻辑：
+ * 1. 在 /d 中创建 100 个文件。
+ * 2. 每次用 512 字节的缓冲区从上一批最后一项的偏移量继续读（node_readdir，与 ll_readdir 相同），
+ *    读到的文件在下一次读之前全部删除。
+ * 3. 读完之后目录应当为空。
+ */
+void check_readdir()
+{
+	char buf[512], path[64];
+	off_t off = 0;
+	int removed = 0;
+
+	check_mount();
+	CHECK(operations.mkdir("/d", 0755) == 0);
+	for (int i = 0; i < 100; i++)
+	{
+		struct fuse_file_info fi;
+
+		snprintf(path, sizeof(path), "/d/file%d", i);
+		memset(&fi, 0, sizeof(fi));
+		CHECK(operations.create(path, 0644, &fi) == 0);
+		operations.release(path, &fi);
+	}
+
+	for (;;)
+	{
+		fs_enter();
+		size_t used = node_readdir(NULL, filetype_from_path("/d"), buf, sizeof(buf), off);
+		fs_leave();
+		if (used == 0)
+			break;
+
+		for (size_t pos = 0; pos < used;)
+		{
+			struct check_dirent *d = (struct check_dirent *)(buf + pos);
+
+			off = d->off;
+			pos += (sizeof(*d) + d->namelen + 7) & ~(size_t)7;
+			if ((d->namelen == 1 && d->name[0] == '.') || (d->namelen == 2 && memcmp(d->name, "..", 2) == 0))
+				continue;
+			snprintf(path, sizeof(path), "/d/%.*s", (int)d->namelen, d->name);
+			CHECK(operations.unlink(path) == 0);
+			removed++;
+		}
+	}
+	CHECK(removed == 100);
+	CHECK(operations.rmdir("/d") == 0);
+}
+
+/*
+ * check_orphan - 加载时释放从根目录不可达的节点
+ *
+ * 实现逻辑：
+ * 1. 创建 /d/f（写入 64 KB）和 /keep，做一次检查点。
+ * 2. 把 file_structure.bin 中 /d 的父目录改成 /keep（一个文件），/d 和 /d/f 从根目录不可达。
+ * 3. 重新加载之后两个节点的编号和数据块都被归还，记录被清零；再加载一次，结果不变。
+ */
+void check_orphan()
+{
+	char data[65536];
+	disk_inode rec;
+	int fd;
+
+	memset(data, 'o', sizeof(data));
+	check_mount();
+	CHECK(operations.mkdir("/d", 0755) == 0);
+	check_write_file("/d/f", data, sizeof(data));
+	check_write_file("/keep", "k", 1);
+	fs_enter_exclusive();
+	CHECK(journal_checkpoint() == 0);
+	fs_leave();
+
+	int dir = filetype_from_path("/d")->number, file = filetype_from_path("/d/f")->number;
+	uint32_t keep = filetype_from_path("/keep")->number;
+	unsigned long free_inodes = spblock.free_inodes, free_blocks = spblock.free_blocks;
+	off_t pos = sizeof(meta_header) + (off_t)dir * sizeof(disk_inode);
+
+	CHECK((fd = open("file_structure.bin", O_RDWR)) >= 0);
+	CHECK(pread(fd, &rec, sizeof(rec), pos) == sizeof(rec));
+	rec.parent = keep;
+	CHECK(pwrite(fd, &rec, sizeof(rec), pos) == sizeof(rec));
+	close(fd);
+
+	// 加载之后的检查点把归还的编号和数据块落盘
+	check_remount();
+	CHECK(filetype_from_path("/d") == NULL && filetype_from_path("/keep") != NULL);
+	CHECK(!bitmap_test(inode_bitmap, dir) && !bitmap_test(inode_bitmap, file));
+	CHECK(spblock.free_inodes == free_inodes + 2);
+	CHECK(spblock.free_blocks >= free_blocks + sizeof(data) / block_size);
+
+	check_remount();
+	CHECK(spblock.free_inodes == free_inodes + 2);
+	CHECK(spblock.free_blocks >= free_blocks + sizeof(data) / block_size);
+	CHECK((fd = open("file_structure.bin", O_RDONLY)) >= 0);
+	CHECK(pread(fd, &rec, sizeof(rec), pos) == sizeof(rec) && !rec.valid);
+	close(fd);
+}
+
+check checks[] = {
+	{"scan", check_scan},
+	{"journal", check_journal},
+	{"readdir", check_readdir},
+	{"orphan", check_orphan},
+};
+
+/*
+ * run_check - 在子进程中运行一项检查，返回是否通过
+ */
+int run_check(check *c)
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid < 0)
+	{
+		perror("fork");
+		return 0;
+	}
+	if (pid == 0)
+	{
+		c->run();
+		exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid)
+		return 0;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-c checks] [-d dir] [-h]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	char tmpdir[] = "/tmp/fscheck.XXXXXX";
+	const char *names = NULL, *dir = NULL;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "c:d:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			names = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (dir == NULL && (dir = mkdtemp(tmpdir)) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	if (chdir(dir) != 0)
+	{
+		perror(dir);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+	{
+		const char *p = names ? strstr(names, checks[i].name) : NULL;
+		size_t len = strlen(checks[i].name);
+
+		// 按逗号分隔的完整名称匹配
+		while (p != NULL && ((p != names && p[-1] != ',') || (p[len] != '\0' && p[len] != ',')))
+			p = strstr(p + 1, checks[i].name);
+		if (names != NULL && p == NULL)
+			continue;
+		int ok = run_check(&checks[i]);
+		printf("%-10s %s\n", checks[i].name, ok ? "ok" : "FAIL");
+		fflush(stdout);
+		failed |= !ok;
+	}
+
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+	if (dir == tmpdir)
+		rmdir(tmpdir);
+	return failed;
+}
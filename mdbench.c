@@ -0,0 +1,563 @@
+/*
+ * mdbench.c - 挂载后的元数据基准测试（类似 mdtest）
+ *
+ * 功能：
+ * 1. 在临时目录中启动 FS（前台模式）并挂载到临时挂载点，通过普通的系统调用访问，
+ *    测得的是包括内核和 FUSE 通信在内的端到端开销。
+ * 2. 每个线程在自己的子树中依次运行以下阶段，阶段之间所有线程同步：
+ *    - mkdir:   建立目录树。
+ *    - create:  在每个目录中创建 -I 个文件（open(O_CREAT) + close）。
+ *    - stat:    stat 每个文件。
+ *    - readdir: 列出每个目录。
+ *    - unlink:  删除每个文件。
+ *    - rmdir:   自底向上删除目录树。
+ * 3. 输出每个阶段的操作数、耗时、吞吐量和延迟分位数；-t 给出多个线程数时依次运行。
+ *
+ * 目录树：
+ * - -z 为深度，-b 为每个目录的子目录数。
+ *   宽树：-b 100 -z 1，每个线程 1 + 100 个目录；深树：-b 1 -z 20，每个线程一条 21 层的链。
+ *
+ * 编译：
+ * gcc -O2 mdbench.c -o mdbench -lpthread
+ *
+ * 示例：
+ * ./mdbench -x ./FS -t 1,2,4,8
+ * ./mdbench -x ./FS -b 1 -z 20 -I 50 -o lowlevel
+ *
+ * 注意：
+ * - FS 在临时目录中运行，镜像文件和日志输出（fs.log）结束后连同挂载点一起删除。
+ * - 需要能够执行 fusermount -u 卸载。
+ * - FS 不限制路径长度（单个名称最长 255 字节），-z 最大为 64；-b 大于 1 时目录数随深度指数增长。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_THREADS 256
+#define MOUNT_TIMEOUT_MS 10000
+
+// 与 FS.c 的 /.fsstats 相同的对数-线性分桶：每个 2 的幂区间 16 个桶
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+enum
+{
+	PHASE_MKDIR,
+	PHASE_CREATE,
+	PHASE_STAT,
+	PHASE_READDIR,
+	PHASE_UNLINK,
+	PHASE_RMDIR,
+	PHASE_COUNT
+};
+
+const char *phase_names[PHASE_COUNT] = {"mkdir", "create", "stat", "readdir", "unlink", "rmdir"};
+
+struct
+{
+	const char *fs_path;  // FS 可执行文件
+	const char *fs_opts;  // 传给 FS 的 -o 选项
+	const char *threads;  // 逗号分隔的线程数
+	int branch;			  // 每个目录的子目录数
+	int depth;			  // 目录树深度
+	int items;			  // 每个目录中的文件数
+	int keep;			  // 保留临时目录
+} md = {"./FS", NULL, "1", 10, 2, 100, 0};
+
+char workdir[PATH_MAX]; // 临时目录，FS 在其中运行
+char mountpoint[PATH_MAX];
+pid_t fs_pid = -1;
+
+typedef struct md_thread
+{
+	int id;
+	pthread_t tid;
+	char root[PATH_MAX];				 // 本线程的子树
+	uint64_t ops[PHASE_COUNT];			 // 每个阶段完成的操作数
+	uint64_t max_ns[PHASE_COUNT];		 // 每个阶段单次操作的最大耗时
+	uint64_t hist[PHASE_COUNT][HIST_BUCKETS]; // 每个阶段的延迟直方图
+} md_thread;
+
+md_thread *threads;
+int nthreads;
+char **dirs; // 子树中的目录（相对路径），父目录在前
+int ndirs;
+pthread_barrier_t barrier;
+
+uint64_t now_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int hist_bucket(uint64_t ns)
+{
+	if (ns < HIST_SUB)
+		return ns;
+	if (ns >> HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+
+	int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+	return shift * HIST_SUB + (int)(ns >> shift);
+}
+
+uint64_t hist_bucket_high(int bucket)
+{
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	int shift = bucket / HIST_SUB - 1;
+	uint64_t sub = bucket - shift * HIST_SUB;
+	return ((sub + 1) << shift) - 1;
+}
+
+uint64_t hist_percentile(const uint64_t *hist, uint64_t count, uint64_t max, double p)
+{
+	uint64_t target = (uint64_t)(p * count + 0.5), seen = 0;
+
+	if (target == 0)
+		target = 1;
+	for (int b = 0; b < HIST_BUCKETS; b++)
+	{
+		seen += hist[b];
+		if (seen >= target)
+			return hist_bucket_high(b) < max ? hist_bucket_high(b) : max;
+	}
+	return max;
+}
+
+void op_done(md_thread *t, int phase, uint64_t start)
+{
+	uint64_t ns = now_ns() - start;
+
+	t->hist[phase][hist_bucket(ns)]++;
+	if (ns > t->max_ns[phase])
+		t->max_ns[phase] = ns;
+	t->ops[phase]++;
+}
+
+/*
+ * md_fail - 操作失败时退出，挂载点由 atexit 注册的 cleanup 卸载
+ */
+void md_fail(const char *what, const char *path)
+{
+	fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+	exit(1);
+}
+
+/*
+ * md_path - 格式化路径，缓冲区放不下时退出，不用截断的路径继续测试
+ */
+void md_path(char *path, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(path, size, fmt, ap);
+	va_end(ap);
+	if (len < 0 || (size_t)len >= size)
+	{
+		fprintf(stderr, "path too long: %s...\n", path);
+		exit(1);
+	}
+}
+
+/*
+ * build_tree - 按 -b / -z 生成子树中所有目录的相对路径（广度优先，父目录在前）
+ */
+void build_tree()
+{
+	int level_start = 0, level_end = 1;
+
+	ndirs = 1;
+	for (int d = 0, width = 1; d < md.depth; d++)
+	{
+		width *= md.branch;
+		ndirs += width;
+	}
+	dirs = calloc(ndirs, sizeof(char *));
+	dirs[0] = strdup("");
+
+	int n = 1;
+	for (int d = 0; d < md.depth; d++)
+	{
+		for (int i = level_start; i < level_end; i++)
+		{
+			for (int b = 0; b < md.branch; b++)
+			{
+				char path[PATH_MAX];
+				md_path(path, sizeof(path), "%s/d%d", dirs[i], b);
+				dirs[n++] = strdup(path);
+			}
+		}
+		level_start = level_end;
+		level_end = n;
+	}
+}
+
+void run_phase(md_thread *t, int phase)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	switch (phase)
+	{
+	case PHASE_MKDIR:
+		for (int i = 0; i < ndirs; i++)
+		{
+			md_path(path, sizeof(path), "%s%s", t->root, dirs[i]);
+			uint64_t start = now_ns();
+			if (mkdir(path, 0755) != 0)
+				md_fail("mkdir", path);
+			op_done(t, phase, start);
+		}
+		break;
+	case PHASE_CREATE:
+	case PHASE_STAT:
+	case PHASE_UNLINK:
+		for (int i = 0; i < ndirs; i++)
+		{
+			for (int j = 0; j < md.items; j++)
+			{
+				md_path(path, sizeof(path), "%s%s/f%d", t->root, dirs[i], j);
+				uint64_t start = now_ns();
+				if (phase == PHASE_CREATE)
+				{
+					int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+					if (fd < 0)
+						md_fail("create", path);
+					close(fd);
+				}
+				else if (phase == PHASE_STAT)
+				{
+					if (stat(path, &st) != 0)
+						md_fail("stat", path);
+				}
+				else if (unlink(path) != 0)
+					md_fail("unlink", path);
+				op_done(t, phase, start);
+			}
+		}
+		break;
+	case PHASE_READDIR:
+		for (int i = 0; i < ndirs; i++)
+		{
+			md_path(path, sizeof(path), "%s%s", t->root, dirs[i]);
+			uint64_t start = now_ns();
+			DIR *dir = opendir(path);
+			if (dir == NULL)
+				md_fail("opendir", path);
+			while (readdir(dir) != NULL)
+				;
+			closedir(dir);
+			op_done(t, phase, start);
+		}
+		break;
+	case PHASE_RMDIR:
+		for (int i = ndirs - 1; i >= 0; i--)
+		{
+			md_path(path, sizeof(path), "%s%s", t->root, dirs[i]);
+			uint64_t start = now_ns();
+			if (rmdir(path) != 0)
+				md_fail("rmdir", path);
+			op_done(t, phase, start);
+		}
+		break;
+	}
+}
+
+void *md_worker(void *arg)
+{
+	md_thread *t = (md_thread *)arg;
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		pthread_barrier_wait(&barrier);
+		run_phase(t, phase);
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+/*
+ * run_suite - 用 n 个线程运行全部阶段，每个阶段的耗时从所有线程开始到最后一个线程结束
+ */
+void run_suite(int n, int round)
+{
+	uint64_t elapsed[PHASE_COUNT];
+
+	nthreads = n;
+	threads = calloc(n, sizeof(md_thread));
+	pthread_barrier_init(&barrier, NULL, n + 1);
+	for (int i = 0; i < n; i++)
+	{
+		threads[i].id = i;
+		md_path(threads[i].root, sizeof(threads[i].root), "%s/r%d.t%d", mountpoint, round, i);
+		pthread_create(&threads[i].tid, NULL, md_worker, &threads[i]);
+	}
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		pthread_barrier_wait(&barrier);
+		uint64_t start = now_ns();
+		pthread_barrier_wait(&barrier);
+		elapsed[phase] = now_ns() - start;
+	}
+	for (int i = 0; i < n; i++)
+		pthread_join(threads[i].tid, NULL);
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		static uint64_t hist[HIST_BUCKETS];
+		uint64_t ops = 0, max_ns = 0;
+
+		memset(hist, 0, sizeof(hist));
+		for (int i = 0; i < n; i++)
+		{
+			ops += threads[i].ops[phase];
+			if (threads[i].max_ns[phase] > max_ns)
+				max_ns = threads[i].max_ns[phase];
+			for (int b = 0; b < HIST_BUCKETS; b++)
+				hist[b] += threads[i].hist[phase][b];
+		}
+
+		double seconds = elapsed[phase] / 1e9;
+		printf("%7d %-8s %9llu %9.3f %11.1f %9.3f %9.3f %9.3f %9.3f\n", n, phase_names[phase], (unsigned long long)ops, seconds,
+			   ops / seconds,
+			   hist_percentile(hist, ops, max_ns, 0.5) / 1000.0,
+			   hist_percentile(hist, ops, max_ns, 0.9) / 1000.0,
+			   hist_percentile(hist, ops, max_ns, 0.99) / 1000.0,
+			   max_ns / 1000.0);
+	}
+	fflush(stdout);
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+}
+
+/*
+ * run_command - 执行命令并等待结束，返回退出码
+ */
+int run_command(char *const argv[])
+{
+	pid_t pid = fork();
+	int status;
+
+	if (pid == 0)
+	{
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0)
+		return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * mount_fs - 在 workdir 中以前台模式启动 FS，等待挂载点出现新的文件系统
+ */
+int mount_fs()
+{
+	struct stat before, st;
+	char *argv[8];
+	int argc = 0;
+
+	if (stat(mountpoint, &before) != 0)
+		return -1;
+
+	argv[argc++] = (char *)md.fs_path;
+	argv[argc++] = "-f";
+	if (md.fs_opts != NULL)
+	{
+		argv[argc++] = "-o";
+		argv[argc++] = (char *)md.fs_opts;
+	}
+	argv[argc++] = mountpoint;
+	argv[argc] = NULL;
+
+	fs_pid = fork();
+	if (fs_pid == 0)
+	{
+		if (chdir(workdir) != 0)
+			_exit(127);
+
+		int log = open("fs.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (log >= 0)
+		{
+			dup2(log, STDOUT_FILENO);
+			dup2(log, STDERR_FILENO);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (fs_pid < 0)
+		return -1;
+
+	for (int waited = 0; waited < MOUNT_TIMEOUT_MS; waited += 10)
+	{
+		if (stat(mountpoint, &st) == 0 && st.st_dev != before.st_dev)
+			return 0;
+		if (waitpid(fs_pid, NULL, WNOHANG) == fs_pid)
+		{
+			fs_pid = -1;
+			return -1;
+		}
+		usleep(10000);
+	}
+	return -1;
+}
+
+void unmount_fs()
+{
+	char *argv[] = {"fusermount", "-u", mountpoint, NULL};
+
+	if (fs_pid <= 0)
+		return;
+	if (run_command(argv) != 0)
+		kill(fs_pid, SIGTERM);
+	waitpid(fs_pid, NULL, 0);
+	fs_pid = -1;
+}
+
+/*
+ * cleanup - 卸载并删除临时目录（atexit 注册，可以重复调用）
+ */
+void cleanup()
+{
+	char path[PATH_MAX];
+
+	unmount_fs();
+	if (md.keep || workdir[0] == '\0')
+		return;
+
+	const char *files[] = {"fs.img", "file_structure.bin", "journal.bin", "fs.log"};
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		if (snprintf(path, sizeof(path), "%s/%s", workdir, files[i]) < (int)sizeof(path))
+			unlink(path);
+	}
+	rmdir(mountpoint);
+	rmdir(workdir);
+}
+
+void on_signal(int sig)
+{
+	cleanup();
+	_exit(128 + sig);
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [-x fs_binary] [-o fs_options] [-t threads[,threads...]]\n"
+			"          [-b branch] [-z depth] [-I items_per_dir] [-k]\n"
+			"-k: keep the temporary directory (fs.img, fs.log)\n",
+			prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	char fs_path[PATH_MAX];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "x:o:t:b:z:I:k")) != -1)
+	{
+		switch (opt)
+		{
+		case 'x':
+			md.fs_path = optarg;
+			break;
+		case 'o':
+			md.fs_opts = optarg;
+			break;
+		case 't':
+			md.threads = optarg;
+			break;
+		case 'b':
+			md.branch = atoi(optarg);
+			break;
+		case 'z':
+			md.depth = atoi(optarg);
+			break;
+		case 'I':
+			md.items = atoi(optarg);
+			break;
+		case 'k':
+			md.keep = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (md.branch < 1 || md.depth < 0 || md.depth > 64 || md.items < 0)
+		usage(argv[0]);
+
+	// FS 在临时目录中运行，先把它的路径转换为绝对路径
+	if (realpath(md.fs_path, fs_path) == NULL)
+	{
+		perror(md.fs_path);
+		return 1;
+	}
+	md.fs_path = fs_path;
+
+	snprintf(workdir, sizeof(workdir), "/tmp/mdbench.XXXXXX");
+	if (mkdtemp(workdir) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	md_path(mountpoint, sizeof(mountpoint), "%s/mnt", workdir);
+	atexit(cleanup);
+	if (mkdir(mountpoint, 0755) != 0 || chdir(workdir) != 0)
+	{
+		perror(mountpoint);
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (mount_fs() != 0)
+	{
+		fprintf(stderr, "mount failed, see %s/fs.log\n", workdir);
+		md.keep = 1;
+		return 1;
+	}
+
+	build_tree();
+	printf("tree: branch %d depth %d items %d -> %d dirs, %d files per thread\n",
+		   md.branch, md.depth, md.items, ndirs, ndirs * md.items);
+	printf("%7s %-8s %9s %9s %11s %9s %9s %9s %9s\n", "threads", "phase", "ops", "seconds", "ops/s", "p50_us", "p90_us", "p99_us", "max_us");
+
+	char *list = strdup(md.threads);
+	int round = 0;
+	for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ","))
+	{
+		int n = atoi(tok);
+		if (n < 1 || n > MAX_THREADS)
+		{
+			fprintf(stderr, "invalid thread count %s\n", tok);
+			break;
+		}
+		run_suite(n, round++);
+	}
+	free(list);
+	return 0;
+}
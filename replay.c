@@ -0,0 +1,671 @@
+/*
+ * replay.c - 回放 -o trace=FILE 记录的负载
+ *
+ * 功能：
+ * 1. 直接包含 FS.c（定义 FS_NO_MAIN 去掉它的 main），把记录文件中的回调按原来的顺序
+ *    交给 operations 表执行，不经过内核和 FUSE 通信。
+ * 2. 默认以最快速度回放；-s N 按记录中的时间间隔回放，N 为倍速（1 为原速）。
+ * 3. 输出每种操作的次数、失败次数、与记录结果不一致的次数，以及记录时和回放时的延迟分位数，
+ *    用于对比路径解析、分配器或持久化等改动在同一负载下的效果。
+ *
+ * 实现逻辑：
+ * 1. 记录按完成顺序写入，依赖其他操作结果的操作总在它们之后，回放时单线程按文件顺序执行。
+ * 2. 记录开始之前就已存在的文件和目录不在记录中，回放前先（不计时）把它们建出来，见 prepare：
+ *    被读写、打开、列出、删除或成功 getattr 但此前没有创建过的路径视为已存在，
+ *    作为父目录出现或被 readdir 的是目录，其余是文件，文件大小取回放中读到的最大偏移。
+ * 3. 记录中的文件句柄（fh）只是原进程里的指针值，回放时 open / create 成功后把它
+ *    对应到新的句柄，之后的 read / write / release 通过它找到新句柄，见 handle_find。
+ *
+ * 编译：
+ * gcc -O2 replay.c -o replay `pkg-config fuse --cflags --libs`
+ *
+ * 示例：
+ * ./FS -o trace=/tmp/app.trace /home/test     采集负载，卸载后记录文件完整
+ * ./replay /tmp/app.trace                     以最快速度回放
+ * ./replay -s 1 -x /tmp/app.trace             按原速回放，结束时输出 /.fsstats
+ *
+ * 注意：
+ * - 与 bench.c 相同，在 -d 指定的目录（默认新建的临时目录）中创建新的文件系统，结束后删除。
+ * - 写入的数据内容没有记录，回放时用固定的字节填充。
+ * - lookup 按 getattr 回放，forget 不回放；低层接口的记录没有结果，不参与一致性比较。
+ * - 原进程中并发执行的回调在回放时串行执行，回放延迟中没有锁争用。
+ */
+#define FS_NO_MAIN
+// 回放只输出警告和错误，避免 SAVING 等日志混入结果
+#define LOG_LEVEL 1
+#include "FS.c"
+
+#include <getopt.h>
+
+struct
+{
+	double speed;	   // 回放倍速，0 表示不等待
+	const char *dir;   // 工作目录
+	int prepare;	   // 回放前建立记录开始之前就已存在的文件
+	int stats;		   // 结束时输出 /.fsstats
+} replay = {0, NULL, 1, 0};
+
+typedef struct replay_op
+{
+	uint64_t count;				 // 回放次数
+	uint64_t errors;			 // 回放返回错误的次数
+	uint64_t mismatches;		 // 回放结果与记录结果不一致的次数
+	uint64_t max_ns;			 // 记录中的最大耗时
+	uint64_t hist[HIST_BUCKETS]; // 记录中的延迟直方图
+} replay_op;
+
+replay_op ops[OP_COUNT];
+
+/*
+ * 记录文件
+ *
+ * - trace_data 是整个文件的内容，entries 指向其中每条记录的开头。
+ * - entry_path / entry_path2 把记录中不带 '\0' 的路径复制到调用者的缓冲区。
+ */
+char *trace_data;
+trace_entry **entries;
+size_t entry_count;
+uint32_t max_io_size;
+
+int load_trace(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	size_t size = 0, capacity = 1 << 20, n;
+
+	if (file == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	trace_data = malloc(capacity);
+	while ((n = fread(trace_data + size, 1, capacity - size, file)) > 0)
+	{
+		size += n;
+		if (size == capacity)
+			trace_data = realloc(trace_data, capacity *= 2);
+	}
+	fclose(file);
+
+	trace_header *hdr = (trace_header *)trace_data;
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+		hdr->version != TRACE_VERSION || hdr->entry_size != sizeof(trace_entry))
+	{
+		fprintf(stderr, "%s: not a trace file of this version\n", path);
+		return -1;
+	}
+
+	size_t entry_capacity = 1024;
+	entries = malloc(entry_capacity * sizeof(*entries));
+	for (size_t pos = sizeof(*hdr); pos < size;)
+	{
+		trace_entry *e = (trace_entry *)(trace_data + pos);
+		if (size - pos < sizeof(*e) || size - pos - sizeof(*e) < (size_t)e->path_len + e->path2_len ||
+			e->path_len >= TRACE_PATH_MAX || e->path2_len >= TRACE_PATH_MAX || e->op >= OP_COUNT)
+		{
+			// 进程没有正常卸载时最后一条记录可能不完整
+			fprintf(stderr, "%s: truncated at entry %zu, replaying the first %zu\n", path, entry_count, entry_count);
+			break;
+		}
+		if (entry_count == entry_capacity)
+			entries = realloc(entries, (entry_capacity *= 2) * sizeof(*entries));
+		entries[entry_count++] = e;
+		if (e->size > max_io_size)
+			max_io_size = e->size;
+		pos += sizeof(*e) + e->path_len + e->path2_len;
+	}
+	return 0;
+}
+
+void entry_path(trace_entry *e, char *path)
+{
+	memcpy(path, (char *)(e + 1), e->path_len);
+	path[e->path_len] = '\0';
+}
+
+void entry_path2(trace_entry *e, char *path)
+{
+	memcpy(path, (char *)(e + 1) + e->path_len, e->path2_len);
+	path[e->path2_len] = '\0';
+}
+
+int entry_ok(trace_entry *e)
+{
+	return e->result == TRACE_NO_RESULT || e->result >= 0;
+}
+
+/*
+ * 回放前已存在的路径
+ *
+ * 功能：
+ * 1. path_table 是以路径为键的开放寻址哈希表，记录 prepare 扫描时每个路径的状态。
+ * 2. preexisting 的路径在回放前建立：目录按路径深度从浅到深 mkdir，文件 create 后写到 size。
+ */
+typedef struct path_state
+{
+	char *path;
+	int exists;		 // 扫描到当前记录时是否存在
+	int preexisting; // 第一次出现时不是由记录中的操作创建的
+	int is_dir;
+	uint64_t size; // 已存在文件需要的大小
+} path_state;
+
+path_state *path_table;
+size_t path_table_size, path_table_used;
+
+uint64_t path_hash(const char *path)
+{
+	uint64_t h = 1469598103934665603ull;
+
+	for (; *path; path++)
+		h = (h ^ (unsigned char)*path) * 1099511628211ull;
+	return h;
+}
+
+path_state *path_find(const char *path, int insert)
+{
+	if (insert && (path_table_used + 1) * 2 > path_table_size)
+	{
+		path_state *old = path_table;
+		size_t old_size = path_table_size;
+
+		path_table_size = old_size ? old_size * 2 : 1024;
+		path_table = calloc(path_table_size, sizeof(path_state));
+		for (size_t i = 0; i < old_size; i++)
+		{
+			if (old[i].path == NULL)
+				continue;
+			size_t j = path_hash(old[i].path) & (path_table_size - 1);
+			while (path_table[j].path != NULL)
+				j = (j + 1) & (path_table_size - 1);
+			path_table[j] = old[i];
+		}
+		free(old);
+	}
+	if (path_table_size == 0)
+		return NULL;
+
+	size_t i = path_hash(path) & (path_table_size - 1);
+	while (path_table[i].path != NULL)
+	{
+		if (strcmp(path_table[i].path, path) == 0)
+			return &path_table[i];
+		i = (i + 1) & (path_table_size - 1);
+	}
+	if (!insert)
+		return NULL;
+	path_table[i].path = strdup(path);
+	path_table_used++;
+	return &path_table[i];
+}
+
+/*
+ * need_path - 当前记录要求 path 已经存在
+ *
+ * 注意：
+ * - 第一次出现的路径标记为 preexisting，它的父目录也递归地标记为已存在的目录。
+ */
+path_state *need_path(const char *path, int is_dir)
+{
+	char parent[TRACE_PATH_MAX];
+
+	if (path[0] != '/' || path[1] == '\0' || stats_path(path))
+		return NULL;
+
+	snprintf(parent, sizeof(parent), "%s", path);
+	*strrchr(parent, '/') = '\0';
+	if (parent[0] != '\0')
+		need_path(parent, 1);
+
+	path_state *state = path_find(path, 0);
+	if (state == NULL)
+	{
+		state = path_find(path, 1);
+		state->exists = state->preexisting = 1;
+	}
+	if (state->preexisting && state->exists)
+		state->is_dir |= is_dir;
+	return state;
+}
+
+/*
+ * created_path / removed_path - 当前记录创建或删除了 path
+ */
+void created_path(const char *path)
+{
+	char parent[TRACE_PATH_MAX];
+
+	snprintf(parent, sizeof(parent), "%s", path);
+	*strrchr(parent, '/') = '\0';
+	if (parent[0] != '\0')
+		need_path(parent, 1);
+
+	path_state *state = path_find(path, 1);
+	state->exists = 1;
+}
+
+void removed_path(const char *path)
+{
+	path_state *state = path_find(path, 0);
+
+	if (state != NULL)
+		state->exists = 0;
+}
+
+int cmp_path_depth(const void *a, const void *b)
+{
+	const path_state *x = *(path_state *const *)a, *y = *(path_state *const *)b;
+	int dx = 0, dy = 0;
+
+	for (const char *p = x->path; *p; p++)
+		dx += *p == '/';
+	for (const char *p = y->path; *p; p++)
+		dy += *p == '/';
+	return dx != dy ? dx - dy : strcmp(x->path, y->path);
+}
+
+/*
+ * prepare - 扫描全部记录，建立记录开始之前就已存在的文件和目录
+ */
+void prepare(char *buf)
+{
+	char path[TRACE_PATH_MAX], path2[TRACE_PATH_MAX];
+	path_state *state;
+
+	for (size_t i = 0; i < entry_count; i++)
+	{
+		trace_entry *e = entries[i];
+		entry_path(e, path);
+		entry_path2(e, path2);
+
+		switch (e->op)
+		{
+		case OP_MKDIR:
+		case OP_CREATE:
+			if (e->result == -EEXIST)
+				need_path(path, e->op == OP_MKDIR);
+			else if (entry_ok(e) && path[0] == '/')
+				created_path(path);
+			break;
+		case OP_GETATTR:
+			// 低层接口的 getattr 带 inode 编号，对象一定存在；lookup 可能是对不存在名称的探测
+			if (entry_ok(e))
+				need_path(path, 0);
+			break;
+		case OP_LOOKUP:
+			if (e->result == 0)
+				need_path(path, 0);
+			break;
+		case OP_READDIR:
+		case OP_FSYNCDIR:
+			if (entry_ok(e))
+				need_path(path, 1);
+			break;
+		case OP_TRUNCATE:
+		case OP_OPEN:
+		case OP_READ:
+		case OP_WRITE:
+			if (entry_ok(e) && (state = need_path(path, 0)) != NULL && state->preexisting && e->op == OP_READ)
+			{
+				// 高层接口的结果是实际读到的字节数，低层接口只知道请求的大小
+				uint64_t end = e->offset + (e->result != TRACE_NO_RESULT ? (uint64_t)e->result : e->size);
+				if (end > state->size)
+					state->size = end;
+			}
+			break;
+		case OP_UNLINK:
+		case OP_RMDIR:
+			if (entry_ok(e))
+			{
+				need_path(path, e->op == OP_RMDIR);
+				removed_path(path);
+			}
+			break;
+		case OP_RENAME:
+			if (entry_ok(e) && path[0] == '/' && path2[0] == '/')
+			{
+				need_path(path, 0);
+				removed_path(path);
+				created_path(path2);
+			}
+			break;
+		}
+	}
+
+	path_state **todo = malloc((path_table_used + 1) * sizeof(path_state *));
+	size_t count = 0, dirs = 0;
+	for (size_t i = 0; i < path_table_size; i++)
+		if (path_table[i].path != NULL && path_table[i].preexisting)
+			todo[count++] = &path_table[i];
+	qsort(todo, count, sizeof(path_state *), cmp_path_depth);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		// 直接调用回调，不经过包装函数，自己归还回调使用的临时内存
+		size_t mark = scratch_mark();
+
+		state = todo[i];
+		if (state->is_dir)
+		{
+			mymkdir(state->path, 0755);
+			dirs++;
+		}
+		else
+		{
+			struct fuse_file_info fi = {.flags = O_WRONLY};
+			if (mycreate(state->path, 0644, &fi) == 0)
+			{
+				for (uint64_t off = 0; off < state->size; off += max_io_size)
+				{
+					uint64_t len = state->size - off < max_io_size ? state->size - off : max_io_size;
+					mywrite(state->path, buf, len, off, &fi);
+				}
+				myrelease(state->path, &fi);
+			}
+		}
+		scratch_reset(mark);
+	}
+	free(todo);
+	printf("prepared %zu directories and %zu files\n", dirs, count - dirs);
+}
+
+/*
+ * 文件句柄对应表
+ *
+ * - 记录中的 fh 到回放时 fuse_file_info 的对应，同时打开的句柄不多，用数组顺序查找。
+ */
+typedef struct replay_handle
+{
+	uint64_t fh;
+	struct fuse_file_info *fi;
+} replay_handle;
+
+replay_handle *handles;
+size_t handle_count, handle_capacity;
+
+struct fuse_file_info *handle_find(uint64_t fh)
+{
+	for (size_t i = 0; i < handle_count; i++)
+		if (handles[i].fh == fh)
+			return handles[i].fi;
+	return NULL;
+}
+
+void handle_add(uint64_t fh, struct fuse_file_info *fi)
+{
+	if (handle_count == handle_capacity)
+	{
+		handle_capacity = handle_capacity ? handle_capacity * 2 : 64;
+		handles = realloc(handles, handle_capacity * sizeof(replay_handle));
+	}
+	handles[handle_count].fh = fh;
+	handles[handle_count].fi = fi;
+	handle_count++;
+}
+
+void handle_remove(uint64_t fh)
+{
+	for (size_t i = 0; i < handle_count; i++)
+		if (handles[i].fh == fh)
+		{
+			free(handles[i].fi);
+			handles[i] = handles[--handle_count];
+			return;
+		}
+}
+
+int replay_filler(void *buf, const char *name, const struct stat *st, off_t off)
+{
+	return 0;
+}
+
+/*
+ * replay_entry - 通过 operations 表执行一条记录
+ *
+ * 返回值：
+ * - 回调的返回值；记录中的句柄没有对应的回放句柄（原来的 open 在回放时失败）时返回 -EBADF。
+ */
+int replay_entry(trace_entry *e, char *buf)
+{
+	char path[TRACE_PATH_MAX], path2[TRACE_PATH_MAX];
+	struct fuse_file_info *fi = e->fh != 0 ? handle_find(e->fh) : NULL;
+	struct stat st;
+	int res;
+
+	entry_path(e, path);
+	entry_path2(e, path2);
+
+	switch (e->op)
+	{
+	case OP_GETATTR:
+	case OP_LOOKUP:
+		return operations.getattr(path, &st);
+	case OP_READDIR:
+		return operations.readdir(path, NULL, replay_filler, e->offset, fi);
+	case OP_MKDIR:
+		return operations.mkdir(path, e->mode);
+	case OP_RMDIR:
+		return operations.rmdir(path);
+	case OP_UNLINK:
+		return operations.unlink(path);
+	case OP_RENAME:
+		return operations.rename(path, path2);
+	case OP_OPEN:
+	case OP_CREATE:
+		fi = calloc(1, sizeof(*fi));
+		fi->flags = e->flags;
+		res = e->op == OP_OPEN ? operations.open(path, fi) : operations.create(path, e->mode, fi);
+		if (res == 0)
+		{
+			// 原来的句柄已经关闭、指针值被复用时，丢弃旧的对应
+			handle_remove(e->fh);
+			handle_add(e->fh, fi);
+		}
+		else
+			free(fi);
+		return res;
+	case OP_RELEASE:
+		if (fi == NULL)
+			return -EBADF;
+		res = operations.release(path, fi);
+		handle_remove(e->fh);
+		return res;
+	case OP_FLUSH:
+		return fi != NULL ? operations.flush(path, fi) : -EBADF;
+	case OP_FSYNC:
+		return operations.fsync(path, e->flags, fi);
+	case OP_FSYNCDIR:
+		return operations.fsyncdir(path, e->flags, fi);
+	case OP_READ:
+		return fi != NULL ? operations.read(path, buf, e->size, e->offset, fi) : -EBADF;
+	case OP_WRITE:
+		return fi != NULL ? operations.write(path, buf, e->size, e->offset, fi) : -EBADF;
+	case OP_TRUNCATE:
+		// 低层接口的 setattr 也记为 truncate，不修改大小时只回放成 getattr
+		if (!(e->flags & FUSE_SET_ATTR_SIZE))
+			return operations.getattr(path, &st);
+		return fi != NULL ? operations.ftruncate(path, e->offset, fi) : operations.truncate(path, e->offset);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * run_replay - 按文件顺序回放全部记录
+ *
+ * 注意：
+ * - 按倍速回放时，开始时间早于上一条记录（并发的回调完成顺序与开始顺序不同）的记录不等待。
+ */
+double run_replay(char *buf)
+{
+	uint64_t start = stats_now();
+
+	for (size_t i = 0; i < entry_count; i++)
+	{
+		trace_entry *e = entries[i];
+
+		if (replay.speed > 0)
+		{
+			uint64_t target = start + (uint64_t)(e->start_ns / replay.speed), now = stats_now();
+			if (target > now)
+			{
+				struct timespec delay = {(target - now) / 1000000000, (target - now) % 1000000000};
+				nanosleep(&delay, NULL);
+			}
+		}
+
+		if (e->op == OP_FORGET)
+			continue;
+
+		int res = replay_entry(e, buf);
+		replay_op *op = &ops[e->op];
+		op->count++;
+		if (res < 0)
+			op->errors++;
+		if (e->result != TRACE_NO_RESULT && (res < 0 ? res : 0) != (e->result < 0 ? e->result : 0))
+			op->mismatches++;
+	}
+	return (stats_now() - start) / 1e9;
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr,
+			"usage: %s [-s speed] [-d dir] [-b blocks] [-i inodes] [-m cache_mb] [-n] [-x] trace\n"
+			"-s: replay at N times the recorded pace (default 0: as fast as possible)\n"
+			"-n: do not create the files and directories that existed before recording\n"
+			"-x: print /.fsstats at the end\n",
+			prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	char tmpdir[] = "/tmp/fsreplay.XXXXXX";
+	int opt;
+
+	fs_config.blocks = 1 << 20;
+	fs_config.inodes = 1 << 20;
+	while ((opt = getopt(argc, argv, "s:d:b:i:m:nx")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			replay.speed = atof(optarg);
+			break;
+		case 'd':
+			replay.dir = optarg;
+			break;
+		case 'b':
+			fs_config.blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			fs_config.inodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			fs_config.cache = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			replay.prepare = 0;
+			break;
+		case 'x':
+			replay.stats = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || replay.speed < 0)
+		usage(argv[0]);
+
+	// 在切换到工作目录之前读入记录，相对路径按当前目录解析
+	if (load_trace(argv[optind]) != 0)
+		return 1;
+	for (size_t i = 0; i < entry_count; i++)
+	{
+		replay_op *op = &ops[entries[i]->op];
+		uint64_t ns = entries[i]->duration_ns;
+		op->hist[hist_bucket(ns)]++;
+		if (ns > op->max_ns)
+			op->max_ns = ns;
+	}
+
+	if (replay.dir == NULL && (replay.dir = mkdtemp(tmpdir)) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	if (chdir(replay.dir) != 0)
+	{
+		perror(replay.dir);
+		return 1;
+	}
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+
+	// 与 main 中首次挂载的流程相同
+	cache_init();
+	journal_open();
+	if (initialize_superblock() != 0)
+		return 1;
+	initialize_root_directory();
+	if (ftruncate(journal_fd, 0) != 0)
+		perror("journal truncate");
+	operations.init(NULL);
+
+	char *buf = malloc(max_io_size ? max_io_size : 1);
+	memset(buf, 'r', max_io_size);
+	if (replay.prepare)
+		prepare(buf);
+
+	double seconds = run_replay(buf);
+	uint64_t total = 0, recorded = 0;
+	for (size_t i = 0; i < entry_count; i++)
+		if (entries[i]->start_ns + entries[i]->duration_ns > recorded)
+			recorded = entries[i]->start_ns + entries[i]->duration_ns;
+	op_stats *now = malloc(sizeof(op_stats));
+	stats_collect(now);
+
+	printf("%-10s %9s %7s %8s %11s %11s %11s %11s\n", "op", "count", "errors", "mismatch", "rec_p50_us", "p50_us", "rec_p99_us", "p99_us");
+	for (int i = 0; i < OP_COUNT; i++)
+	{
+		replay_op *op = &ops[i];
+		uint64_t rec = 0;
+
+		for (int b = 0; b < HIST_BUCKETS; b++)
+			rec += op->hist[b];
+		if (rec == 0)
+			continue;
+		total += op->count;
+		printf("%-10s %9llu %7llu %8llu %11.3f ", op_names[i], (unsigned long long)op->count,
+			   (unsigned long long)op->errors, (unsigned long long)op->mismatches,
+			   hist_percentile(op->hist, rec, op->max_ns, 0.5) / 1000.0);
+		// lookup 按 getattr 回放，耗时计入 getattr；forget 不回放
+		if (now->count[i] == 0)
+			printf("%11s %11.3f %11s\n", "-", hist_percentile(op->hist, rec, op->max_ns, 0.99) / 1000.0, "-");
+		else
+			printf("%11.3f %11.3f %11.3f\n", hist_percentile(now->hist[i], now->count[i], now->max_ns[i], 0.5) / 1000.0,
+				   hist_percentile(op->hist, rec, op->max_ns, 0.99) / 1000.0,
+				   hist_percentile(now->hist[i], now->count[i], now->max_ns[i], 0.99) / 1000.0);
+	}
+	printf("replayed %llu ops in %.3f s (%.1f ops/s), recorded over %.3f s\n", (unsigned long long)total, seconds,
+		   seconds > 0 ? total / seconds : 0, recorded / 1e9);
+	free(now);
+
+	if (replay.stats)
+	{
+		size_t len;
+		char *text = stats_render(&len);
+		if (text != NULL)
+			fwrite(text, 1, len, stdout);
+		free(text);
+	}
+
+	operations.destroy(NULL);
+	unlink("fs.img");
+	unlink("file_structure.bin");
+	unlink("journal.bin");
+	if (replay.dir == tmpdir)
+		rmdir(tmpdir);
+	return 0;
+}